@@ -43,6 +43,13 @@ struct asm_opt_t {
     bool no_bubble;
     int min_standalone;
     int min_contig;
+    bool output_mask;
+    bool mask_only;
+    bool unitig_clean;
+    int merge_len;
+    double merge_similar;
+    double low_local_ratio;
+    double max_local_depth;
     
     asm_opt_t() {
         output_prefix = "out";
@@ -51,11 +58,22 @@ struct asm_opt_t {
         no_bubble = false;
         min_standalone = 400;
         min_contig = 0;
+        output_mask = false;
+        mask_only = false;
+        unitig_clean = false;
+        merge_len = 20;
+        merge_similar = 0.98;
+        low_local_ratio = 0.2;
+        max_local_depth = 10;
     }
 
     string contig_file() {
         return output_prefix + ".contigs.fa";
     }
+
+    string invalid_mask_file() {
+        return output_prefix + ".invalid_mask";
+    }
 };
 
 static asm_opt_t opt;
@@ -70,6 +88,13 @@ void ParseAsmOption(int argc, char *argv[]) {
     desc.AddOption("no_bubble", "", opt.no_bubble, "do not remove bubbles");
     desc.AddOption("min_standalone", "", opt.min_standalone, "min length of a standalone contig to output to final.contigs.fa");
     desc.AddOption("min_contig", "", opt.min_contig, "min length of contig to output");
+    desc.AddOption("output_mask", "", opt.output_mask, "write the edges removed by cleaning to OUTPUT_PREFIX.invalid_mask, to be loaded by search");
+    desc.AddOption("mask_only", "", opt.mask_only, "only clean the graph and write the mask, without contigs");
+    desc.AddOption("unitig_clean", "", opt.unitig_clean, "build the unitig graph first and clean tips, bubbles and local low depth unitigs on it");
+    desc.AddOption("merge_len", "", opt.merge_len, "merge complex bubbles of length <= merge_len * k; 0 to disable. only for --unitig_clean");
+    desc.AddOption("merge_similar", "", opt.merge_similar, "min similarity of merging complex bubbles. only for --unitig_clean");
+    desc.AddOption("low_local_ratio", "", opt.low_local_ratio, "ratio to define low depth unitigs against their neighbors; 0 to disable. only for --unitig_clean");
+    desc.AddOption("max_local_depth", "", opt.max_local_depth, "max depth of a low local depth unitig. only for --unitig_clean");
 
     try {
         desc.Parse(argc, argv);
@@ -95,6 +120,95 @@ void PrintStat(Histgram<int64_t> &h) {
     xlog("Maximum length: %llu\n", h.maximum());
 }
 
+/**
+ * @brief clean tips, bubbles and local low depth unitigs in rounds until nothing changes;
+ * each round only visits the unitig vertices instead of all the edges
+ */
+static void CleanUnitigGraph(UnitigGraph &unitig_graph, int kmer_k) {
+    const int kLocalWidth = 1000;
+    const int kMaxRounds = 20;
+    xtimer_t timer;
+    Histgram<int64_t> bubble_hist;
+
+    for (int round = 1; round <= kMaxRounds; ++round) {
+        timer.reset();
+        timer.start();
+        int64_t num_tips = 0, num_bubbles = 0, num_complex = 0, num_low_depth = 0;
+
+        if (opt.max_tip_len > 0) {
+            num_tips = unitig_graph.RemoveTips(opt.max_tip_len);
+        }
+
+        if (!opt.no_bubble) {
+            num_bubbles = unitig_graph.MergeBubbles(true, false, NULL, bubble_hist);
+
+            if (opt.merge_len > 0) {
+                num_complex = unitig_graph.MergeComplexBubbles(opt.merge_similar, opt.merge_len, true, false, NULL, bubble_hist);
+            }
+        }
+
+        if (opt.low_local_ratio > 0) {
+            for (double min_depth = 1; min_depth < opt.max_local_depth; min_depth *= 1.1) {
+                if (!unitig_graph.RemoveLocalLowDepth(min_depth, std::max(opt.max_tip_len, kmer_k + 1), kLocalWidth,
+                                                      opt.low_local_ratio, num_low_depth, true)) {
+                    break;
+                }
+            }
+        }
+
+        timer.stop();
+        xlog("Round %d: %lld tips, %lld bubbles, %lld complex bubbles, %lld local low depth removed; time elapsed(sec): %lf\n",
+             round, (long long)num_tips, (long long)num_bubbles, (long long)num_complex, (long long)num_low_depth, timer.elapsed());
+
+        if (num_tips + num_bubbles + num_complex + num_low_depth == 0) {
+            break;
+        }
+    }
+}
+
+static void SaveMask(SuccinctDBG &dbg) {
+    xtimer_t timer;
+    timer.reset();
+    timer.start();
+    dbg.SaveInvalidMask(opt.invalid_mask_file().c_str());
+    timer.stop();
+    xlog("Invalid edge mask written to %s, time elapsed(sec): %lf\n", opt.invalid_mask_file().c_str(), timer.elapsed());
+}
+
+static int AssembleOnUnitigGraph(SuccinctDBG &dbg) {
+    xtimer_t timer;
+    timer.reset();
+    timer.start();
+    UnitigGraph unitig_graph(&dbg);
+    unitig_graph.InitFromSdBG();
+    timer.stop();
+    xlog("unitig graph size: %u, time for building: %lf\n", unitig_graph.size(), timer.elapsed());
+
+    CleanUnitigGraph(unitig_graph, dbg.kmer_k);
+
+    if (opt.output_mask || opt.mask_only) {
+        SaveMask(dbg);
+
+        if (opt.mask_only) {
+            return 0;
+        }
+    }
+
+    FILE *out_contig_file = OpenFileAndCheck(opt.contig_file().c_str(), "w");
+    FILE *out_contig_info = OpenFileAndCheck((opt.contig_file() + ".info").c_str(), "w");
+    Histgram<int64_t> hist;
+    unitig_graph.OutputContigs(out_contig_file, NULL, hist, false, opt.min_standalone, opt.min_contig);
+
+    PrintStat(hist);
+
+    fprintf(out_contig_info, "%lld %lld\n", (long long)(hist.size()), (long long)(hist.sum()));
+
+    fclose(out_contig_file);
+    fclose(out_contig_info);
+
+    return 0;
+}
+
 int main_assemble(int argc, char **argv) {
     ParseAsmOption(argc, argv);
 
@@ -106,7 +220,8 @@ int main_assemble(int argc, char **argv) {
         timer.reset();
         timer.start();
         xlog("Loading succinct de Bruijn graph: %s ", opt.sdbg_name.c_str());
-        dbg.LoadFromMultiFile(opt.sdbg_name.c_str(), false);
+        // unitig cleaning compares depths, which need the exact multiplicities
+        dbg.LoadFromMultiFile(opt.sdbg_name.c_str(), opt.unitig_clean);
         timer.stop();
         xlog_ext("Done. Time elapsed: %lf\n", timer.elapsed());
         xlog("Number of Edges: %lld; K value: %d\n", (long long)dbg.size, dbg.kmer_k);
@@ -126,6 +241,10 @@ int main_assemble(int argc, char **argv) {
         }
     }
 
+    if (opt.unitig_clean) {
+        return AssembleOnUnitigGraph(dbg);
+    }
+
     if (opt.max_tip_len > 0) { // tips removal
         timer.reset();
         timer.start();
@@ -144,6 +263,14 @@ int main_assemble(int argc, char **argv) {
              num_bubbles, timer.elapsed());
     }
 
+    if (opt.output_mask || opt.mask_only) {
+        SaveMask(dbg);
+
+        if (opt.mask_only) {
+            return 0;
+        }
+    }
+
     // output contigs
     FILE *out_contig_file = OpenFileAndCheck(opt.contig_file().c_str(), "w");
     FILE *out_contig_info = OpenFileAndCheck((opt.contig_file() + ".info").c_str(), "w");
@@ -73,111 +73,167 @@ double SetMinDepth(SuccinctDBG &dbg) {
     return 1;
 }
 
-int64_t Trim(SuccinctDBG &dbg, int len, int min_final_standalone) {
+/**
+ * @brief walk from a dead end towards the node it branches from, backward if it has no outgoing edges
+ * @return whether it is a tip shorter than len, whose nodes are put in path and the branching node (-1 if none) in junction
+ */
+static bool FindTip(SuccinctDBG &dbg, int64_t node_idx, bool backward, int len, vector<int64_t> &path, int64_t &junction) {
+    path.clear();
+    path.push_back(node_idx);
+    junction = -1;
+    int64_t cur_node = node_idx;
+
+    for (int i = 1; i < len; ++i) {
+        int64_t next_node = backward ? dbg.UniquePrevNode(cur_node) : dbg.UniqueNextNode(cur_node);
+
+        if (next_node == -1) {
+            return backward ? dbg.NodeIndegreeZero(cur_node) : dbg.NodeOutdegreeZero(cur_node); // && (i + dbg.kmer_k - 1 < min_final_standalone);
+        }
+        else if ((backward ? dbg.UniqueNextNode(next_node) : dbg.UniquePrevNode(next_node)) == -1) {
+            junction = next_node;
+            return true;
+        }
+        else {
+            path.push_back(next_node);
+            cur_node = next_node;
+        }
+    }
+
+    return false;
+}
+
+static bool IsRemoved(int64_t node_idx) {
+    return removed_nodes.get(node_idx);
+}
+
+/**
+ * @brief remove the tips shorter than len that start from the dead ends
+ * the removed nodes and the junctions of the removed tips are appended to the per-thread vectors
+ */
+static int64_t TrimDeadEnds(SuccinctDBG &dbg, int len, vector<int64_t> &dead_ends, bool backward,
+                            vector<vector<int64_t> > &removed, vector<vector<int64_t> > &junctions) {
     int64_t number_tips = 0;
 
     #pragma omp parallel for reduction(+:number_tips)
 
-    for (int64_t node_idx = 0; node_idx < dbg.size; ++node_idx) {
-        if (dbg.IsLast(node_idx) && !removed_nodes.get(node_idx) && dbg.NodeOutdegreeZero(node_idx)) {
-            vector<int64_t> path = {node_idx};
-            int64_t prev_node;
-            int64_t cur_node = node_idx;
-            bool is_tip = false;
-
-            for (int i = 1; i < len; ++i) {
-                prev_node = dbg.UniquePrevNode(cur_node);
-
-                if (prev_node == -1) {
-                    is_tip = dbg.NodeIndegreeZero(cur_node); // && (i + dbg.kmer_k - 1 < min_final_standalone);
-                    break;
-                }
-                else if (dbg.UniqueNextNode(prev_node) == -1) {
-                    is_tip = true;
-                    break;
-                }
-                else {
-                    path.push_back(prev_node);
-                    cur_node = prev_node;
-                }
+    for (size_t i = 0; i < dead_ends.size(); ++i) {
+        if (removed_nodes.get(dead_ends[i])) {
+            continue;
+        }
+
+        vector<int64_t> path;
+        int64_t junction;
+
+        if (FindTip(dbg, dead_ends[i], backward, len, path, junction)) {
+            int tid = omp_get_thread_num();
+
+            for (unsigned j = 0; j < path.size(); ++j) {
+                removed_nodes.set(path[j]);
             }
 
-            if (is_tip) {
-                for (unsigned i = 0; i < path.size(); ++i) {
-                    removed_nodes.set(path[i]);
-                }
+            removed[tid].insert(removed[tid].end(), path.begin(), path.end());
 
-                ++number_tips;
+            if (junction != -1) {
+                junctions[tid].push_back(junction);
             }
+
+            ++number_tips;
         }
     }
 
-    #pragma omp parallel for reduction(+:number_tips)
-
-    for (int64_t node_idx = 0; node_idx < dbg.size; ++node_idx) {
-        if (dbg.IsLast(node_idx) && !removed_nodes.get(node_idx) && dbg.NodeIndegreeZero(node_idx)) {
-            vector<int64_t> path = {node_idx};
-            int64_t next_node;
-            int64_t cur_node = node_idx;
-            bool is_tip = false;
-
-            for (int i = 1; i < len; ++i) {
-                next_node = dbg.UniqueNextNode(cur_node);
-
-                if (next_node == -1) {
-                    is_tip = dbg.NodeOutdegreeZero(cur_node); // && (i + dbg.kmer_k - 1 < min_final_standalone);
-                    break;
-                }
-                else if (dbg.UniquePrevNode(next_node) == -1) {
-                    is_tip = true;
-                }
-                else {
-                    path.push_back(next_node);
-                    cur_node = next_node;
-                }
-            }
+    return number_tips;
+}
 
-            if (is_tip) {
-                for (unsigned i = 0; i < path.size(); ++i) {
-                    removed_nodes.set(path[i]);
-                }
+static void AddNewDeadEnds(SuccinctDBG &dbg, vector<vector<int64_t> > &junctions, bool no_out, vector<int64_t> &dead_ends) {
+    vector<int64_t> candidates;
 
-                ++number_tips;
-            }
-        }
+    for (unsigned t = 0; t < junctions.size(); ++t) {
+        candidates.insert(candidates.end(), junctions[t].begin(), junctions[t].end());
     }
 
-    #pragma omp parallel for
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
 
-    for (int64_t node_idx = 0; node_idx < dbg.size; ++node_idx) {
-        if (removed_nodes.get(node_idx)) {
-            dbg.DeleteAllEdges(node_idx);
+    for (unsigned i = 0; i < candidates.size(); ++i) {
+        if (!removed_nodes.get(candidates[i]) &&
+                (no_out ? dbg.NodeOutdegreeZero(candidates[i]) : dbg.NodeIndegreeZero(candidates[i]))) {
+            dead_ends.push_back(candidates[i]);
         }
     }
-
-    return number_tips;
 }
 
+/**
+ * @brief the dead ends are found by a single sweep, and a tip is walked again only if it was too long for the last length;
+ * removing tips only exposes their junctions as new dead ends, so they are the only nodes checked again.
+ * tips are removed in the same order as sweeping the whole graph for len = 2, 4, 8, ..., max_tip_len
+ */
 int64_t RemoveTips(SuccinctDBG &dbg, int max_tip_len, int min_final_standalone) {
     int64_t number_tips = 0;
     xtimer_t timer;
     removed_nodes.reset(dbg.size);
 
-    for (int len = 2; len < max_tip_len; len *= 2) {
+    int num_threads = omp_get_max_threads();
+    vector<vector<int64_t> > no_out_per_thread(num_threads), no_in_per_thread(num_threads);
+    vector<int64_t> no_out, no_in;
+
+    timer.reset();
+    timer.start();
+
+    #pragma omp parallel for
+
+    for (int64_t node_idx = 0; node_idx < dbg.size; ++node_idx) {
+        if (dbg.IsLast(node_idx)) {
+            if (dbg.NodeOutdegreeZero(node_idx)) {
+                no_out_per_thread[omp_get_thread_num()].push_back(node_idx);
+            }
+
+            if (dbg.NodeIndegreeZero(node_idx)) {
+                no_in_per_thread[omp_get_thread_num()].push_back(node_idx);
+            }
+        }
+    }
+
+    for (int t = 0; t < num_threads; ++t) {
+        no_out.insert(no_out.end(), no_out_per_thread[t].begin(), no_out_per_thread[t].end());
+        no_in.insert(no_in.end(), no_in_per_thread[t].begin(), no_in_per_thread[t].end());
+        vector<int64_t>().swap(no_out_per_thread[t]);
+        vector<int64_t>().swap(no_in_per_thread[t]);
+    }
+
+    timer.stop();
+    xlog("Dead ends: %lu without outgoing edges, %lu without incoming edges; time elapsed: %.4f\n", no_out.size(), no_in.size(), timer.elapsed());
+
+    for (int len = 2; ; len *= 2) {
+        len = std::min(len, max_tip_len);
         xlog("Removing tips with length less than %d; ", len);
         timer.reset();
         timer.start();
-        number_tips += Trim(dbg, len, min_final_standalone);
+
+        vector<vector<int64_t> > removed(num_threads), out_junctions(num_threads), in_junctions(num_threads);
+        number_tips += TrimDeadEnds(dbg, len, no_out, true, removed, out_junctions);
+        number_tips += TrimDeadEnds(dbg, len, no_in, false, removed, in_junctions);
+
+        #pragma omp parallel for
+
+        for (int t = 0; t < num_threads; ++t) {
+            for (unsigned i = 0; i < removed[t].size(); ++i) {
+                dbg.DeleteAllEdges(removed[t][i]);
+            }
+        }
+
+        // a junction loses edges only on the side of its removed tips, so it can only become a dead end of that side
+        no_out.erase(std::remove_if(no_out.begin(), no_out.end(), IsRemoved), no_out.end());
+        no_in.erase(std::remove_if(no_in.begin(), no_in.end(), IsRemoved), no_in.end());
+        AddNewDeadEnds(dbg, out_junctions, true, no_out);
+        AddNewDeadEnds(dbg, in_junctions, false, no_in);
+
         timer.stop();
         xlog_ext("Accumulated tips removed: %lld; time elapsed: %.4f\n", (long long)number_tips, timer.elapsed());
-    }
 
-    xlog("Removing tips with length less than %d; ", max_tip_len);
-    timer.reset();
-    timer.start();
-    number_tips += Trim(dbg, max_tip_len, min_final_standalone);
-    timer.stop();
-    xlog_ext("Accumulated tips removed: %lld; time elapsed: %.4f\n", (long long)number_tips, timer.elapsed());
+        if (len == max_tip_len) {
+            break;
+        }
+    }
 
     return number_tips;
 }
@@ -242,56 +298,82 @@ void MarkSubGraph(SuccinctDBG &dbg, const char *seq, int seq_len) {
 }
 
 
+/**
+ * @brief try to pop the bubbles starting from the candidates in parallel; a bubble owns its inner nodes through
+ * removed_nodes, so overlapping bubbles never pop together and the losers are kept in the per-thread vectors
+ */
+static int64_t PopCandidates(SuccinctDBG &dbg, vector<int64_t> &candidates, int max_bubble_len,
+                             vector<vector<int64_t> > &failed) {
+    int64_t num_bubbles = 0;
+
+    #pragma omp parallel for reduction(+: num_bubbles)
+
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        BranchGroup bubble(&dbg, candidates[i], BranchGroup::kMaxBranches, max_bubble_len);
+
+        if (bubble.Search()) {
+            if (bubble.Pop(removed_nodes)) {
+                ++num_bubbles;
+            } else {
+                failed[omp_get_thread_num()].push_back(candidates[i]);
+            }
+        }
+    }
+
+    return num_bubbles;
+}
+
+static void GatherPerThread(vector<vector<int64_t> > &per_thread, vector<int64_t> &gathered) {
+    gathered.clear();
+
+    for (unsigned t = 0; t < per_thread.size(); ++t) {
+        gathered.insert(gathered.end(), per_thread[t].begin(), per_thread[t].end());
+        vector<int64_t>().swap(per_thread[t]);
+    }
+}
+
+/**
+ * @brief bubbles are detected into per-thread vectors and popped in rounds without any lock;
+ * the conflicting ones are retried while a round still pops something, and the rest are popped by one thread
+ */
 int64_t PopBubbles(SuccinctDBG &dbg) {
-    omp_lock_t bubble_lock;
-    omp_init_lock(&bubble_lock);
-    const int kMaxBranchesPerGroup = 16;
     int max_bubble_len = dbg.kmer_k * 2 + 4;
-    vector<std::pair<int, int64_t> > bubble_candidates, bubble_candidates2;
+    int num_threads = omp_get_max_threads();
+    vector<vector<int64_t> > per_thread(num_threads);
+    vector<int64_t> candidates;
     int64_t num_bubbles = 0;
     removed_nodes.reset(dbg.size, 0);
 
-#pragma omp parallel for
+    #pragma omp parallel for
+
     for (int64_t edge_idx = 0; edge_idx < dbg.size; ++edge_idx) {
         if (dbg.IsValidEdge(edge_idx)) {
-            BranchGroup bubble(&dbg, edge_idx, kMaxBranchesPerGroup, max_bubble_len);
+            BranchGroup bubble(&dbg, edge_idx, BranchGroup::kMaxBranches, max_bubble_len);
+
             if (bubble.Search()) {
-                omp_set_lock(&bubble_lock);
-                bubble_candidates.push_back(std::make_pair(bubble.length(), edge_idx));
-                omp_unset_lock(&bubble_lock);
+                per_thread[omp_get_thread_num()].push_back(edge_idx);
             }
         }
     }
 
-#pragma omp parallel for reduction(+: num_bubbles)
-    for (unsigned i = 0; i < bubble_candidates.size(); ++i) {
-        BranchGroup bubble(&dbg, bubble_candidates[i].second, kMaxBranchesPerGroup, max_bubble_len);
-        if (bubble.Search()) {
-            if (bubble.Pop(removed_nodes)) {
-                ++num_bubbles;
-            } else {
-                omp_set_lock(&bubble_lock);
-                bubble_candidates2.push_back(std::make_pair(bubble.length(), bubble_candidates[i].second));
-                omp_unset_lock(&bubble_lock);
-            }
-        }
-    }
+    GatherPerThread(per_thread, candidates);
 
-    xlog("1-pass: pop %lld bubbles, %lld remained\n", num_bubbles, bubble_candidates2.size());
+    for (int round = 1; !candidates.empty(); ++round) {
+        int64_t popped = PopCandidates(dbg, candidates, max_bubble_len, per_thread);
+        num_bubbles += popped;
+        GatherPerThread(per_thread, candidates);
+        xlog("%d-pass: pop %lld bubbles, %lu remained\n", round, (long long)popped, candidates.size());
 
-#pragma omp parallel for reduction(+: num_bubbles)
-    for (unsigned i = 0; i < bubble_candidates2.size(); ++i) {
-        BranchGroup bubble(&dbg, bubble_candidates2[i].second, kMaxBranchesPerGroup, max_bubble_len);
-        if (bubble.Search()) {
-            omp_set_lock(&bubble_lock);
-            if (bubble.Pop(removed_nodes)) {
-                ++num_bubbles;
-            }
-            omp_unset_lock(&bubble_lock);
+        if (popped == 0) {
+            break;
         }
     }
 
-    omp_destroy_lock(&bubble_lock);
+    if (!candidates.empty()) {
+        omp_set_num_threads(1);
+        num_bubbles += PopCandidates(dbg, candidates, max_bubble_len, per_thread);
+        omp_set_num_threads(num_threads);
+    }
 
     {
         AtomicBitVector empty;
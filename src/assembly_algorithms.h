@@ -37,7 +37,6 @@ int64_t PrevSimplePathNode(SuccinctDBG &dbg, int64_t curr_node); // return -1 if
 double SetMinDepth(SuccinctDBG &dbg);
 
 // tips removal
-int64_t Trim(SuccinctDBG &dbg, int len, int min_final_standalone);
 int64_t RemoveTips(SuccinctDBG &dbg, int max_tip_len, int min_final_standalone);
 
 // bubble merging
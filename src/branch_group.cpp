@@ -26,42 +26,41 @@ bool BranchGroup::Search() {
         return false;
     }
 
-    branches_.push_back(BranchRecord(1, begin_node_));
-    multiplicities_.push_back(0);
+    num_branches_ = 1;
+    branches_[0][0] = begin_node_;
+    branch_length_[0] = 1;
+    multiplicities_[0] = 0;
 
     bool converged = false;
 
     for (int j = 1; j < max_length_; ++j) {
-        int num_branches = branches_.size();
+        int num_branches = num_branches_;
         for (int i = 0; i < num_branches; ++i) {
-            int64_t current = branches_[i].back();
+            int64_t current = back_(i);
             int64_t outgoings[4];
             int out_degree = sdbg_->OutgoingEdges(current, outgoings);
 
             if (out_degree >= 1) {
                 // append this node the last of current branch
-                branches_[i].push_back(outgoings[0]);
+                branches_[i][branch_length_[i]++] = outgoings[0];
                 multiplicities_[i] += sdbg_->EdgeMultiplicity(outgoings[0]);
 
-                if ((int)branches_.size() + out_degree - 1 > max_branches_) {
+                if (num_branches_ + out_degree - 1 > max_branches_) {
                     // too many branches
                     return false;
                 } else {
-                    BranchRecord curr_branch = branches_[i];
                     int curr_branch_multiplicity = multiplicities_[i] - sdbg_->EdgeMultiplicity(outgoings[0]);
                     for (int x = 1; x < out_degree; ++x) {
-                        curr_branch.pop_back();
-                        curr_branch.push_back(outgoings[x]);
-                        branches_.push_back(curr_branch);
-                        multiplicities_.push_back(curr_branch_multiplicity + sdbg_->EdgeMultiplicity(outgoings[x]));
+                        multiplicities_[num_branches_] = curr_branch_multiplicity + sdbg_->EdgeMultiplicity(outgoings[x]);
+                        Fork_(i, outgoings[x]);
                     }
                 }
             }
         }
 
         // check whether all branches's last nodes are coming from this branch group
-        for (unsigned i = 0; i < branches_.size(); ++i) {
-            int64_t last_node = branches_[i].back();
+        for (int i = 0; i < num_branches_; ++i) {
+            int64_t last_node = back_(i);
             int64_t incomings[4];
             int in_degree = sdbg_->IncomingEdges(last_node, incomings);
 
@@ -70,8 +69,8 @@ bool BranchGroup::Search() {
             } else {
                 for (int x = 0; x < in_degree; ++x) {
                     bool exist_in_group = false;
-                    for (auto it = branches_.begin(); it != branches_.end(); ++it) {
-                        if ((*it)[j - 1] == incomings[x]) {
+                    for (int b = 0; b < num_branches_; ++b) {
+                        if (branch_length_[b] >= j && branches_[b][j - 1] == incomings[x]) {
                             exist_in_group = true;
                             break;
                         }
@@ -84,11 +83,11 @@ bool BranchGroup::Search() {
         }
 
         // check converge
-        end_node_ = branches_[0].back();
+        end_node_ = back_(0);
         if (sdbg_->EdgeOutdegree(end_node_) == 1) {
             converged = true;
-            for (unsigned i = 1; i < branches_.size(); ++i) {
-                if (branches_[i].back() != end_node_) {
+            for (int i = 1; i < num_branches_; ++i) {
+                if (back_(i) != end_node_) {
                     converged = false;
                     break;
                 }
@@ -105,9 +104,8 @@ bool BranchGroup::Search() {
 bool BranchGroup::Pop(AtomicBitVector &marked) {
     int best_multiplicity = multiplicities_[0];
     int best_path = 0;
-    std::vector<int64_t> locked_nodes;
 
-    for (unsigned i = 1; i < branches_.size(); ++i) {
+    for (int i = 1; i < num_branches_; ++i) {
         int curr_multiplicity = multiplicities_[i];
         if (curr_multiplicity >= best_multiplicity) {
             best_path = i;
@@ -115,25 +113,29 @@ bool BranchGroup::Pop(AtomicBitVector &marked) {
         }
     }
 
-    for (unsigned i = 0; i < branches_.size(); ++i) {
-        for (unsigned j = 1; j + 1 < branches_[i].size(); ++j) {
+    // own all inner nodes first, so that a conflicting group gives up before any edge is touched
+    for (int i = 0; i < num_branches_; ++i) {
+        for (int j = 1; j + 1 < branch_length_[i]; ++j) {
             if (!marked.try_lock(branches_[i][j])) {
-                for (auto it = locked_nodes.begin(); it != locked_nodes.end(); ++it) {
-                    marked.unset(*it);
-                    sdbg_->SetValidEdge(*it);
+                for (int ii = 0; ii <= i; ++ii) {
+                    for (int jj = 1; jj + 1 < branch_length_[ii] && (ii < i || jj < j); ++jj) {
+                        marked.unset(branches_[ii][jj]);
+                    }
                 }
                 return false;
             }
-            locked_nodes.push_back(branches_[i][j]);
-            sdbg_->SetInvalidEdge(branches_[i][j]);
         }
     }
 
-    for (unsigned j = 1; j + 1 < branches_[best_path].size(); ++j) {
-        sdbg_->SetValidEdge(branches_[best_path][j]);
+    for (int i = 0; i < num_branches_; ++i) {
+        if (i != best_path) {
+            for (int j = 1; j + 1 < branch_length_[i]; ++j) {
+                sdbg_->SetInvalidEdge(branches_[i][j]);
+            }
+        }
     }
 
-    for (unsigned j = 1; j + 1 < branches_[best_path].size(); ++j) {
+    for (int j = 1; j + 1 < branch_length_[best_path]; ++j) {
         marked.unset(branches_[best_path][j]);
     }
 
@@ -20,57 +20,58 @@
 #define BRANCH_GROUP_H_
 
 #include <stdint.h>
-#include <vector>
+#include <assert.h>
+#include <algorithm>
 #include "atomic_bit_vector.h"
 #include "succinct_dbg.h"
 
 class BranchGroup {
   public:
-    typedef std::vector<int64_t> BranchRecord;
+    static const int kMaxBranches = 16;
+    static const int kMaxBranchLength = (kMaxK + 1) * 2 + 4;
 
+    // branches are kept in fixed inline arrays, so no allocation happens when searching every edge of the graph
     BranchGroup(SuccinctDBG *sdbg, int64_t begin_node, int max_branches = 4, int max_length = 0):
-        sdbg_(sdbg), begin_node_(begin_node), max_branches_(max_branches), max_length_(max_length) {
-        branches_.reserve(max_branches_);
-        multiplicities_.reserve(max_branches_);
+        sdbg_(sdbg), begin_node_(begin_node), max_branches_(max_branches), max_length_(max_length), num_branches_(0) {
         if (max_length <= 0) {
             max_length_ = sdbg->kmer_k * 2 + 2;
         }
-    }
-
-    BranchGroup(const BranchGroup &rhs):
-        sdbg_(rhs.sdbg_), begin_node_(rhs.begin_node_), end_node_(rhs.end_node_),
-        max_branches_(rhs.max_branches_), max_length_(rhs.max_length_), branches_(rhs.branches_),
-        multiplicities_(rhs.multiplicities_) { }
 
-    BranchGroup& operator= (const BranchGroup &rhs) {
-        sdbg_ = rhs.sdbg_;
-        begin_node_ = rhs.begin_node_;
-        end_node_ = rhs.end_node_;
-        max_branches_ = rhs.max_branches_;
-        max_length_ = rhs.max_length_;
-        branches_ = rhs.branches_;
-        multiplicities_ = rhs.multiplicities_;
-
-        return *this;
+        assert(max_branches_ <= kMaxBranches);
+        assert(max_length_ <= kMaxBranchLength);
     }
 
     bool Search();
     bool Pop(AtomicBitVector &marked);
     size_t length() {
-        if (branches_.size() == 0) {
+        if (num_branches_ == 0) {
             return 0;
         }
-        return branches_[0].size();
+        return branch_length_[0];
     }
 
   private:
+    // start a new branch from branch i with its last node replaced by node
+    void Fork_(int i, int64_t node) {
+        int b = num_branches_++;
+        branch_length_[b] = branch_length_[i];
+        std::copy(branches_[i], branches_[i] + branch_length_[i] - 1, branches_[b]);
+        branches_[b][branch_length_[b] - 1] = node;
+    }
+
+    int64_t back_(int i) {
+        return branches_[i][branch_length_[i] - 1];
+    }
+
     SuccinctDBG *sdbg_;
     int64_t begin_node_;
     int64_t end_node_;
     int64_t max_branches_;
     int64_t max_length_;
-    vector<BranchRecord> branches_;
-    vector<int> multiplicities_;
+    int num_branches_;
+    int64_t branches_[kMaxBranches][kMaxBranchLength];
+    int branch_length_[kMaxBranches];
+    int multiplicities_[kMaxBranches];
 };
 
 #endif
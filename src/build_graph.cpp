@@ -23,6 +23,8 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <stdexcept>
 
 #include "cx1_read2sdbg.h"
@@ -30,12 +32,27 @@
 #include "utils.h"
 #include "definitions.h"
 
+static std::vector<std::string> SplitByComma(const std::string &s) {
+    std::vector<std::string> fields;
+
+    for (size_t begin = 0, end; begin <= s.size(); begin = end + 1) {
+        end = std::min(s.find(',', begin), s.size());
+        fields.push_back(s.substr(begin, end - begin));
+    }
+
+    return fields;
+}
+
 int build_graph(int argc, char **argv) {
     // parse option the same as kmer_count
     OptionsDescription desc;
     read2sdbg_opt_t opt;
+    std::vector<int> k_list;
+    std::vector<std::string> output_prefixes;
 
     desc.AddOption("kmer_k", "k", opt.kmer_k, "kmer size");
+    desc.AddOption("k_list", "", opt.k_list, "build the SdBGs of several k (comma separated) on one loading of the reads, instead of -k. "
+                   "--output_prefix then lists one prefix per k");
     desc.AddOption("min_kmer_frequency", "m", opt.kmer_freq_threshold, "min frequency to output an edge");
     desc.AddOption("host_mem", "", opt.host_mem, "Max memory to be used. 90% of the free memory is recommended.");
     desc.AddOption("gpu_mem", "", opt.gpu_mem, "gpu memory to be used. 0 for auto detect.");
@@ -46,6 +63,10 @@ int build_graph(int argc, char **argv) {
     desc.AddOption("output_prefix", "", opt.output_prefix, "output prefix");
     desc.AddOption("mem_flag", "", opt.mem_flag, "memory options. 0: minimize memory usage; 1: automatically use moderate memory; other: use all available mem specified by '--host_mem'");
     desc.AddOption("need_mercy", "", opt.need_mercy, "to add mercy edges.");
+    desc.AddOption("spill_dir", "", opt.spill_dir, "external memory mode: scan the reads once and spill lv1 items to this directory, preferably on local disk; the reads stay in memory");
+    desc.AddOption("direct_io", "", opt.direct_io, "write the SdBG with direct I/O, bypassing the page cache");
+    desc.AddOption("adaptive_buckets", "", opt.adaptive_buckets, "split the sorting buckets of heavy prefixes by their next chars and merge light ones, for k > 10; cuts the sorting memory when skew spreads over many prefixes");
+    desc.AddOption("compress_sdbg", "", opt.compress_sdbg, "write the SdBG as a zlib block per bucket");
 
     try {
         desc.Parse(argc, argv);
@@ -73,6 +94,27 @@ int build_graph(int argc, char **argv) {
         if (opt.num_output_threads >= opt.num_cpu_threads) {
             throw std::logic_error("Number of output threads must be less than number of CPU threads!");
         }
+
+        if (opt.k_list == "") {
+            k_list.push_back(opt.kmer_k);
+            output_prefixes.push_back(opt.output_prefix);
+        }
+        else {
+            std::vector<std::string> ks = SplitByComma(opt.k_list);
+            output_prefixes = SplitByComma(opt.output_prefix);
+
+            if (output_prefixes.size() != ks.size()) {
+                throw std::logic_error("--output_prefix must list one prefix per k of --k_list!");
+            }
+
+            for (size_t i = 0; i < ks.size(); ++i) {
+                k_list.push_back(atoi(ks[i].c_str()));
+
+                if (k_list.back() <= cx1_read2sdbg::kBucketPrefixLength || k_list.back() > kMaxK) {
+                    throw std::logic_error("Invalid k in --k_list: " + ks[i]);
+                }
+            }
+        }
     }
     catch (std::exception &e) {
         std::cerr << e.what() << std::endl;
@@ -83,7 +125,6 @@ int build_graph(int argc, char **argv) {
     }
 
     cx1_read2sdbg::read2sdbg_global_t globals;
-    globals.kmer_k = opt.kmer_k;
     globals.kmer_freq_threshold = opt.kmer_freq_threshold;
     globals.host_mem = opt.host_mem;
     globals.gpu_mem = opt.gpu_mem;
@@ -91,45 +132,59 @@ int build_graph(int argc, char **argv) {
     globals.num_output_threads = opt.num_output_threads;
     globals.read_lib_file = opt.read_lib_file;
     globals.assist_seq_file = opt.assist_seq_file;
-    globals.output_prefix = opt.output_prefix;
     globals.mem_flag = opt.mem_flag;
     globals.need_mercy = opt.need_mercy;
+    globals.direct_io = opt.direct_io;
+    globals.compress_sdbg = opt.compress_sdbg;
     globals.cx1.g_ = &globals;
 
-    // stage1
-    if (opt.kmer_freq_threshold > 1) {
-        globals.cx1.encode_lv1_diff_base_func_ = cx1_read2sdbg::s1::s1_encode_lv1_diff_base;
-        globals.cx1.prepare_func_ = cx1_read2sdbg::s1::s1_read_input_prepare;
-        globals.cx1.lv0_calc_bucket_size_func_ = cx1_read2sdbg::s1::s1_lv0_calc_bucket_size;
-        globals.cx1.init_global_and_set_cx1_func_ = cx1_read2sdbg::s1::s1_init_global_and_set_cx1;
-        globals.cx1.lv1_fill_offset_func_ = cx1_read2sdbg::s1::s1_lv1_fill_offset;
-        globals.cx1.lv1_sort_and_proc = cx1_read2sdbg::s1::s1_lv1_direct_sort_and_count;
-        globals.cx1.lv2_extract_substr_func_ = cx1_read2sdbg::s1::s1_lv2_extract_substr;
-        globals.cx1.lv2_sort_func_ = cx1_read2sdbg::s1::s1_lv2_sort;
-        globals.cx1.lv2_pre_output_partition_func_ = cx1_read2sdbg::s1::s1_lv2_pre_output_partition;
-        globals.cx1.lv2_output_func_ = cx1_read2sdbg::s1::s1_lv2_output;
-        globals.cx1.lv2_post_output_func_ = cx1_read2sdbg::s1::s1_lv2_post_output;
-        globals.cx1.post_proc_func_ = cx1_read2sdbg::s1::s1_post_proc;
+    // the reads are loaded once; each k then runs both stages on them
+    cx1_read2sdbg::s1::s1_load_reads(globals);
+
+    for (size_t i = 0; i < k_list.size(); ++i) {
+        globals.kmer_k = k_list[i];
+        globals.output_prefix = output_prefixes[i];
+        // fine keys take chars beyond the bucket prefix, which the shortest sorting keys, (k-1)-mers, must have
+        globals.cx1.adaptive_buckets_ = opt.adaptive_buckets &&
+                                        globals.kmer_k - 1 >= cx1_read2sdbg::kBucketPrefixLength + globals.cx1.kFineKeyBits / kBitsPerEdgeChar;
+
+        if (k_list.size() > 1) {
+            xlog("Building SdBG for k = %d\n", globals.kmer_k);
+        }
+
+        if (opt.spill_dir != "") {
+            std::string name = globals.output_prefix.substr(globals.output_prefix.find_last_of('/') + 1);
+            globals.cx1.lv1_spill_prefix_ = opt.spill_dir + "/" + name + ".lv1_spill";
+        }
+
+        // stage1
+        if (opt.kmer_freq_threshold > 1) {
+            globals.cx1.encode_lv1_diff_base_func_ = cx1_read2sdbg::s1::s1_encode_lv1_diff_base;
+            globals.cx1.prepare_func_ = cx1_read2sdbg::s1::s1_read_input_prepare;
+            globals.cx1.lv0_calc_bucket_size_func_ = cx1_read2sdbg::s1::s1_lv0_calc_bucket_size;
+            globals.cx1.init_global_and_set_cx1_func_ = cx1_read2sdbg::s1::s1_init_global_and_set_cx1;
+            globals.cx1.lv1_fill_offset_func_ = cx1_read2sdbg::s1::s1_lv1_fill_offset;
+            globals.cx1.lv2_sort_func_ = cx1_read2sdbg::s1::s1_lv2_sort;
+            globals.cx1.lv2_post_output_func_ = cx1_read2sdbg::s1::s1_lv2_post_output;
+            globals.cx1.post_proc_func_ = cx1_read2sdbg::s1::s1_post_proc;
+            globals.cx1.run();
+        }
+        else {
+            cx1_read2sdbg::s1::s1_read_input_prepare(globals);
+        }
+
+        // stage2
+        globals.cx1.encode_lv1_diff_base_func_ = cx1_read2sdbg::s2::s2_encode_lv1_diff_base;
+        globals.cx1.prepare_func_ = cx1_read2sdbg::s2::s2_read_mercy_prepare;
+        globals.cx1.lv0_calc_bucket_size_func_ = cx1_read2sdbg::s2::s2_lv0_calc_bucket_size;
+        globals.cx1.init_global_and_set_cx1_func_ = cx1_read2sdbg::s2::s2_init_global_and_set_cx1;
+        globals.cx1.lv1_fill_offset_func_ = cx1_read2sdbg::s2::s2_lv1_fill_offset;
+        globals.cx1.lv2_sort_func_ = cx1_read2sdbg::s2::s2_lv2_sort;
+        globals.cx1.lv2_pre_output_partition_func_ = cx1_read2sdbg::s2::s2_lv2_pre_output_partition;
+        globals.cx1.lv2_post_output_func_ = cx1_read2sdbg::s2::s2_lv2_post_output;
+        globals.cx1.post_proc_func_ = cx1_read2sdbg::s2::s2_post_proc;
         globals.cx1.run();
     }
-    else {
-        cx1_read2sdbg::s1::s1_read_input_prepare(globals);
-    }
-
-    // stage2
-    globals.cx1.encode_lv1_diff_base_func_ = cx1_read2sdbg::s2::s2_encode_lv1_diff_base;
-    globals.cx1.prepare_func_ = cx1_read2sdbg::s2::s2_read_mercy_prepare;
-    globals.cx1.lv0_calc_bucket_size_func_ = cx1_read2sdbg::s2::s2_lv0_calc_bucket_size;
-    globals.cx1.init_global_and_set_cx1_func_ = cx1_read2sdbg::s2::s2_init_global_and_set_cx1;
-    globals.cx1.lv1_fill_offset_func_ = cx1_read2sdbg::s2::s2_lv1_fill_offset;
-    globals.cx1.lv1_sort_and_proc = cx1_read2sdbg::s2::s2_lv1_direct_sort_and_proc;
-    globals.cx1.lv2_extract_substr_func_ = cx1_read2sdbg::s2::s2_lv2_extract_substr;
-    globals.cx1.lv2_sort_func_ = cx1_read2sdbg::s2::s2_lv2_sort;
-    globals.cx1.lv2_pre_output_partition_func_ = cx1_read2sdbg::s2::s2_lv2_pre_output_partition;
-    globals.cx1.lv2_output_func_ = cx1_read2sdbg::s2::s2_lv2_output;
-    globals.cx1.lv2_post_output_func_ = cx1_read2sdbg::s2::s2_lv2_post_output;
-    globals.cx1.post_proc_func_ = cx1_read2sdbg::s2::s2_post_proc;
-    globals.cx1.run();
 
     return 0;
 }
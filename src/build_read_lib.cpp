@@ -2,7 +2,9 @@
 #include "utils.h"
 
 void DisplayHelp(const char *program) {
-    fprintf(stderr, "Usage %s <read_lib_file> <out_prefix>\n", program);
+    fprintf(stderr, "Usage %s <read_lib_file> <out_prefix> [max_coverage=0] [sketch_mem=1073741824] [norm_k=20]\n"
+            "    max_coverage > 0 drops reads whose median k-mer coverage has reached it,\n"
+            "    counting k-mers in a count-min sketch of sketch_mem bytes\n", program);
 }
 
 int build_lib(int argc, char **argv) {
@@ -11,9 +13,25 @@ int build_lib(int argc, char **argv) {
         exit(1);
     }
 
-    bool is_reverse = false;
+    bool is_reverse = true; // same orientation as buildgraph, which then maps the library directly
     bool verbose = true;
-    ReadAndWriteMultipleLibs(argv[1], is_reverse, argv[2], verbose);
+    int max_coverage = argc > 3 ? atoi(argv[3]) : 0;
+    size_t sketch_mem = argc > 4 ? strtoull(argv[4], NULL, 10) : (1ULL << 30);
+    int norm_k = argc > 5 ? atoi(argv[5]) : 20;
+
+    if (max_coverage > 0) {
+        if (norm_k <= 0 || norm_k > 32) {
+            xerr_and_exit("norm_k must be in [1, 32]\n");
+        }
+
+        DigitalNormalizer normalizer(std::min(max_coverage, (int)CountMinSketch::kMaxCount), sketch_mem, norm_k);
+        xlog("Normalizing to coverage %d, sketch size: %lld bytes\n", max_coverage, (long long)normalizer.size_in_byte());
+        ReadAndWriteMultipleLibs(argv[1], is_reverse, argv[2], verbose, &normalizer);
+        xlog("Normalization kept %lld reads, dropped %lld\n", (long long)normalizer.num_kept(), (long long)normalizer.num_dropped());
+    }
+    else {
+        ReadAndWriteMultipleLibs(argv[1], is_reverse, argv[2], verbose);
+    }
 
     return 0;
 }
@@ -0,0 +1,105 @@
+/*
+ *  MEGAHIT
+ *  Copyright (C) 2014 - 2015 The University of Hong Kong
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* contact: Dinghua Li <dhli@cs.hku.hk> */
+
+#ifndef COUNT_MIN_SKETCH_H__
+#define COUNT_MIN_SKETCH_H__
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+/**
+ * @brief count-min sketch of 64-bit keys with saturating 16-bit counters in a fixed memory budget
+ * estimates never undercount; conservative update (only raising the smallest counters) keeps the overcount low
+ */
+class CountMinSketch {
+  public:
+    static const int kDepth = 4;
+    static const uint16_t kMaxCount = 0xFFFF;
+
+    explicit CountMinSketch(size_t mem_bytes) {
+        // a power of two width per row, so a row index is a mask of the hash
+        width_ = 1024;
+
+        while (width_ * 2 * kDepth * sizeof(uint16_t) <= mem_bytes) {
+            width_ *= 2;
+        }
+
+        counters_.assign(width_ * kDepth, 0);
+    }
+
+    size_t size_in_byte() const {
+        return counters_.size() * sizeof(uint16_t);
+    }
+
+    uint16_t Estimate(uint64_t key) const {
+        size_t idx[kDepth];
+        Index_(key, idx);
+        uint16_t count = kMaxCount;
+
+        for (int i = 0; i < kDepth; ++i) {
+            count = std::min(count, counters_[idx[i]]);
+        }
+
+        return count;
+    }
+
+    void Add(uint64_t key) {
+        size_t idx[kDepth];
+        Index_(key, idx);
+        uint16_t count = kMaxCount;
+
+        for (int i = 0; i < kDepth; ++i) {
+            count = std::min(count, counters_[idx[i]]);
+        }
+
+        if (count == kMaxCount) {
+            return;
+        }
+
+        for (int i = 0; i < kDepth; ++i) {
+            if (counters_[idx[i]] == count) {
+                ++counters_[idx[i]];
+            }
+        }
+    }
+
+  private:
+    // double hashing from one 64-bit mix (murmur3 finalizer), the odd step visits a distinct slot per row
+    void Index_(uint64_t key, size_t *idx) const {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ULL;
+        key ^= key >> 33;
+
+        uint64_t h = key & 0xFFFFFFFFULL;
+        uint64_t step = (key >> 32) | 1;
+
+        for (int i = 0; i < kDepth; ++i) {
+            idx[i] = i * width_ + ((h + i * step) & (width_ - 1));
+        }
+    }
+
+    size_t width_;
+    std::vector<uint16_t> counters_;
+};
+
+#endif // COUNT_MIN_SKETCH_H__
@@ -27,10 +27,14 @@
 #include <assert.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <string>
 #include <vector>
 #include <algorithm>
+#include <numeric>
 
 #include "mem_file_checker-inl.h"
+#include "thread_pool.h"
 #include "utils.h"
 
 /**
@@ -39,7 +43,8 @@
  *
  * @tparam global_data_type the type of global datas used in a specified CX1 engine
  *                          must contain a member `CX1* cx1`, where cx1->g_ is itself,
- *                          that enables interactions with CX1 functions
+ *                          that enables interactions with CX1 functions,
+ *                          and the lv1 item array `int32_t *lv1_items`, which is filled from disk when spilling
  * @tparam kNumBuckets      number of buckets
  */
 template <typename global_data_type, int kNumBuckets>
@@ -51,12 +56,21 @@ struct CX1 {
     static const int kLv1BytePerItem = 4; // 32-bit differatial offset
     static const uint64_t kSpDiffMaxNum = (1ULL << 32) - 1;
     static const int64_t kDifferentialLimit = (1ULL << 31) - 1;
+    // a spilled lv1 item packs the bucket rank above a 48-bit full offset
+    static const int kSpillOffsetBits = 48;
+    static const int64_t kMinSpillBlockItems = 1024;
+    static const int64_t kMaxSpillBlockItems = 65536;
+    // more read partitions than threads, so that the threads balance the uneven ones
+    static const int kReadPartitionsPerThread = 4;
+    // adaptive buckets: a bucket covers a range of fine keys, which have kFineKeyBits more bits than a bucket ID
+    static const int kFineKeyBits = 4;
+    static const int kNumFineKeys = kNumBuckets << kFineKeyBits;
+    static const int kHeavyBucketFactor = 4; // split buckets larger than this times the mean of the non-empty ones
 
     struct readpartition_data_t {
         // local data for each read partition (i.e. a subrange of input reads)
         global_data_t *globals;
-        int rp_id; // ID of this read partition, in [ 0, num_cpu_threads ).
-        pthread_t thread;
+        int rp_id; // ID of this read partition, in [ 0, num_read_partitions_ ).
         int64_t rp_start_id, rp_end_id; // start and end IDs of this read partition (end is exclusive)
         int64_t *rp_bucket_sizes; // bucket sizes for this read partition; len =
         int64_t *rp_bucket_offsets;
@@ -67,7 +81,6 @@ struct CX1 {
         // local data for each bucket partition (i.e. a range of buckets), used in lv.2 (extract substring)
         global_data_t *globals;
         int bp_id;
-        pthread_t thread;
         int bp_start_bucket, bp_end_bucket;
     };
 
@@ -85,16 +98,59 @@ struct CX1 {
     int num_cpu_threads_;
     int num_output_threads_;
     int64_t max_lv1_items_, max_lv2_items_;
+    int num_read_partitions_; // set by prepare_rp_and_bp_(), before init_global_and_set_cx1_func_
 
     bool lv1_just_go_;
+    // set to split heavy buckets into their fine keys and merge light neighbors after lv0;
+    // the buckets remain ranges of keys in order and the first key bits still give the quarter of the bucket ID
+    bool adaptive_buckets_;
+    std::vector<int> fine_key_bucket_; // bucket ID of each fine key; empty for plain buckets (fine key >> kFineKeyBits)
+    // fine_key_bucket_ compacted for the scans: the bucket of each prefix (plain bucket ID) if all its fine keys share
+    // one, otherwise ~i with the buckets of its fine keys at split_fine_key_bucket_[i << kFineKeyBits]
+    std::vector<int> prefix_bucket_;
+    std::vector<int> split_fine_key_bucket_;
     int64_t max_mem_remain_;
     int64_t bytes_per_sorting_item_;
     std::vector<bool> cur_lv1_buckets_;
 
+    // external memory mode: set lv1_spill_prefix_ to scan the reads once and spill the lv1 items of
+    // all lv1 iterations to disk, one file per read partition; each iteration then loads its items back.
+    // the items are read offsets, so lv2 still extracts from the reads: they are kept in memory and counted in host_mem
+    std::string lv1_spill_prefix_;
+    bool lv1_spilling_; // during the spilling scan, the fill function must pass items to lv1_spill_item_()
+    bool lv1_spilled_;
+
+    struct lv1_spill_block_t {
+        int iteration;
+        int64_t file_offset; // in items
+        int64_t num_items;
+    };
+
+    struct lv1_spill_t {
+        FILE *file;
+        int64_t num_items;
+        std::vector<uint64_t> buffer; // one block per lv1 iteration
+        std::vector<int64_t> buffer_size;
+        std::vector<lv1_spill_block_t> blocks;
+    };
+
+    std::vector<lv1_spill_t> lv1_spill_;
+    std::vector<int> lv1_spill_ends_; // end bucket of each lv1 iteration
+    std::vector<int> lv1_spill_iteration_; // lv1 iteration of each bucket, by rank
+    int64_t lv1_spill_block_items_;
+    int lv1_iteration_;
+    pthread_mutex_t lv1_spill_lock_;
+
+    // the workers of all parallel phases, kept alive across runs
+    ThreadPool thread_pool_;
+
     // other data
     int64_t *bucket_sizes_;
     int *ori_bucket_id_;
     int *bucket_rank_;
+    // by rank, from reorder_buckets_(): the end of the group starting at a rank; a group is the buckets of a prefix,
+    // more than one with adaptive buckets, which stay in order and are sorted by one thread
+    std::vector<int> group_end_;
     readpartition_data_t *rp_;
     bucketpartition_data_t *bp_;
     outputpartition_data_t *op_;
@@ -119,7 +175,7 @@ struct CX1 {
     void (*lv2_post_output_func_) (global_data_t &);
     void (*post_proc_func_) (global_data_t &);
 
-    CX1() : lv1_just_go_(false) {}
+    CX1() : lv1_just_go_(false), adaptive_buckets_(false), lv1_spilling_(false), lv1_spilled_(false) {}
 
     // === single thread functions ===
     inline void adjust_mem(int64_t mem_avail, int64_t lv2_bytes_per_item, int64_t min_lv1_items, int64_t min_lv2_items) {
@@ -162,30 +218,25 @@ struct CX1 {
 
     inline void adjust_mem_just_go(int64_t mem_avail, int64_t bytes_per_sorting_item, int64_t min_lv1_items, int64_t min_sorting_items,
                                    int64_t max_sorting_items, int64_t &max_lv1_items, int64_t &num_sorting_items) {
-        num_sorting_items = max_sorting_items;
+        num_sorting_items = std::max(max_sorting_items, min_sorting_items);
 
-        while (num_sorting_items >= min_sorting_items) {
+        while (true) {
             int64_t mem_sorting_items = bytes_per_sorting_item * num_sorting_items;
 
-            if (mem_avail < mem_sorting_items) {
-                mem_sorting_items = num_sorting_items * 0.95;
-                continue;
-            }
+            if (mem_avail >= mem_sorting_items) {
+                max_lv1_items = (mem_avail - mem_sorting_items) / kLv1BytePerItem;
 
-            max_lv1_items = (mem_avail - mem_sorting_items) / kLv1BytePerItem;
-
-            if (max_lv1_items < min_lv1_items || max_lv1_items < num_sorting_items) {
-                num_sorting_items *= 0.95;
-            }
-            else {
-                break;
+                if (max_lv1_items >= min_lv1_items && max_lv1_items >= num_sorting_items) {
+                    break;
+                }
             }
-        }
 
-        if (num_sorting_items < min_sorting_items) {
-            if (num_sorting_items < min_sorting_items) {
+            if (num_sorting_items == min_sorting_items) {
                 xerr_and_exit("No enough memory to process CX1.\n");
             }
+
+            // the last try is exactly min_sorting_items, which a budget sized for it must pass
+            num_sorting_items = std::max(int64_t(num_sorting_items * 0.95), min_sorting_items);
         }
 
         // --- adjust num_sorting_items to fit more lv1 item ---
@@ -202,20 +253,21 @@ struct CX1 {
     }
 
     inline void prepare_rp_and_bp_() { // call after prepare_func_
-        rp_ = (readpartition_data_t *) MallocAndCheck(sizeof(readpartition_data_t) * num_cpu_threads_, __FILE__, __LINE__);
+        num_read_partitions_ = num_cpu_threads_ * kReadPartitionsPerThread;
+        rp_ = (readpartition_data_t *) MallocAndCheck(sizeof(readpartition_data_t) * num_read_partitions_, __FILE__, __LINE__);
         bp_ = (bucketpartition_data_t *) MallocAndCheck(sizeof(bucketpartition_data_t) * (num_cpu_threads_ - num_output_threads_), __FILE__, __LINE__);
         op_ = (outputpartition_data_t *) MallocAndCheck(sizeof(outputpartition_data_t) * num_output_threads_, __FILE__, __LINE__);
 
-        for (int t = 0; t < num_cpu_threads_; ++t) {
+        for (int t = 0; t < num_read_partitions_; ++t) {
             struct readpartition_data_t &rp = rp_[t];
             rp.rp_id = t;
             rp.globals = g_;
             rp.rp_bucket_sizes = (int64_t *) MallocAndCheck(kNumBuckets * sizeof(int64_t), __FILE__, __LINE__);
             rp.rp_bucket_offsets = (int64_t *) MallocAndCheck(kNumBuckets * sizeof(int64_t), __FILE__, __LINE__);
             // distribute reads to partitions
-            int64_t average = num_items_ / num_cpu_threads_;
+            int64_t average = num_items_ / num_read_partitions_;
             rp.rp_start_id = t * average;
-            rp.rp_end_id = t < num_cpu_threads_ - 1 ? (t + 1) * average : num_items_;
+            rp.rp_end_id = t < num_read_partitions_ - 1 ? (t + 1) * average : num_items_;
             rp.rp_lv1_differential_base = encode_lv1_diff_base_func_(rp.rp_start_id, *g_);
         }
 
@@ -243,7 +295,7 @@ struct CX1 {
     }
 
     inline void clean_() {
-        for (int t = 0; t < num_cpu_threads_; ++t) {
+        for (int t = 0; t < num_read_partitions_; ++t) {
             free(rp_[t].rp_bucket_sizes);
             free(rp_[t].rp_bucket_offsets);
         }
@@ -277,29 +329,57 @@ struct CX1 {
     }
 
     inline void reorder_buckets_() {
-        std::vector<std::pair<int64_t, int> > tmp_v(kNumBuckets);
+        // the groups by their largest bucket, the buckets of a group in order
+        std::vector<std::pair<int64_t, int> > groups;
+        std::vector<int> end_of(kNumBuckets); // the end of the group starting at a bucket
 
-        for (int i = 0; i < kNumBuckets; ++i) {
-            tmp_v[i] = std::make_pair(bucket_sizes_[i], i);
+        for (int i = 0, j; i < kNumBuckets; i = j) {
+            int64_t max_size = bucket_sizes_[i];
+
+            for (j = i + 1; j < kNumBuckets && !is_prefix_start(j); ++j) {
+                max_size = std::max(max_size, bucket_sizes_[j]);
+            }
+
+            groups.push_back(std::make_pair(max_size, i));
+            end_of[i] = j;
+        }
+
+        std::sort(groups.rbegin(), groups.rend());
+        std::vector<int> order;
+        group_end_.resize(kNumBuckets);
+
+        for (size_t g = 0; g < groups.size(); ++g) {
+            int rank = order.size();
+
+            for (int b = groups[g].second; b < end_of[groups[g].second]; ++b) {
+                order.push_back(b);
+            }
+
+            group_end_[rank] = order.size();
         }
 
-        std::sort(tmp_v.rbegin(), tmp_v.rend());
+        std::vector<int64_t> old_bucket_sizes(bucket_sizes_, bucket_sizes_ + kNumBuckets);
 
         for (int i = 0; i < kNumBuckets; ++i) {
-            bucket_sizes_[i] = tmp_v[i].first;
-            ori_bucket_id_[i] = tmp_v[i].second;
-            bucket_rank_[tmp_v[i].second] = i;
+            bucket_sizes_[i] = old_bucket_sizes[order[i]];
+            ori_bucket_id_[i] = order[i];
+            bucket_rank_[order[i]] = i;
         }
 
-        for (int tid = 0; tid < num_cpu_threads_; ++tid) {
+        for (int tid = 0; tid < num_read_partitions_; ++tid) {
             std::vector<int64_t> old_rp_bucket_sizes(rp_[tid].rp_bucket_sizes, rp_[tid].rp_bucket_sizes + kNumBuckets);
 
             for (int i = 0; i < kNumBuckets; ++i) {
-                rp_[tid].rp_bucket_sizes[i] = old_rp_bucket_sizes[tmp_v[i].second];
+                rp_[tid].rp_bucket_sizes[i] = old_rp_bucket_sizes[order[i]];
             }
         }
     }
 
+    // the largest bucket of the group starting at rank
+    inline int64_t group_max_bucket_size(int rank) {
+        return *std::max_element(bucket_sizes_ + rank, bucket_sizes_ + group_end_[rank]);
+    }
+
     inline int find_end_buckets_with_rank_(int start_bucket, int end_limit, int64_t mem_limit, int bytes_per_sorting_items, int64_t &num_items) {
         num_items = 0;
         int end_bucket = start_bucket;
@@ -310,18 +390,22 @@ struct CX1 {
         std::fill(cur_lv1_buckets_.begin(), cur_lv1_buckets_.end(), false);
 
         while (end_bucket < end_limit) {
+            int64_t group_items = std::accumulate(bucket_sizes_ + end_bucket, bucket_sizes_ + group_end_[end_bucket], (int64_t)0);
+
             if (used_threads < num_cpu_threads_) {
-                mem_sorting_items += bytes_per_sorting_items * bucket_sizes_[end_bucket];
+                mem_sorting_items += bytes_per_sorting_items * group_max_bucket_size(end_bucket);
                 ++used_threads;
             }
 
-            if (mem_sorting_items + (num_items + bucket_sizes_[end_bucket]) * kLv1BytePerItem > mem_limit) {
+            if (mem_sorting_items + (num_items + group_items) * kLv1BytePerItem > mem_limit) {
                 return end_bucket;
             }
 
-            num_items += bucket_sizes_[end_bucket];
-            cur_lv1_buckets_[ori_bucket_id_[end_bucket]] = true;
-            ++end_bucket;
+            num_items += group_items;
+
+            for (int group_end = group_end_[end_bucket]; end_bucket < group_end; ++end_bucket) {
+                cur_lv1_buckets_[ori_bucket_id_[end_bucket]] = true;
+            }
         }
 
         return end_limit;
@@ -337,7 +421,7 @@ struct CX1 {
         }
 
         // then for each read partition
-        for (int t = 1; t < num_cpu_threads_; ++t) {
+        for (int t = 1; t < num_read_partitions_; ++t) {
             int64_t *this_offsets = rp_[t].rp_bucket_offsets;
             int64_t *prev_offsets = rp_[t - 1].rp_bucket_offsets;
             int64_t *sizes = rp_[t - 1].rp_bucket_sizes;
@@ -374,21 +458,409 @@ struct CX1 {
         bp_[num_cpu_threads_ - num_output_threads_ - 1].bp_end_bucket = lv2_end_bucket_;
     }
 
-    // === multi-thread wrappers ====
-    inline void lv0_calc_bucket_size_mt_() {
-        for (int t = 0; t < num_cpu_threads_; ++t) {
-            pthread_create(&(rp_[t].thread), NULL, lv0_calc_bucket_size_func_, &rp_[t]);
+    // === adaptive buckets ===
+    inline void log_bucket_skew_(const char *scheme) {
+        int64_t max_size = 0, total_size = 0;
+        int num_non_empty = 0;
+
+        for (int i = 0; i < kNumBuckets; ++i) {
+            max_size = std::max(max_size, bucket_sizes_[i]);
+            total_size += bucket_sizes_[i];
+            num_non_empty += bucket_sizes_[i] > 0;
+        }
+
+        double mean_size = (double)total_size / std::max(1, num_non_empty);
+        xlog("%s buckets: %d non-empty, max size %lld, mean size %.0f, skew %.1fx\n", scheme, num_non_empty,
+             (long long)max_size, mean_size, max_size / std::max(1.0, mean_size));
+    }
+
+    /**
+     * @brief re-bucket after lv0: count the fine keys of the heavy buckets with another lv0 scan, then cut the
+     * sequence of fine key ranges (heavy buckets by fine key, others whole) into kNumBuckets ranges of similar size
+     */
+    inline void refine_buckets_() {
+        const int kNumSubKeys = 1 << kFineKeyBits;
+        const int kBucketsPerQuarter = kNumBuckets / 4;
+        const int kFineKeysPerQuarter = kNumFineKeys / 4;
+        int64_t total_size = 0;
+        int num_non_empty = 0;
+
+        for (int i = 0; i < kNumBuckets; ++i) {
+            total_size += bucket_sizes_[i];
+            num_non_empty += bucket_sizes_[i] > 0;
+        }
+
+        // the heavy buckets, largest first, as many as their fine keys can be counted in one scan
+        std::vector<std::pair<int64_t, int> > heavy;
+
+        for (int i = 0; i < kNumBuckets; ++i) {
+            if (bucket_sizes_[i] > kHeavyBucketFactor * total_size / std::max(1, num_non_empty)) {
+                heavy.push_back(std::make_pair(bucket_sizes_[i], i));
+            }
+        }
+
+        if (heavy.empty()) {
+            return;
+        }
+
+        std::sort(heavy.rbegin(), heavy.rend());
+        heavy.resize(std::min(heavy.size(), (size_t)(kNumBuckets - 1) / kNumSubKeys));
+        std::vector<int> heavy_id(kNumBuckets, -1);
+
+        for (size_t h = 0; h < heavy.size(); ++h) {
+            heavy_id[heavy[h].second] = h;
+        }
+
+        // the probing scan counts the fine keys of heavy bucket h as buckets [h * kNumSubKeys, (h + 1) * kNumSubKeys)
+        std::vector<int64_t> plain_rp_sizes((int64_t)num_read_partitions_ * kNumBuckets);
+
+        for (int t = 0; t < num_read_partitions_; ++t) {
+            std::copy(rp_[t].rp_bucket_sizes, rp_[t].rp_bucket_sizes + kNumBuckets, plain_rp_sizes.begin() + (int64_t)t * kNumBuckets);
         }
 
-        for (int t = 0; t < num_cpu_threads_; ++t) {
-            pthread_join(rp_[t].thread, NULL);
+        std::vector<int64_t> plain_sizes(bucket_sizes_, bucket_sizes_ + kNumBuckets);
+        fine_key_bucket_.assign(kNumFineKeys, kNumBuckets - 1);
+
+        for (size_t h = 0; h < heavy.size(); ++h) {
+            for (int j = 0; j < kNumSubKeys; ++j) {
+                fine_key_bucket_[heavy[h].second * kNumSubKeys + j] = h * kNumSubKeys + j;
+            }
         }
 
+        index_fine_key_bucket_();
+        lv0_calc_bucket_size_mt_();
+
+        // units: the fine key ranges no bucket boundary may cut
+        std::vector<int> unit_begin; // in fine keys
+        std::vector<int64_t> unit_size;
+
+        for (int i = 0; i < kNumBuckets; ++i) {
+            if (heavy_id[i] < 0) {
+                unit_begin.push_back(i * kNumSubKeys);
+                unit_size.push_back(plain_sizes[i]);
+            }
+            else {
+                for (int j = 0; j < kNumSubKeys; ++j) {
+                    unit_begin.push_back(i * kNumSubKeys + j);
+                    unit_size.push_back(bucket_sizes_[heavy_id[i] * kNumSubKeys + j]);
+                }
+            }
+        }
+
+        unit_begin.push_back(kFineKeysPerQuarter * 4);
+
+        // in each quarter, the smallest size limit that needs no more than kBucketsPerQuarter buckets;
+        // a unit larger than the limit gets a bucket of its own
+        std::vector<int> unit_bucket(unit_size.size());
+
+        for (size_t q_begin = 0, q_end; q_begin < unit_size.size(); q_begin = q_end) {
+            int quarter = unit_begin[q_begin] / kFineKeysPerQuarter;
+            int64_t sum = 0;
+
+            for (q_end = q_begin; q_end < unit_size.size() && unit_begin[q_end] / kFineKeysPerQuarter == quarter; ++q_end) {
+                sum += unit_size[q_end];
+            }
+
+            int64_t lo = 1, hi = std::max((int64_t)1, sum);
+
+            while (lo < hi) {
+                int64_t mid = lo + (hi - lo) / 2;
+                int num_buckets = 1;
+
+                for (size_t u = q_begin, acc = 0; u < q_end; ++u) {
+                    if (acc > 0 && acc + unit_size[u] > (uint64_t)mid) {
+                        ++num_buckets;
+                        acc = 0;
+                    }
+
+                    acc += unit_size[u];
+                }
+
+                if (num_buckets <= kBucketsPerQuarter) {
+                    hi = mid;
+                }
+                else {
+                    lo = mid + 1;
+                }
+            }
+
+            int bucket = quarter * kBucketsPerQuarter;
+            int64_t acc = 0;
+
+            for (size_t u = q_begin; u < q_end; ++u) {
+                if (acc > 0 && acc + unit_size[u] > lo) {
+                    ++bucket;
+                    acc = 0;
+                }
+
+                acc += unit_size[u];
+                unit_bucket[u] = bucket;
+                std::fill(fine_key_bucket_.begin() + unit_begin[u], fine_key_bucket_.begin() + unit_begin[u + 1], bucket);
+            }
+        }
+
+        index_fine_key_bucket_();
+
+        // the sizes of the new buckets in each read partition, from the plain and the probing counts
+        std::vector<int64_t> new_sizes(kNumBuckets);
+
+        for (int t = 0; t < num_read_partitions_; ++t) {
+            int64_t *rp_plain_sizes = &plain_rp_sizes[(int64_t)t * kNumBuckets];
+            std::fill(new_sizes.begin(), new_sizes.end(), 0);
+
+            for (size_t u = 0; u < unit_size.size(); ++u) {
+                int i = unit_begin[u] / kNumSubKeys;
+                new_sizes[unit_bucket[u]] += heavy_id[i] < 0 ? rp_plain_sizes[i] : rp_[t].rp_bucket_sizes[heavy_id[i] * kNumSubKeys + unit_begin[u] % kNumSubKeys];
+            }
+
+            std::copy(new_sizes.begin(), new_sizes.end(), rp_[t].rp_bucket_sizes);
+        }
+
+        memset(bucket_sizes_, 0, kNumBuckets * sizeof(bucket_sizes_[0]));
+
+        for (int t = 0; t < num_read_partitions_; ++t) {
+            for (int b = 0; b < kNumBuckets; ++b) {
+                bucket_sizes_[b] += rp_[t].rp_bucket_sizes[b];
+            }
+        }
+
+        if (kCX1Verbose >= 3) {
+            xlog("Split %lu heavy buckets by their fine keys\n", heavy.size());
+        }
+    }
+
+    inline void index_fine_key_bucket_() {
+        const int kNumSubKeys = 1 << kFineKeyBits;
+        prefix_bucket_.resize(kNumBuckets);
+        split_fine_key_bucket_.clear();
+
+        for (int i = 0; i < kNumBuckets; ++i) {
+            std::vector<int>::iterator first = fine_key_bucket_.begin() + i * kNumSubKeys;
+
+            if (std::count(first, first + kNumSubKeys, *first) == kNumSubKeys) {
+                prefix_bucket_[i] = *first;
+            }
+            else {
+                prefix_bucket_[i] = ~int(split_fine_key_bucket_.size() >> kFineKeyBits);
+                split_fine_key_bucket_.insert(split_fine_key_bucket_.end(), first, first + kNumSubKeys);
+            }
+        }
+    }
+
+    inline int bucket_of_fine_key(int fine_key) const {
+        int bucket = prefix_bucket_[fine_key >> kFineKeyBits];
+        return bucket >= 0 ? bucket : split_fine_key_bucket_[(~bucket << kFineKeyBits) | (fine_key & ((1 << kFineKeyBits) - 1))];
+    }
+
+    // whether no prefix bucket (the first kBucketPrefixLength chars) has items on both sides of the start of bucket
+    inline bool is_prefix_start(int bucket) {
+        if (fine_key_bucket_.empty()) {
+            return true;
+        }
+
+        int fine_key = std::lower_bound(fine_key_bucket_.begin(), fine_key_bucket_.end(), bucket) - fine_key_bucket_.begin();
+        return fine_key % (1 << kFineKeyBits) == 0;
+    }
+
+    // === external memory lv1 ===
+    inline int find_lv1_end_bucket_(int start_bucket) {
+        if (lv1_just_go_) {
+            return find_end_buckets_with_rank_(start_bucket, kNumBuckets, max_mem_remain_, bytes_per_sorting_item_, lv1_num_items_);
+        }
+        else {
+            return find_end_buckets_(start_bucket, kNumBuckets, max_lv1_items_, lv1_num_items_);
+        }
+    }
+
+    // called by the fill function for every item of the spilling scan; key_ is the bucket rank
+    inline void lv1_spill_item_(int rp_id, int key_, int64_t full_offset) {
+        lv1_spill_t &spill = lv1_spill_[rp_id];
+        int iteration = lv1_spill_iteration_[key_];
+
+        if ((uint64_t)full_offset >> kSpillOffsetBits) {
+            xerr_and_exit("Offset %lld too large to spill lv1 items\n", (long long)full_offset);
+        }
+
+        spill.buffer[iteration * lv1_spill_block_items_ + spill.buffer_size[iteration]++] =
+            ((uint64_t)key_ << kSpillOffsetBits) | full_offset;
+
+        if (spill.buffer_size[iteration] == lv1_spill_block_items_) {
+            lv1_spill_flush_block_(spill, iteration);
+        }
+    }
+
+    inline void lv1_spill_flush_block_(lv1_spill_t &spill, int iteration) {
+        lv1_spill_block_t block = {iteration, spill.num_items, spill.buffer_size[iteration]};
+
+        if (block.num_items == 0) {
+            return;
+        }
+
+        if (fwrite(&spill.buffer[iteration * lv1_spill_block_items_], sizeof(uint64_t), block.num_items, spill.file) != (size_t)block.num_items) {
+            xerr_and_exit("Failed to spill lv1 items to %s\n", lv1_spill_prefix_.c_str());
+        }
+
+        spill.blocks.push_back(block);
+        spill.num_items += block.num_items;
+        spill.buffer_size[iteration] = 0;
+    }
+
+    /**
+     * @brief plan the lv1 iterations and spill their items in a single scan of the reads
+     * nothing is spilled if a single iteration covers all buckets
+     */
+    inline void lv1_spill_mt_() {
+        lv1_spill_ends_.clear();
+        lv1_spill_iteration_.assign(kNumBuckets, 0);
+
+        for (int start = 0; start < kNumBuckets; ) {
+            int end = find_lv1_end_bucket_(start);
+
+            if (lv1_num_items_ == 0) {
+                return; // a bucket too large, reported by the main loop
+            }
+
+            std::fill(lv1_spill_iteration_.begin() + start, lv1_spill_iteration_.begin() + end, (int)lv1_spill_ends_.size());
+            lv1_spill_ends_.push_back(end);
+            start = end;
+        }
+
+        int num_iterations = lv1_spill_ends_.size();
+
+        if (num_iterations <= 1) {
+            return;
+        }
+
+        // the buffers take at most half of the lv1 items' memory, which is idle during the scan
+        lv1_spill_block_items_ = max_lv1_items_ * kLv1BytePerItem / sizeof(uint64_t) / 2 / num_read_partitions_ / num_iterations;
+        lv1_spill_block_items_ = std::max(kMinSpillBlockItems, std::min(kMaxSpillBlockItems, lv1_spill_block_items_));
+        lv1_spill_.resize(num_read_partitions_);
+
+        for (int t = 0; t < num_read_partitions_; ++t) {
+            lv1_spill_[t].file = OpenFileAndCheck(FormatString("%s.%d", lv1_spill_prefix_.c_str(), t), "wb+");
+            lv1_spill_[t].num_items = 0;
+            lv1_spill_[t].buffer.resize(lv1_spill_block_items_ * num_iterations);
+            lv1_spill_[t].buffer_size.assign(num_iterations, 0);
+            lv1_spill_[t].blocks.clear();
+        }
+
+        if (kCX1Verbose >= 3) {
+            xlog("Spilling lv1 items of %d iterations to %s.*\n", num_iterations, lv1_spill_prefix_.c_str());
+        }
+
+        cur_lv1_buckets_.assign(kNumBuckets, true);
+        lv1_start_bucket_ = 0;
+        lv1_end_bucket_ = kNumBuckets;
+        lv1_spilling_ = true;
+        for_each_partition_(lv1_fill_offset_func_, rp_, num_read_partitions_);
+        lv1_spilling_ = false;
+        lv1_spilled_ = true;
+        int64_t num_spilled = 0;
+
+        for (int t = 0; t < num_read_partitions_; ++t) {
+            for (int i = 0; i < num_iterations; ++i) {
+                lv1_spill_flush_block_(lv1_spill_[t], i);
+            }
+
+            fflush(lv1_spill_[t].file);
+            std::vector<uint64_t>().swap(lv1_spill_[t].buffer);
+            num_spilled += lv1_spill_[t].num_items;
+        }
+
+        pthread_mutex_init(&lv1_spill_lock_, NULL);
+
+        if (kCX1Verbose >= 3) {
+            xlog("Spilled %lld lv1 items\n", (long long)num_spilled);
+        }
+    }
+
+    // fill the lv1 items of the current iteration from the spilled blocks of a read partition,
+    // in the same differential representation as the fill function
+    static void *lv1_load_spilled_(void *_data) {
+        readpartition_data_t &rp = *((readpartition_data_t *) _data);
+        CX1 &cx1 = rp.globals->cx1;
+        lv1_spill_t &spill = cx1.lv1_spill_[rp.rp_id];
+        int32_t *lv1_items = rp.globals->lv1_items;
+        std::vector<int64_t> prev_full_offsets(kNumBuckets, rp.rp_lv1_differential_base);
+        std::vector<uint64_t> buffer(cx1.lv1_spill_block_items_);
+        uint64_t offset_mask = (1ULL << kSpillOffsetBits) - 1;
+
+        for (size_t i = 0; i < spill.blocks.size(); ++i) {
+            if (spill.blocks[i].iteration != cx1.lv1_iteration_) {
+                continue;
+            }
+
+            int64_t num_items = spill.blocks[i].num_items;
+
+            if (pread(fileno(spill.file), &buffer[0], num_items * sizeof(uint64_t), spill.blocks[i].file_offset * sizeof(uint64_t))
+                    != (ssize_t)(num_items * sizeof(uint64_t))) {
+                xerr_and_exit("Failed to load spilled lv1 items from %s\n", cx1.lv1_spill_prefix_.c_str());
+            }
+
+            for (int64_t j = 0; j < num_items; ++j) {
+                int key_ = buffer[j] >> kSpillOffsetBits;
+                int64_t full_offset = buffer[j] & offset_mask;
+                int64_t differential = full_offset - prev_full_offsets[key_];
+
+                if (differential > kDifferentialLimit) {
+                    pthread_mutex_lock(&cx1.lv1_spill_lock_);
+                    lv1_items[rp.rp_bucket_offsets[key_]++] = -cx1.lv1_items_special_.size() - 1;
+                    cx1.lv1_items_special_.push_back(full_offset);
+                    pthread_mutex_unlock(&cx1.lv1_spill_lock_);
+                }
+                else {
+                    assert(differential >= 0);
+                    lv1_items[rp.rp_bucket_offsets[key_]++] = (int32_t)differential;
+                }
+
+                prev_full_offsets[key_] = full_offset;
+            }
+        }
+
+        return NULL;
+    }
+
+    inline void lv1_spill_clean_() {
+        if (lv1_spilled_) {
+            for (int t = 0; t < num_read_partitions_; ++t) {
+                fclose(lv1_spill_[t].file);
+                remove(FormatString("%s.%d", lv1_spill_prefix_.c_str(), t));
+            }
+
+            pthread_mutex_destroy(&lv1_spill_lock_);
+        }
+
+        lv1_spill_.clear();
+        lv1_spilled_ = false;
+    }
+
+    // === multi-thread wrappers ====
+    struct partition_job_t {
+        void *(*func) (void *);
+        char *partitions;
+        size_t partition_size;
+    };
+
+    static void run_partition_(void *data, long i, int worker_id) {
+        partition_job_t &job = *((partition_job_t *) data);
+        job.func(job.partitions + i * job.partition_size);
+    }
+
+    // runs a pthread-style partition function on each partition with the thread pool
+    template <typename partition_t>
+    inline void for_each_partition_(void *(*func) (void *), partition_t *partitions, int num_partitions) {
+        partition_job_t job = {func, (char *) partitions, sizeof(partition_t)};
+        thread_pool_.ForEach(num_partitions, run_partition_, &job);
+    }
+
+    inline void lv0_calc_bucket_size_mt_() {
+        for_each_partition_(lv0_calc_bucket_size_func_, rp_, num_read_partitions_);
+
         // sum up readpartitions bucketsizes to form global bucketsizes
         memset(bucket_sizes_, 0, kNumBuckets * sizeof(bucket_sizes_[0]));
 
         // the array accesses in this loop are optimized by the compiler??
-        for (int t = 0; t < num_cpu_threads_; ++t) {
+        for (int t = 0; t < num_read_partitions_; ++t) {
             for (int b = 0; b < kNumBuckets; ++b) {
                 bucket_sizes_[b] += rp_[t].rp_bucket_sizes[b];
             }
@@ -399,32 +871,28 @@ struct CX1 {
         lv1_items_special_.clear();
         lv1_compute_offset_();
 
-        // create threads
-        for (int t = 0; t < num_cpu_threads_; ++t) {
-            pthread_create(&(rp_[t].thread), NULL, lv1_fill_offset_func_, &rp_[t]);
-        }
-
-        for (int t = 0; t < num_cpu_threads_; ++t) {
-            pthread_join(rp_[t].thread, NULL);
-        }
+        for_each_partition_(lv1_fill_offset_func_, rp_, num_read_partitions_);
 
         // revert rp_bucket_offsets
         lv1_compute_offset_();
     }
 
+    inline void lv1_load_spilled_mt_() {
+        lv1_items_special_.clear();
+        lv1_compute_offset_();
+
+        for_each_partition_(lv1_load_spilled_, rp_, num_read_partitions_);
+
+        lv1_compute_offset_();
+    }
+
     inline void lv2_extract_substr_mt_() {
         lv2_distribute_bucket_partitions_();
 
-        // create threads
-        for (int t = 0; t < num_cpu_threads_ - num_output_threads_; ++t) {
-            pthread_create(&(bp_[t].thread), NULL, lv2_extract_substr_func_, &bp_[t]);
-        }
-
-        for (int t = 0; t < num_cpu_threads_ - num_output_threads_; ++t) {
-            pthread_join(bp_[t].thread, NULL);
-        }
+        for_each_partition_(lv2_extract_substr_func_, bp_, num_cpu_threads_ - num_output_threads_);
     }
 
+    // the output is pipelined with the next lv2 batch, so it has its own threads
     inline void lv2_output_mt_() {
         for (int t = 0; t < num_output_threads_; ++t) {
             op_[t].op_id = t;
@@ -451,6 +919,7 @@ struct CX1 {
         }
 
         prepare_func_(*g_);
+        thread_pool_.Resize(num_cpu_threads_);
 
         if (kCX1Verbose >= 2) {
             lv0_timer.stop();
@@ -467,7 +936,21 @@ struct CX1 {
         // prepare rp bp and op
         prepare_rp_and_bp_();
         // calc bucket size
+        fine_key_bucket_.clear();
         lv0_calc_bucket_size_mt_();
+
+        if (kCX1Verbose >= 3) {
+            log_bucket_skew_("Prefix");
+        }
+
+        if (adaptive_buckets_) {
+            refine_buckets_();
+
+            if (kCX1Verbose >= 3 && !fine_key_bucket_.empty()) {
+                log_bucket_skew_("Adaptive");
+            }
+        }
+
         // init global datas
         init_global_and_set_cx1_func_(*g_);
 
@@ -486,6 +969,10 @@ struct CX1 {
             xlog("Start main loop...\n");
         }
 
+        if (!lv1_spill_prefix_.empty()) {
+            lv1_spill_mt_();
+        }
+
         // === start main loop ===
         bool output_thread_created = false;
         int lv1_iteration = 0;
@@ -494,15 +981,10 @@ struct CX1 {
         while (lv1_start_bucket_ < kNumBuckets) {
             xtimer_t lv1_timer;
 
-            lv1_iteration++;
+            lv1_iteration_ = lv1_iteration++;
 
             // --- finds the bucket range for this iteration ---
-            if (lv1_just_go_) {
-                lv1_end_bucket_ = find_end_buckets_with_rank_(lv1_start_bucket_, kNumBuckets, max_mem_remain_, bytes_per_sorting_item_, lv1_num_items_);
-            }
-            else {
-                lv1_end_bucket_ = find_end_buckets_(lv1_start_bucket_, kNumBuckets, max_lv1_items_, lv1_num_items_);
-            }
+            lv1_end_bucket_ = find_lv1_end_bucket_(lv1_start_bucket_);
 
             if (lv1_num_items_ == 0) {
                 fprintf(stderr, "Bucket %d too large for lv1: %lld > %lld\n", lv1_end_bucket_, (long long)bucket_sizes_[lv1_end_bucket_], (long long)max_lv1_items_);
@@ -516,7 +998,13 @@ struct CX1 {
             }
 
             // --- scan to fill offset ---
-            lv1_fill_offset_mt_();
+            if (lv1_spilled_) {
+                assert(lv1_end_bucket_ == lv1_spill_ends_[lv1_iteration_]);
+                lv1_load_spilled_mt_();
+            }
+            else {
+                lv1_fill_offset_mt_();
+            }
 
             if (lv1_items_special_.size() > kSpDiffMaxNum) {
                 fprintf(stderr, "Too many large diff items (%lu) from in buckets [%d, %d)\n", lv1_items_special_.size(), lv1_start_bucket_, lv1_end_bucket_);
@@ -604,7 +1092,7 @@ struct CX1 {
 
         if (kCX1Verbose >= 2) {
             lv0_timer.stop();
-            xlog("Main loop done. Time elapsed: %.4f\n", lv0_timer.elapsed());
+            xlog("Main loop done. Lv1 iterations: %d. Time elapsed: %.4f\n", lv1_iteration, lv0_timer.elapsed());
         }
 
         if (kCX1Verbose >= 2) {
@@ -614,6 +1102,7 @@ struct CX1 {
         }
 
         post_proc_func_(*g_);
+        lv1_spill_clean_();
         clean_();
 
         if (kCX1Verbose >= 2) {
@@ -25,6 +25,7 @@
 #include <stdint.h>
 #include <vector>
 #include <string>
+#include <algorithm>
 #include "definitions.h"
 #include "cx1.h"
 #include "sdbg_multi_io.h"
@@ -34,6 +35,7 @@
 
 struct read2sdbg_opt_t {
     int kmer_k;
+    std::string k_list;
     int kmer_freq_threshold;
     double host_mem;
     double gpu_mem;
@@ -44,9 +46,14 @@ struct read2sdbg_opt_t {
     std::string output_prefix;
     int mem_flag;
     bool need_mercy;
+    std::string spill_dir;
+    bool direct_io;
+    bool adaptive_buckets;
+    bool compress_sdbg;
 
     read2sdbg_opt_t() {
         kmer_k = 21;
+        k_list = "";
         kmer_freq_threshold = 2;
         host_mem = 0;
         gpu_mem = 0;
@@ -56,6 +63,9 @@ struct read2sdbg_opt_t {
         output_prefix = "out";
         mem_flag = 1;
         need_mercy = false;
+        direct_io = false;
+        adaptive_buckets = false;
+        compress_sdbg = false;
     }
 };
 
@@ -68,10 +78,14 @@ static const int64_t kMinLv2BatchSize = 2 * 1024 * 1024;
 static const int64_t kMinLv2BatchSizeGPU = 64 * 1024 * 1024;
 static const int64_t kDefaultLv1ScanTime = 8;
 static const int64_t kMaxLv1ScanTime = 64;
+static const int64_t kMaxLv1SpillTime = 256; // lv1 iterations load spilled items instead of scanning the reads
+static const int64_t kMinMercyCandPerBuffer = 4096; // when host_mem is short, the buffers only batch the spill writes
 static const int kSentinelValue = 4;
 static const int64_t kMaxDummyEdges = 4294967294LL;
 static const int kBWTCharNumBits = 3;
+static const int kSdbgCompressLevel = 1; // the W/last/tip items are highly redundant, a fast level is enough
 static const int kTopCharShift = kBitsPerEdgeWord - kBitsPerEdgeChar; // bits >> to get the most significant char
+static const int kMaxWordsPerSubstring = (kMaxK * kBitsPerEdgeChar + kBWTCharNumBits + 1 + kBitsPerEdgeWord - 1) / kBitsPerEdgeWord; // in both stages
 
 struct read2sdbg_global_t {
     CX1<read2sdbg_global_t, kNumBuckets> cx1;
@@ -86,11 +100,12 @@ struct read2sdbg_global_t {
     int64_t gpu_mem;
     int mem_flag;
     bool need_mercy;
+    bool direct_io;
+    bool compress_sdbg;
     std::string read_lib_file;
     std::string assist_seq_file;
     std::string output_prefix;
 
-    int num_k1_per_read; // max_read_len - kmer_k
     int num_mercy_files;
     int words_per_edge; // number of (32-bit) words needed to represent a (k+1)-mer
     int64_t words_per_substring; // substrings to be sorted by GPU
@@ -137,26 +152,116 @@ struct read2sdbg_global_t {
     int64_t *thread_edge_counting;
 
     // output-stage1
-    // std::vector<pthread_spinlock_t> mercy_file_locks;
-    std::vector<FILE *> mercy_files;
+    // mercy candidates are buffered in memory per output thread and per mercy file, at [tid * num_mercy_files + fid];
+    // a buffer reaching max_mercy_cand_per_buffer is appended to its mercy file, which is only created on the first spill
+    std::vector<std::vector<uint64_t> > mercy_cand;
+    int64_t max_mercy_cand_per_buffer;
+    std::vector<FILE *> mercy_files; // NULL if nothing spilled
+    pthread_mutex_t mercy_file_lock;
     std::vector<std::vector<uint64_t> > lv2_output_items;
 
     // output-stage2
     SdbgWriter sdbg_writer;
+    int lv2_last_output_thread; // the thread that wrote the end of the last lv2 batch
 };
 
+inline int64_t MaxLv1ScanTime(read2sdbg_global_t &g) {
+    return g.cx1.lv1_spill_prefix_.empty() ? kMaxLv1ScanTime : kMaxLv1SpillTime;
+}
+
+// the bucket of a sorting key whose first chars are packed in w
+inline int BucketOf(read2sdbg_global_t &g, uint32_t w) {
+    static const int kPrefixShift = (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar;
+
+    if (g.cx1.fine_key_bucket_.empty()) {
+        return w >> kPrefixShift;
+    }
+
+    return g.cx1.bucket_of_fine_key(w >> (kPrefixShift - CX1<read2sdbg_global_t, kNumBuckets>::kFineKeyBits));
+}
+
+// the bits of the (k-1)-mer in each of the kWords words of a lv2 substring
+template <int kWords>
+struct KMinusOneMerMask {
+    uint32_t mask[kWords];
+
+    explicit KMinusOneMerMask(int kmer_k) {
+        for (int i = 0; i < kWords; ++i) {
+            int num_bits = std::min(std::max((kmer_k - 1) * kBitsPerEdgeChar - i * kBitsPerEdgeWord, 0), kBitsPerEdgeWord);
+            mask[i] = num_bits == 0 ? 0 : ~0U << (kBitsPerEdgeWord - num_bits);
+        }
+    }
+};
+
+// helper: see whether two lv2 items of kWords words have the same (k-1)-mer
+template <int kWords>
+inline bool IsDiffKMinusOneMer(uint32_t *item1, uint32_t *item2, int64_t spacing, const KMinusOneMerMask<kWords> &m) {
+    for (int i = kWords - 1; i >= 0; --i) {
+        if (m.mask[i] && ((item1[i * spacing] ^ item2[i * spacing]) & m.mask[i])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief call Kernels<w>::Set(g) with w = g.words_per_substring, to point the cx1 callbacks to the lv2 kernels
+ * compiled for w words per substring; their per-word loops then have a fixed trip count
+ */
+template <template <int> class Kernels>
+inline void SetLv2Kernels(read2sdbg_global_t &g) {
+    switch (g.words_per_substring) {
+    case 1:
+        Kernels<1>::Set(g);
+        break;
+
+    case 2:
+        Kernels<2>::Set(g);
+        break;
+
+    case 3:
+        Kernels<3>::Set(g);
+        break;
+
+    case 4:
+        Kernels<4>::Set(g);
+        break;
+
+    case 5:
+        Kernels<5>::Set(g);
+        break;
+
+    case 6:
+        Kernels<6>::Set(g);
+        break;
+
+    case 7:
+        Kernels<7>::Set(g);
+        break;
+
+    case 8:
+        Kernels<8>::Set(g);
+        break;
+
+    case 9:
+        Kernels<9>::Set(g);
+        break;
+
+    default:
+        xerr_and_exit("No lv2 kernels for %d words per substring, max: %d\n", (int)g.words_per_substring, kMaxWordsPerSubstring);
+    }
+}
+
 namespace s1 {
 // stage1 cx1 core functions
 int64_t s1_encode_lv1_diff_base(int64_t read_id, read2sdbg_global_t &g);
+void    s1_load_reads(read2sdbg_global_t &g); // once, before the stages of every k
 void    s1_read_input_prepare(read2sdbg_global_t &g); // num_items_, num_cpu_threads_ and num_output_threads_ must be set here
 void   *s1_lv0_calc_bucket_size(void *); // pthread working function
-void    s1_init_global_and_set_cx1(read2sdbg_global_t &g);
+void    s1_init_global_and_set_cx1(read2sdbg_global_t &g); // also sets the lv1 sorting and lv2 callbacks
 void   *s1_lv1_fill_offset(void *); // pthread working function
-void    s1_lv1_direct_sort_and_count(read2sdbg_global_t &g);
-void   *s1_lv2_extract_substr(void *); // pthread working function
 void    s1_lv2_sort(read2sdbg_global_t &g);
-void    s1_lv2_pre_output_partition(read2sdbg_global_t &g);
-void   *s1_lv2_output(void *); // pthread working function
 void    s1_lv2_post_output(read2sdbg_global_t &g);
 void    s1_post_proc(read2sdbg_global_t &g);
 }
@@ -166,13 +271,10 @@ namespace s2 {
 int64_t s2_encode_lv1_diff_base(int64_t read_id, read2sdbg_global_t &g);
 void    s2_read_mercy_prepare(read2sdbg_global_t &g); // num_items_, num_cpu_threads_ and num_output_threads_ must be set here
 void   *s2_lv0_calc_bucket_size(void *); // pthread working function
-void    s2_init_global_and_set_cx1(read2sdbg_global_t &g);
+void    s2_init_global_and_set_cx1(read2sdbg_global_t &g); // also sets the lv1 sorting and lv2 callbacks
 void   *s2_lv1_fill_offset(void *); // pthread working function
-void    s2_lv1_direct_sort_and_proc(read2sdbg_global_t &g);
-void   *s2_lv2_extract_substr(void *); // pthread working function
 void    s2_lv2_sort(read2sdbg_global_t &g);
 void    s2_lv2_pre_output_partition(read2sdbg_global_t &g);
-void   *s2_lv2_output(void *); // pthread working function
 void    s2_lv2_post_output(read2sdbg_global_t &g);
 void    s2_post_proc(read2sdbg_global_t &g);
 }
@@ -36,8 +36,6 @@
 #include "lv2_cpu_sort.h"
 // helping functions
 
-extern void kt_dfor(int n_threads, void (*func)(void *, long, int), void *data, long n);
-
 namespace cx1_read2sdbg {
 
 namespace s1 {
@@ -48,39 +46,18 @@ typedef CX1<read2sdbg_global_t, kNumBuckets>::readpartition_data_t readpartition
 typedef CX1<read2sdbg_global_t, kNumBuckets>::bucketpartition_data_t bucketpartition_data_t;
 typedef CX1<read2sdbg_global_t, kNumBuckets>::outputpartition_data_t outputpartition_data_t;
 
+template <int kWords> struct Lv2Kernels; // lv1 sorting and lv2 callbacks for kWords words per substring
+
 /**
- * @brief encode read_id and its offset in one int64_t
+ * @brief encode the position of a read (start_index + offset) in one int64_t
  */
-inline int64_t EncodeOffset(int64_t read_id, int offset, int strand, SequencePackage &p) {
-    return ((p.get_start_index(read_id) + offset) << 1) | strand;
+inline int64_t EncodeOffset(int64_t start_index, int offset, int strand) {
+    return ((start_index + offset) << 1) | strand;
 }
 
-// helper: see whether two lv2 items have the same (k-1)-mer
-inline bool IsDiffKMinusOneMer(uint32_t *item1, uint32_t *item2, int64_t spacing, int kmer_k) {
-    // mask extra bits
-    int chars_in_last_word = (kmer_k - 1) % kCharsPerEdgeWord;
-    int num_full_words = (kmer_k - 1) / kCharsPerEdgeWord;
-
-    if (chars_in_last_word > 0) {
-        uint32_t w1 = item1[num_full_words * spacing];
-        uint32_t w2 = item2[num_full_words * spacing];
-
-        if ((w1 >> (kCharsPerEdgeWord - chars_in_last_word) * kBitsPerEdgeChar) != (w2 >> (kCharsPerEdgeWord - chars_in_last_word) * kBitsPerEdgeChar)) {
-            return true;
-        }
-    }
-
-    for (int i = num_full_words - 1; i >= 0; --i) {
-        if (item1[i * spacing] != item2[i * spacing]) {
-            return true;
-        }
-    }
-
-    return false;
-}
-
-inline uint8_t ExtractHeadTail(uint32_t *item, int64_t spacing, int words_per_substring) {
-    return *(item + spacing * (words_per_substring - 1)) & ((1 << 2 * kBWTCharNumBits) - 1);
+template <int kWords>
+inline uint8_t ExtractHeadTail(uint32_t *item, int64_t spacing) {
+    return *(item + spacing * (kWords - 1)) & ((1 << 2 * kBWTCharNumBits) - 1);
 }
 
 inline uint8_t ExtractPrevNext(int i, int64_t *readinfo) {
@@ -90,31 +67,26 @@ inline uint8_t ExtractPrevNext(int i, int64_t *readinfo) {
 // cx1 core functions
 
 int64_t s1_encode_lv1_diff_base(int64_t read_id, read2sdbg_global_t &g) {
-    return EncodeOffset(read_id, 0, 0, g.package);
+    return EncodeOffset(g.package.get_start_index(read_id), 0, 0);
 }
 
-void s1_read_input_prepare(read2sdbg_global_t &globals) {
+void s1_load_reads(read2sdbg_global_t &globals) {
     bool is_reverse = true;
     int64_t num_bases, num_reads;
     GetBinaryLibSize(globals.read_lib_file, num_bases, num_reads);
 
     globals.num_short_reads = num_reads;
     globals.num_short_read_bases = num_bases;
+    long long num_ass_bases = 0, num_ass_seq = 0;
 
     if (globals.assist_seq_file != "") {
         FILE *assist_seq_info = OpenFileAndCheck((globals.assist_seq_file + ".info").c_str(), "r");
-        long long num_ass_bases, num_ass_seq;
         assert(fscanf(assist_seq_info, "%lld%lld", &num_ass_seq, &num_ass_bases) == 2);
         fclose(assist_seq_info);
-
-        num_bases += num_ass_bases;
-        num_reads += num_ass_seq;
     }
-    
-    globals.package.reserve_num_seq(num_reads);
-    globals.package.reserve_bases(num_bases);
 
-    ReadBinaryLibs(globals.read_lib_file, globals.package, globals.lib_info, is_reverse);
+    // the reads may be mapped from the library, only the assist seq is held in private memory then
+    ReadBinaryLibs(globals.read_lib_file, globals.package, globals.lib_info, is_reverse, false, num_ass_seq, num_ass_bases);
     // set up these figures before reading assist seq
     globals.max_read_length = globals.package.max_read_len();
 
@@ -146,21 +118,23 @@ void s1_read_input_prepare(read2sdbg_global_t &globals) {
 
     globals.read_length_mask = (1 << bits_read_length) - 1;
     globals.offset_num_bits = bits_read_length;
+}
 
+void s1_read_input_prepare(read2sdbg_global_t &globals) {
     // --- allocate memory for is_solid bit_vector
-    globals.num_k1_per_read = globals.max_read_length - globals.kmer_k;
-
     if (globals.kmer_freq_threshold == 1) {
         // do not need to count solid kmers
         globals.mem_packed_reads = globals.package.size_in_byte();
     }
     else {
-        globals.is_solid.reset(globals.num_k1_per_read * globals.num_short_reads);
-        globals.mem_packed_reads = DivCeiling(globals.num_k1_per_read * globals.num_short_reads, 8) + globals.package.size_in_byte();
+        // one bit per base of the short reads: the (k+1)-mer at offset i of a read is solid if
+        // bit get_start_index(read_id) + i is set, so the size does not depend on the max read length
+        globals.is_solid.reset(globals.num_short_read_bases);
+        globals.mem_packed_reads = DivCeiling(globals.num_short_read_bases, 8) + globals.package.size_in_byte();
     }
 
     int64_t mem_low_bound = globals.mem_packed_reads
-                            + kNumBuckets * sizeof(int64_t) * (globals.num_cpu_threads * 3 + 1)
+                            + kNumBuckets * sizeof(int64_t) * (globals.num_cpu_threads * cx1_t::kReadPartitionsPerThread * 2 + globals.num_cpu_threads + 1)
                             + (kMaxMulti_t + 1) * (globals.num_output_threads + 1) * sizeof(int64_t);
     mem_low_bound *= 1.05;
 
@@ -182,26 +156,28 @@ void *s1_lv0_calc_bucket_size(void *_data) {
     GenericKmer k_minus1_mer, rev_k_minus1_mer; // (k-1)-mer and its rc
 
     for (int64_t read_id = rp.rp_start_id; read_id < rp.rp_end_id; ++read_id) {
-        int read_length = globals.package.length(read_id);
+        uint64_t start_index, end_index;
+        globals.package.get_range(read_id, start_index, end_index);
+        int read_length = end_index - start_index;
 
         if (read_length < globals.kmer_k + 1) {
             continue;
         }
 
-        int64_t which_word = globals.package.get_start_index(read_id) / 16;
-        int64_t offset = globals.package.get_start_index(read_id) % 16;
-        uint32_t *read_p = &globals.package.packed_seq[which_word];
+        int64_t which_word = start_index / 16;
+        int64_t offset = start_index % 16;
+        const uint32_t *read_p = globals.package.get_word_ptr(which_word);
 
         k_minus1_mer.init(read_p, offset, globals.kmer_k - 1);
         rev_k_minus1_mer = k_minus1_mer;
         rev_k_minus1_mer.ReverseComplement(globals.kmer_k - 1);
 
         // the first one special handling
-        bucket_sizes[k_minus1_mer.data_[0] >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar]++;
-        bucket_sizes[rev_k_minus1_mer.data_[0] >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar]++;
+        bucket_sizes[BucketOf(globals, k_minus1_mer.data_[0])]++;
+        bucket_sizes[BucketOf(globals, rev_k_minus1_mer.data_[0])]++;
 
         int last_char_offset = globals.kmer_k - 1;
-        int c = globals.package.get_base(read_id, last_char_offset);
+        int c = globals.package.get_base_at(start_index + last_char_offset);
         k_minus1_mer.ShiftAppend(c, globals.kmer_k - 1);
         rev_k_minus1_mer.ShiftPreappend(3 - c, globals.kmer_k - 1);
 
@@ -209,20 +185,21 @@ void *s1_lv0_calc_bucket_size(void *_data) {
             int cmp = k_minus1_mer.cmp(rev_k_minus1_mer, globals.kmer_k - 1);
 
             if (cmp > 0) {
-                bucket_sizes[rev_k_minus1_mer.data_[0] >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar]++;
+                bucket_sizes[BucketOf(globals, rev_k_minus1_mer.data_[0])]++;
             }
             else {
-                bucket_sizes[k_minus1_mer.data_[0] >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar]++;
+                bucket_sizes[BucketOf(globals, k_minus1_mer.data_[0])]++;
             }
 
-            int c = globals.package.get_base(read_id, ++last_char_offset);
+            ++last_char_offset;
+            int c = globals.package.get_base_at(start_index + last_char_offset);
             k_minus1_mer.ShiftAppend(c, globals.kmer_k - 1);
             rev_k_minus1_mer.ShiftPreappend(3 - c, globals.kmer_k - 1);
         }
 
         // last one special handling
-        bucket_sizes[k_minus1_mer.data_[0] >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar]++;
-        bucket_sizes[rev_k_minus1_mer.data_[0] >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar]++;
+        bucket_sizes[BucketOf(globals, k_minus1_mer.data_[0])]++;
+        bucket_sizes[BucketOf(globals, rev_k_minus1_mer.data_[0])]++;
     }
 
     return NULL;
@@ -249,6 +226,8 @@ void s1_init_global_and_set_cx1(read2sdbg_global_t &globals) {
         xlog("%d words per substring\n", globals.words_per_substring);
     }
 
+    SetLv2Kernels<Lv2Kernels>(globals);
+
     // lv2 bytes: substring, permutation, readinfo
     int64_t lv2_bytes_per_item = (globals.words_per_substring) * sizeof(uint32_t) + sizeof(uint32_t) + sizeof(int64_t);
 
@@ -266,9 +245,9 @@ void s1_init_global_and_set_cx1(read2sdbg_global_t &globals) {
     // --- memory stuff ---
     int64_t mem_remained = globals.host_mem
                            - globals.mem_packed_reads
-                           - kNumBuckets * sizeof(int64_t) * (globals.num_cpu_threads * 3 + 1)
+                           - kNumBuckets * sizeof(int64_t) * (globals.cx1.num_read_partitions_ * 2 + globals.num_cpu_threads + 1)
                            - (kMaxMulti_t + 1) * (globals.num_output_threads + 1) * sizeof(int64_t);
-    int64_t min_lv1_items = globals.tot_bucket_size / (kMaxLv1ScanTime - 0.5);
+    int64_t min_lv1_items = globals.tot_bucket_size / (MaxLv1ScanTime(globals) - 0.5);
     int64_t min_lv2_items = std::max(globals.max_bucket_size, kMinLv2BatchSize);
 
     if (globals.mem_flag == 1) {
@@ -282,7 +261,7 @@ void s1_init_global_and_set_cx1(read2sdbg_global_t &globals) {
     }
     else if (globals.mem_flag == 0) {
         // min memory
-        globals.cx1.max_lv1_items_ = std::max(globals.cx1.max_lv2_items_, int64_t(globals.tot_bucket_size / (kMaxLv1ScanTime - 0.5)));
+        globals.cx1.max_lv1_items_ = std::max(globals.cx1.max_lv2_items_, min_lv1_items);
         int64_t mem_needed = globals.cx1.max_lv1_items_ * cx1_t::kLv1BytePerItem + globals.cx1.max_lv2_items_ * lv2_bytes_per_item;
 
         if (mem_needed > mem_remained) {
@@ -326,9 +305,9 @@ void s1_init_global_and_set_cx1(read2sdbg_global_t &globals) {
     int64_t mem_remained = globals.host_mem
                            - globals.mem_packed_reads
                            - globals.num_cpu_threads * 65536 * sizeof(uint64_t) // radix sort buckets
-                           - kNumBuckets * sizeof(int64_t) * (globals.num_cpu_threads * 3 + 1)
+                           - kNumBuckets * sizeof(int64_t) * (globals.cx1.num_read_partitions_ * 2 + globals.num_cpu_threads + 1)
                            - (kMaxMulti_t + 1) * (globals.num_output_threads + 1) * sizeof(int64_t);
-    int64_t min_lv1_items = globals.tot_bucket_size / (kMaxLv1ScanTime - 0.5);
+    int64_t min_lv1_items = globals.tot_bucket_size / (MaxLv1ScanTime(globals) - 0.5);
 
     if (globals.mem_flag == 1) {
         // auto set memory
@@ -342,9 +321,9 @@ void s1_init_global_and_set_cx1(read2sdbg_global_t &globals) {
 
     }
     else if (globals.mem_flag == 0) {
-        // min memory
-        globals.cx1.max_lv1_items_ = int64_t(globals.tot_bucket_size / (kMaxLv1ScanTime - 0.5));
-        int64_t mem_needed = globals.cx1.max_lv1_items_ * cx1_t::kLv1BytePerItem;
+        // min memory: lv1 items for the most iterations allowed, sorting items for the largest bucket only
+        globals.cx1.max_lv1_items_ = std::max(min_lv1_items, globals.max_bucket_size);
+        int64_t mem_needed = globals.cx1.max_lv1_items_ * cx1_t::kLv1BytePerItem + globals.max_bucket_size * lv2_bytes_per_item;
 
         if (mem_needed > mem_remained) {
             globals.cx1.adjust_mem_just_go(mem_remained, lv2_bytes_per_item, min_lv1_items, globals.max_bucket_size,
@@ -392,8 +371,23 @@ void s1_init_global_and_set_cx1(read2sdbg_global_t &globals) {
         xlog("Number of files for mercy candidate reads: %d\n", globals.num_mercy_files);
     }
 
-    for (int i = 0; i < globals.num_mercy_files; ++i) {
-        globals.mercy_files.push_back(OpenFileAndCheck(FormatString("%s.mercy_cand.%d", globals.output_prefix.c_str(), i), "wb"));
+    if (globals.need_mercy) {
+        // whatever the sorting arrays leave of host_mem holds the candidates, half of it for vector growth
+#ifdef USE_GPU
+        int64_t mem_sorting = globals.cx1.max_lv1_items_ * sizeof(int) + globals.cx1.max_lv2_items_ * lv2_bytes_per_item;
+#else
+        int64_t mem_sorting = globals.cx1.max_mem_remain_;
+#endif
+        int64_t num_buffers = (int64_t)globals.num_output_threads * globals.num_mercy_files;
+        globals.max_mercy_cand_per_buffer = std::max(mem_remained - mem_sorting, (int64_t)0) / 2 / sizeof(uint64_t) / num_buffers;
+        globals.max_mercy_cand_per_buffer = std::max(globals.max_mercy_cand_per_buffer, (int64_t)kMinMercyCandPerBuffer);
+        globals.mercy_cand.resize(num_buffers);
+        globals.mercy_files.assign(globals.num_mercy_files, NULL);
+        pthread_mutex_init(&globals.mercy_file_lock, NULL);
+
+        if (cx1_t::kCX1Verbose >= 3) {
+            xlog("Max mercy candidates in memory per thread: %lld\n", (long long)globals.max_mercy_cand_per_buffer * globals.num_mercy_files);
+        }
     }
 
     pthread_mutex_init(&globals.lv1_items_scanning_lock, NULL); // init lock
@@ -420,50 +414,56 @@ void *s1_lv1_fill_offset(void *_data) {
     int key;
 
     for (int64_t read_id = rp.rp_start_id; read_id < rp.rp_end_id; ++read_id) {
-        int read_length = globals.package.length(read_id);
+        uint64_t start_index, end_index;
+        globals.package.get_range(read_id, start_index, end_index);
+        int read_length = end_index - start_index;
 
         if (read_length < globals.kmer_k + 1) {
             continue;
         }
 
-        int64_t which_word = globals.package.get_start_index(read_id) / 16;
-        int64_t offset = globals.package.get_start_index(read_id) % 16;
-        uint32_t *read_p = &globals.package.packed_seq[which_word];
+        int64_t which_word = start_index / 16;
+        int64_t offset = start_index % 16;
+        const uint32_t *read_p = globals.package.get_word_ptr(which_word);
 
         k_minus1_mer.init(read_p, offset, globals.kmer_k - 1);
         rev_k_minus1_mer = k_minus1_mer;
         rev_k_minus1_mer.ReverseComplement(globals.kmer_k - 1);
 
         // ===== this is a macro to save some copy&paste ================
-#define CHECK_AND_SAVE_OFFSET(offset, strand)                                                                  \
-    do {                                                                                                       \
-        if (globals.cx1.cur_lv1_buckets_[key]) {                                                               \
-            int key_ = globals.cx1.bucket_rank_[key];                                                          \
-            int64_t full_offset = EncodeOffset(read_id, offset, strand, globals.package);                      \
-            int64_t differential = full_offset - prev_full_offsets[key_];                                      \
-            if (differential > cx1_t::kDifferentialLimit) {                                                    \
-                pthread_mutex_lock(&globals.lv1_items_scanning_lock);                                          \
-                globals.lv1_items[rp.rp_bucket_offsets[key_]++] = -globals.cx1.lv1_items_special_.size() - 1;  \
-                globals.cx1.lv1_items_special_.push_back(full_offset);                                         \
-                pthread_mutex_unlock(&globals.lv1_items_scanning_lock);                                        \
-            } else {                                                                                           \
-                assert((int) differential >= 0);                                                               \
-                globals.lv1_items[rp.rp_bucket_offsets[key_]++] = (int) differential;                          \
-            }                                                                                                  \
-            prev_full_offsets[key_] = full_offset;                                                             \
-        }                                                                                                      \
+#define CHECK_AND_SAVE_OFFSET(offset, strand)                                                                     \
+    do {                                                                                                          \
+        if (globals.cx1.cur_lv1_buckets_[key]) {                                                                  \
+            int key_ = globals.cx1.bucket_rank_[key];                                                             \
+            int64_t full_offset = EncodeOffset(start_index, offset, strand);                                      \
+            if (globals.cx1.lv1_spilling_) {                                                                      \
+                globals.cx1.lv1_spill_item_(rp.rp_id, key_, full_offset);                                         \
+            } else {                                                                                              \
+                int64_t differential = full_offset - prev_full_offsets[key_];                                     \
+                if (differential > cx1_t::kDifferentialLimit) {                                                   \
+                    pthread_mutex_lock(&globals.lv1_items_scanning_lock);                                         \
+                    globals.lv1_items[rp.rp_bucket_offsets[key_]++] = -globals.cx1.lv1_items_special_.size() - 1; \
+                    globals.cx1.lv1_items_special_.push_back(full_offset);                                        \
+                    pthread_mutex_unlock(&globals.lv1_items_scanning_lock);                                       \
+                } else {                                                                                          \
+                    assert((int) differential >= 0);                                                              \
+                    globals.lv1_items[rp.rp_bucket_offsets[key_]++] = (int) differential;                         \
+                }                                                                                                 \
+            }                                                                                                     \
+            prev_full_offsets[key_] = full_offset;                                                                \
+        }                                                                                                         \
     } while (0)
         // ^^^^^ why is the macro surrounded by a do-while? please ask Google
         // =========== end macro ==========================
 
         // the first one special handling
-        key = k_minus1_mer.data_[0] >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar;
+        key = BucketOf(globals, k_minus1_mer.data_[0]);
         CHECK_AND_SAVE_OFFSET(0, 0);
-        key = rev_k_minus1_mer.data_[0] >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar;
+        key = BucketOf(globals, rev_k_minus1_mer.data_[0]);
         CHECK_AND_SAVE_OFFSET(0, 1);
 
         int last_char_offset = globals.kmer_k - 1;
-        int c = globals.package.get_base(read_id, last_char_offset);
+        int c = globals.package.get_base_at(start_index + last_char_offset);
         k_minus1_mer.ShiftAppend(c, globals.kmer_k - 1);
         rev_k_minus1_mer.ShiftPreappend(3 - c, globals.kmer_k - 1);
 
@@ -472,37 +472,38 @@ void *s1_lv1_fill_offset(void *_data) {
             int cmp = k_minus1_mer.cmp(rev_k_minus1_mer, globals.kmer_k - 1);
 
             if (cmp > 0) {
-                key = rev_k_minus1_mer.data_[0] >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar;
+                key = BucketOf(globals, rev_k_minus1_mer.data_[0]);
                 CHECK_AND_SAVE_OFFSET(last_char_offset - globals.kmer_k + 2, 1);
             }
             else if (cmp < 0) {
-                key = k_minus1_mer.data_[0] >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar;
+                key = BucketOf(globals, k_minus1_mer.data_[0]);
                 CHECK_AND_SAVE_OFFSET(last_char_offset - globals.kmer_k + 2, 0);
             }
             else {
                 // a not-that-math-correct solution if the edge is palindrome, but works well enough
-                int prev = globals.package.get_base(read_id, last_char_offset - (globals.kmer_k - 1));
-                int next = globals.package.get_base(read_id, last_char_offset + 1);
+                int prev = globals.package.get_base_at(start_index + last_char_offset - (globals.kmer_k - 1));
+                int next = globals.package.get_base_at(start_index + last_char_offset + 1);
 
                 if (prev <= 3 - next) {
-                    key = rev_k_minus1_mer.data_[0] >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar;
+                    key = BucketOf(globals, rev_k_minus1_mer.data_[0]);
                     CHECK_AND_SAVE_OFFSET(last_char_offset - globals.kmer_k + 2, 0);
                 }
                 else {
-                    key = rev_k_minus1_mer.data_[0] >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar;
+                    key = BucketOf(globals, rev_k_minus1_mer.data_[0]);
                     CHECK_AND_SAVE_OFFSET(last_char_offset - globals.kmer_k + 2, 1);
                 }
             }
 
-            int c = globals.package.get_base(read_id, ++last_char_offset);
+            ++last_char_offset;
+            int c = globals.package.get_base_at(start_index + last_char_offset);
             k_minus1_mer.ShiftAppend(c, globals.kmer_k - 1);
             rev_k_minus1_mer.ShiftPreappend(3 - c, globals.kmer_k - 1);
         }
 
         // the last one special handling
-        key = k_minus1_mer.data_[0] >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar;
+        key = BucketOf(globals, k_minus1_mer.data_[0]);
         CHECK_AND_SAVE_OFFSET(last_char_offset - globals.kmer_k + 2, 0);
-        key = rev_k_minus1_mer.data_[0] >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar;
+        key = BucketOf(globals, rev_k_minus1_mer.data_[0]);
         CHECK_AND_SAVE_OFFSET(last_char_offset - globals.kmer_k + 2, 1);
     }
 
@@ -512,11 +513,12 @@ void *s1_lv1_fill_offset(void *_data) {
     return NULL;
 }
 
+template <int kWords>
 void s1_extract_subtstr_(int bp_from, int bp_to, read2sdbg_global_t &globals, uint32_t *substr, int64_t *readinfo_ptr, int num_items) {
     int *lv1_p = globals.lv1_items + globals.cx1.rp_[0].rp_bucket_offsets[bp_from];
 
     for (int b = bp_from; b < bp_to; ++b) {
-        for (int t = 0; t < globals.num_cpu_threads; ++t) {
+        for (int t = 0; t < globals.cx1.num_read_partitions_; ++t) {
             int64_t full_offset = globals.cx1.rp_[t].rp_lv1_differential_base;
             int num = globals.cx1.rp_[t].rp_bucket_sizes[b];
 
@@ -528,24 +530,25 @@ void s1_extract_subtstr_(int bp_from, int bp_to, read2sdbg_global_t &globals, ui
                     full_offset = globals.cx1.lv1_items_special_[-1 - * (lv1_p++)];
                 }
 
-                int64_t read_id = globals.package.get_id(full_offset >> 1);
+                uint64_t start_index, end_index;
+                globals.package.get_id(full_offset >> 1, start_index, end_index);
                 int strand = full_offset & 1;
-                int offset = (full_offset >> 1) - globals.package.get_start_index(read_id);
-                int read_length = globals.package.length(read_id);
+                int offset = (full_offset >> 1) - start_index;
+                int read_length = end_index - start_index;
                 int num_chars_to_copy = globals.kmer_k - 1;
                 unsigned char prev, next, head, tail; // (k+1)=abScd, prev=a, head=b, tail=c, next=d
 
                 assert(offset < read_length);
 
                 if (offset > 1) {
-                    head = globals.package.get_base(read_id, offset - 1);
-                    prev = globals.package.get_base(read_id, offset - 2);
+                    head = globals.package.get_base_at(start_index + offset - 1);
+                    prev = globals.package.get_base_at(start_index + offset - 2);
                 }
                 else {
                     prev = kSentinelValue;
 
                     if (offset > 0) {
-                        head = globals.package.get_base(read_id, offset - 1);
+                        head = globals.package.get_base_at(start_index + offset - 1);
                     }
                     else {
                         head = kSentinelValue;
@@ -553,36 +556,36 @@ void s1_extract_subtstr_(int bp_from, int bp_to, read2sdbg_global_t &globals, ui
                 }
 
                 if (offset + globals.kmer_k < read_length) {
-                    tail = globals.package.get_base(read_id, offset + globals.kmer_k - 1);
-                    next = globals.package.get_base(read_id, offset + globals.kmer_k);
+                    tail = globals.package.get_base_at(start_index + offset + globals.kmer_k - 1);
+                    next = globals.package.get_base_at(start_index + offset + globals.kmer_k);
                 }
                 else {
                     next = kSentinelValue;
 
                     if (offset + globals.kmer_k - 1 < read_length) {
-                        tail = globals.package.get_base(read_id, offset + globals.kmer_k - 1);
+                        tail = globals.package.get_base_at(start_index + offset + globals.kmer_k - 1);
                     }
                     else {
                         tail = kSentinelValue;
                     }
                 }
 
-                int64_t which_word = globals.package.get_start_index(read_id) / 16;
-                int start_offset = globals.package.get_start_index(read_id) % 16;
-                uint32_t *read_p = &globals.package.packed_seq[which_word];
+                int64_t which_word = start_index / 16;
+                int start_offset = start_index % 16;
+                const uint32_t *read_p = globals.package.get_word_ptr(which_word);
                 int words_this_read = DivCeiling(start_offset + read_length, 16);
 
                 if (strand == 0) {
                     CopySubstring(substr, read_p, offset + start_offset, num_chars_to_copy,
-                                  num_items, words_this_read, globals.words_per_substring);
-                    uint32_t *last_word = substr + int64_t(globals.words_per_substring - 1) * num_items;
+                                  num_items, words_this_read, kWords);
+                    uint32_t *last_word = substr + int64_t(kWords - 1) * num_items;
                     *last_word |= (head << kBWTCharNumBits) | tail;
                     *readinfo_ptr = (full_offset << 6) | (prev << 3) | next;
                 }
                 else {
                     CopySubstringRC(substr, read_p, offset + start_offset, num_chars_to_copy,
-                                    num_items, words_this_read, globals.words_per_substring);
-                    uint32_t *last_word = substr + int64_t(globals.words_per_substring - 1) * num_items;
+                                    num_items, words_this_read, kWords);
+                    uint32_t *last_word = substr + int64_t(kWords - 1) * num_items;
                     *last_word |= ((tail == kSentinelValue ? kSentinelValue : 3 - tail) << kBWTCharNumBits) | (head == kSentinelValue ? kSentinelValue : 3 - head);
                     *readinfo_ptr = (full_offset << 6) | ((next == kSentinelValue ? kSentinelValue : (3 - next)) << 3)
                                     | (prev == kSentinelValue ? kSentinelValue : (3 - prev));
@@ -595,6 +598,7 @@ void s1_extract_subtstr_(int bp_from, int bp_to, read2sdbg_global_t &globals, ui
     }
 }
 
+template <int kWords>
 void *s1_lv2_extract_substr(void *_data) {
     bucketpartition_data_t &bp = *((bucketpartition_data_t *) _data);
     read2sdbg_global_t &globals = *(bp.globals);
@@ -603,7 +607,7 @@ void *s1_lv2_extract_substr(void *_data) {
     int64_t *read_info_p = globals.lv2_read_info +
                            (globals.cx1.rp_[0].rp_bucket_offsets[bp.bp_start_bucket] - globals.cx1.rp_[0].rp_bucket_offsets[globals.cx1.lv2_start_bucket_]);
 
-    s1_extract_subtstr_(bp.bp_start_bucket, bp.bp_end_bucket, globals, substrings_p, read_info_p, globals.cx1.lv2_num_items_);
+    s1_extract_subtstr_<kWords>(bp.bp_start_bucket, bp.bp_end_bucket, globals, substrings_p, read_info_p, globals.cx1.lv2_num_items_);
     return NULL;
 }
 
@@ -627,6 +631,7 @@ void s1_lv2_sort(read2sdbg_global_t &globals) {
 #endif
 }
 
+template <int kWords>
 void s1_lv2_pre_output_partition(read2sdbg_global_t &globals) {
     // swap double buffers
     globals.lv2_num_items_db = globals.cx1.lv2_num_items_;
@@ -634,6 +639,7 @@ void s1_lv2_pre_output_partition(read2sdbg_global_t &globals) {
     std::swap(globals.permutation_db, globals.permutation);
     std::swap(globals.lv2_read_info_db, globals.lv2_read_info);
 
+    KMinusOneMerMask<kWords> k_minus1_mer_mask(globals.kmer_k);
     int64_t last_end_index = 0;
     int64_t items_per_thread = globals.lv2_num_items_db / globals.num_output_threads;
 
@@ -650,7 +656,7 @@ void s1_lv2_pre_output_partition(read2sdbg_global_t &globals) {
                 uint32_t *prev_item = globals.lv2_substrings_db + globals.permutation_db[this_end_index - 1];
                 uint32_t *item = globals.lv2_substrings_db + globals.permutation_db[this_end_index];
 
-                if (IsDiffKMinusOneMer(prev_item, item, globals.lv2_num_items_db, globals.kmer_k)) {
+                if (IsDiffKMinusOneMer(prev_item, item, globals.lv2_num_items_db, k_minus1_mer_mask)) {
                     break;
                 }
 
@@ -668,12 +674,41 @@ void s1_lv2_pre_output_partition(read2sdbg_global_t &globals) {
     globals.cx1.op_[globals.num_output_threads - 1].op_end_index = globals.lv2_num_items_db;
 }
 
+// appends a full mercy candidate buffer to its file, creating the file on first use
+void s1_spill_mercy_cand_(int fid, std::vector<uint64_t> &buffer, read2sdbg_global_t &globals) {
+    pthread_mutex_lock(&globals.mercy_file_lock);
+
+    if (globals.mercy_files[fid] == NULL) {
+        globals.mercy_files[fid] = OpenFileAndCheck(FormatString("%s.mercy_cand.%d", globals.output_prefix.c_str(), fid), "wb+");
+    }
+
+    fwrite(&buffer[0], sizeof(uint64_t), buffer.size(), globals.mercy_files[fid]);
+    pthread_mutex_unlock(&globals.mercy_file_lock);
+    buffer.clear();
+}
+
+inline void s1_save_mercy_cand_(int tid, int64_t read_id, int64_t packed_mercy_cand, read2sdbg_global_t &globals) {
+    if (!globals.need_mercy) {
+        return;
+    }
+
+    int fid = read_id & (globals.num_mercy_files - 1);
+    std::vector<uint64_t> &buffer = globals.mercy_cand[tid * globals.num_mercy_files + fid];
+    buffer.push_back(packed_mercy_cand);
+
+    if ((int64_t)buffer.size() >= globals.max_mercy_cand_per_buffer) {
+        s1_spill_mercy_cand_(fid, buffer, globals);
+    }
+}
+
+template <int kWords>
 void s1_lv2_output_(int from, int to, int tid, read2sdbg_global_t &globals, uint32_t *substr, uint32_t *permutation, int64_t *readinfo_ptr, int num_items) {
     int end_idx;
     int count_prev_head[5][5];
     int count_tail_next[5][5];
     int count_head_tail[(1 << 2 * kBWTCharNumBits) - 1];
     int64_t *thread_edge_counting = globals.thread_edge_counting + tid * (kMaxMulti_t + 1);
+    KMinusOneMerMask<kWords> k_minus1_mer_mask(globals.kmer_k);
 
     for (int i = from; i < to; i = end_idx) {
         end_idx = i + 1;
@@ -684,7 +719,7 @@ void s1_lv2_output_(int from, int to, int tid, read2sdbg_global_t &globals, uint
 
         {
             uint8_t prev_and_next = ExtractPrevNext(permutation[i], readinfo_ptr);
-            uint8_t head_and_tail = ExtractHeadTail(substr + permutation[i], num_items, globals.words_per_substring);
+            uint8_t head_and_tail = ExtractHeadTail<kWords>(substr + permutation[i], num_items);
             count_prev_head[prev_and_next >> 3][head_and_tail >> 3]++;
             count_tail_next[head_and_tail & 7][prev_and_next & 7]++;
             count_head_tail[head_and_tail]++;
@@ -694,12 +729,12 @@ void s1_lv2_output_(int from, int to, int tid, read2sdbg_global_t &globals, uint
             if (IsDiffKMinusOneMer(first_item,
                                    substr + permutation[end_idx],
                                    num_items,
-                                   globals.kmer_k)) {
+                                   k_minus1_mer_mask)) {
                 break;
             }
 
             uint8_t prev_and_next = ExtractPrevNext(permutation[end_idx], readinfo_ptr);
-            uint8_t head_and_tail = ExtractHeadTail(substr + permutation[end_idx], num_items, globals.words_per_substring);
+            uint8_t head_and_tail = ExtractHeadTail<kWords>(substr + permutation[end_idx], num_items);
             count_prev_head[prev_and_next >> 3][head_and_tail >> 3]++;
             count_tail_next[head_and_tail & 7][prev_and_next & 7]++;
             count_head_tail[head_and_tail]++;
@@ -737,7 +772,7 @@ void s1_lv2_output_(int from, int to, int tid, read2sdbg_global_t &globals, uint
         }
 
         while (i < end_idx) {
-            uint8_t head_and_tail = ExtractHeadTail(substr + permutation[i], num_items, globals.words_per_substring);
+            uint8_t head_and_tail = ExtractHeadTail<kWords>(substr + permutation[i], num_items);
             uint8_t head = head_and_tail >> 3;
             uint8_t tail = head_and_tail & 7;
 
@@ -749,26 +784,27 @@ void s1_lv2_output_(int from, int to, int tid, read2sdbg_global_t &globals, uint
                 for (int j = 0; j < count_head_tail[head_and_tail]; ++j, ++i) {
                     int64_t read_info = readinfo_ptr[permutation[i]] >> 6;
                     int strand = read_info & 1;
-                    int64_t read_id = globals.package.get_id(read_info >> 1);
-                    int offset = (read_info >> 1) - globals.package.get_start_index(read_id) - 1;
+                    uint64_t start_index, end_index;
+                    int64_t read_id = globals.package.get_id(read_info >> 1, start_index, end_index);
+                    int offset = (read_info >> 1) - start_index - 1;
                     int l_offset = strand == 0 ? offset : offset + 1;
                     int r_offset = strand == 0 ? offset + 1 : offset;
 
                     if (read_id >= globals.num_short_reads) { continue; } // then we don't need to judge whether it's solid
 
                     // mark this is a solid edge
-                    globals.is_solid.set(globals.num_k1_per_read * read_id + offset);
+                    globals.is_solid.set(start_index + offset);
 
                     if (!(has_in & (1 << head))) {
                         // no in
-                        int64_t packed_mercy_cand = ((globals.package.get_start_index(read_id) + l_offset) << 2) | (1 + strand);
-                        fwrite(&packed_mercy_cand, sizeof(packed_mercy_cand), 1, globals.mercy_files[read_id & (globals.num_mercy_files - 1)]);
+                        int64_t packed_mercy_cand = ((start_index + l_offset) << 2) | (1 + strand);
+                        s1_save_mercy_cand_(tid, read_id, packed_mercy_cand, globals);
                     }
 
                     if (!(has_out & (1 << tail))) {
                         // no out
-                        int64_t packed_mercy_cand = ((globals.package.get_start_index(read_id) + r_offset) << 2) | (2 - strand);
-                        fwrite(&packed_mercy_cand, sizeof(packed_mercy_cand), 1, globals.mercy_files[read_id & (globals.num_mercy_files - 1)]);
+                        int64_t packed_mercy_cand = ((start_index + r_offset) << 2) | (2 - strand);
+                        s1_save_mercy_cand_(tid, read_id, packed_mercy_cand, globals);
                     }
                 }
             }
@@ -777,8 +813,9 @@ void s1_lv2_output_(int from, int to, int tid, read2sdbg_global_t &globals, uint
                 for (int j = 0; j < count_head_tail[head_and_tail]; ++j, ++i) {
                     int64_t read_info = readinfo_ptr[permutation[i]] >> 6;
                     int strand = read_info & 1;
-                    int64_t read_id = globals.package.get_id(read_info >> 1);
-                    int offset = (read_info >> 1) - globals.package.get_start_index(read_id) - 1;
+                    uint64_t start_index, end_index;
+                    int64_t read_id = globals.package.get_id(read_info >> 1, start_index, end_index);
+                    int offset = (read_info >> 1) - start_index - 1;
                     int l_offset = strand == 0 ? offset : offset + 1;
                     int r_offset = strand == 0 ? offset + 1 : offset;
                     
@@ -787,40 +824,40 @@ void s1_lv2_output_(int from, int to, int tid, read2sdbg_global_t &globals, uint
                     if (l_has_out & (1 << head)) {
                         if (has_in & (1 << head)) {
                             // has both in & out
-                            int64_t packed_mercy_cand = ((globals.package.get_start_index(read_id) + l_offset) << 2) | 0;
-                            fwrite(&packed_mercy_cand, sizeof(packed_mercy_cand), 1, globals.mercy_files[read_id & (globals.num_mercy_files - 1)]);
+                            int64_t packed_mercy_cand = ((start_index + l_offset) << 2) | 0;
+                            s1_save_mercy_cand_(tid, read_id, packed_mercy_cand, globals);
                         }
                         else {
                             // has out but no in
-                            int64_t packed_mercy_cand = ((globals.package.get_start_index(read_id) + l_offset) << 2) | (1 + strand);
-                            fwrite(&packed_mercy_cand, sizeof(packed_mercy_cand), 1, globals.mercy_files[read_id & (globals.num_mercy_files - 1)]);
+                            int64_t packed_mercy_cand = ((start_index + l_offset) << 2) | (1 + strand);
+                            s1_save_mercy_cand_(tid, read_id, packed_mercy_cand, globals);
                         }
                     }
                     else {
                         if (has_in & (1 << head)) {
                             // has in but no out
-                            int64_t packed_mercy_cand = ((globals.package.get_start_index(read_id) + l_offset) << 2) | (2 - strand);
-                            fwrite(&packed_mercy_cand, sizeof(packed_mercy_cand), 1, globals.mercy_files[read_id & (globals.num_mercy_files - 1)]);
+                            int64_t packed_mercy_cand = ((start_index + l_offset) << 2) | (2 - strand);
+                            s1_save_mercy_cand_(tid, read_id, packed_mercy_cand, globals);
                         }
                     }
 
                     if (r_has_in & (1 << tail)) {
                         if (has_out & (1 << tail)) {
                             // has both in & out
-                            int64_t packed_mercy_cand = ((globals.package.get_start_index(read_id) + r_offset) << 2) | 0;
-                            fwrite(&packed_mercy_cand, sizeof(packed_mercy_cand), 1, globals.mercy_files[read_id & (globals.num_mercy_files - 1)]);
+                            int64_t packed_mercy_cand = ((start_index + r_offset) << 2) | 0;
+                            s1_save_mercy_cand_(tid, read_id, packed_mercy_cand, globals);
                         }
                         else {
                             // has in but no out
-                            int64_t packed_mercy_cand = ((globals.package.get_start_index(read_id) + r_offset) << 2) | (2 - strand);
-                            fwrite(&packed_mercy_cand, sizeof(packed_mercy_cand), 1, globals.mercy_files[read_id & (globals.num_mercy_files - 1)]);
+                            int64_t packed_mercy_cand = ((start_index + r_offset) << 2) | (2 - strand);
+                            s1_save_mercy_cand_(tid, read_id, packed_mercy_cand, globals);
                         }
                     }
                     else {
                         if (has_out & (1 << tail)) {
                             // has out but no in
-                            int64_t packed_mercy_cand = ((globals.package.get_start_index(read_id) + r_offset) << 2) | (1 + strand);
-                            fwrite(&packed_mercy_cand, sizeof(packed_mercy_cand), 1, globals.mercy_files[read_id & (globals.num_mercy_files - 1)]);
+                            int64_t packed_mercy_cand = ((start_index + r_offset) << 2) | (1 + strand);
+                            s1_save_mercy_cand_(tid, read_id, packed_mercy_cand, globals);
                         }
                     }
                 }
@@ -829,6 +866,7 @@ void s1_lv2_output_(int from, int to, int tid, read2sdbg_global_t &globals, uint
     }
 }
 
+template <int kWords>
 void *s1_lv2_output(void *_op) {
     xtimer_t local_timer;
 
@@ -843,7 +881,7 @@ void *s1_lv2_output(void *_op) {
     int64_t op_end_index = op->op_end_index;
     int thread_id = op->op_id;
 
-    s1_lv2_output_(op_start_index, op_end_index, thread_id, globals, globals.lv2_substrings_db, globals.permutation_db, globals.lv2_read_info_db, globals.lv2_num_items_db);
+    s1_lv2_output_<kWords>(op_start_index, op_end_index, thread_id, globals, globals.lv2_substrings_db, globals.permutation_db, globals.lv2_read_info_db, globals.lv2_num_items_db);
 
     if (cx1_t::kCX1Verbose >= 4) {
         local_timer.stop();
@@ -859,49 +897,75 @@ void s1_lv2_post_output(read2sdbg_global_t &globals) {
 struct kt_sort_t {
     read2sdbg_global_t *globals;
     std::vector<int64_t> thread_offset;
+    std::vector<int> group_start; // the group of each task
 };
 
+template <int kWords>
 void kt_sort(void *_g, long i, int tid) {
     kt_sort_t *kg = (kt_sort_t *)_g;
-    int b = kg->globals->cx1.lv1_start_bucket_ + i;
+    int first = kg->group_start[i];
+    int64_t max_size = kg->globals->cx1.group_max_bucket_size(first);
 
-    if (kg->globals->cx1.bucket_sizes_[b] == 0) {
+    if (max_size == 0) {
         return;
     }
 
     if (tid + 1 < kg->globals->num_cpu_threads) {
-        kg->thread_offset[tid + 1] = kg->thread_offset[tid] + kg->globals->cx1.bucket_sizes_[b];
+        kg->thread_offset[tid + 1] = kg->thread_offset[tid] + max_size;
     }
 
     size_t offset = kg->globals->cx1.lv1_num_items_ * sizeof(int32_t) +
                     kg->thread_offset[tid] * kg->globals->cx1.bytes_per_sorting_item_ +
                     tid * sizeof(uint64_t) * 65536;
 
-    uint32_t *substr_ptr = (uint32_t *) ((char *)kg->globals->lv1_items + offset);
-    uint64_t *bucket = (uint64_t *)(substr_ptr + kg->globals->cx1.bucket_sizes_[b] * kg->globals->words_per_substring);
-    uint32_t *permutation_ptr = (uint32_t *)(bucket + 65536);
-    uint32_t *cpu_sort_space_ptr = permutation_ptr + kg->globals->cx1.bucket_sizes_[b];
-    int64_t *readinfo_ptr = (int64_t *) (cpu_sort_space_ptr + kg->globals->cx1.bucket_sizes_[b]);
+    for (int b = first; b < kg->globals->cx1.group_end_[first]; ++b) {
+        int64_t size = kg->globals->cx1.bucket_sizes_[b];
 
-    s1_extract_subtstr_(b, b + 1, *(kg->globals), substr_ptr, readinfo_ptr, kg->globals->cx1.bucket_sizes_[b]);
-    lv2_cpu_radix_sort_st(substr_ptr, permutation_ptr, cpu_sort_space_ptr, bucket, kg->globals->words_per_substring, kg->globals->cx1.bucket_sizes_[b]);
-    s1_lv2_output_(0, kg->globals->cx1.bucket_sizes_[b], tid, *(kg->globals), substr_ptr, permutation_ptr, readinfo_ptr, kg->globals->cx1.bucket_sizes_[b]);
+        if (size == 0) {
+            continue;
+        }
+
+        uint32_t *substr_ptr = (uint32_t *) ((char *)kg->globals->lv1_items + offset);
+        uint64_t *bucket = (uint64_t *)(substr_ptr + size * kWords);
+        uint32_t *permutation_ptr = (uint32_t *)(bucket + 65536);
+        uint32_t *cpu_sort_space_ptr = permutation_ptr + size;
+        int64_t *readinfo_ptr = (int64_t *) (cpu_sort_space_ptr + size);
+
+        s1_extract_subtstr_<kWords>(b, b + 1, *(kg->globals), substr_ptr, readinfo_ptr, size);
+        lv2_cpu_radix_sort_st(substr_ptr, permutation_ptr, cpu_sort_space_ptr, bucket, kWords, size);
+        s1_lv2_output_<kWords>(0, size, tid, *(kg->globals), substr_ptr, permutation_ptr, readinfo_ptr, size);
+    }
 }
 
+template <int kWords>
 void s1_lv1_direct_sort_and_count(read2sdbg_global_t &globals) {
     kt_sort_t kg;
     kg.globals = &globals;
     kg.thread_offset.clear();
     int64_t acc_size = 0;
 
-    for (int i = 0, b = globals.cx1.lv1_start_bucket_; i < globals.num_cpu_threads && b < globals.cx1.lv1_end_bucket_; ++i, ++b) {
-        kg.thread_offset.push_back(acc_size);
-        acc_size += globals.cx1.bucket_sizes_[b];
+    for (int b = globals.cx1.lv1_start_bucket_; b < globals.cx1.lv1_end_bucket_; b = globals.cx1.group_end_[b]) {
+        if ((int)kg.group_start.size() < globals.num_cpu_threads) {
+            kg.thread_offset.push_back(acc_size);
+            acc_size += globals.cx1.group_max_bucket_size(b);
+        }
+
+        kg.group_start.push_back(b);
     }
 
-    kt_dfor(globals.num_cpu_threads, kt_sort, &kg, globals.cx1.lv1_end_bucket_ - globals.cx1.lv1_start_bucket_);
+    globals.cx1.thread_pool_.ForEach(kg.group_start.size(), kt_sort<kWords>, &kg);
 }
 
+template <int kWords>
+struct Lv2Kernels {
+    static void Set(read2sdbg_global_t &globals) {
+        globals.cx1.lv1_sort_and_proc = s1_lv1_direct_sort_and_count<kWords>;
+        globals.cx1.lv2_extract_substr_func_ = s1_lv2_extract_substr<kWords>;
+        globals.cx1.lv2_pre_output_partition_func_ = s1_lv2_pre_output_partition<kWords>;
+        globals.cx1.lv2_output_func_ = s1_lv2_output<kWords>;
+    }
+};
+
 void s1_post_proc(read2sdbg_global_t &globals) {
     for (int t = 0; t < globals.num_output_threads; ++t) {
         for (int i = 1; i <= kMaxMulti_t; ++i) {
@@ -932,6 +996,8 @@ void s1_post_proc(read2sdbg_global_t &globals) {
     // --- cleaning ---
     pthread_mutex_destroy(&globals.lv1_items_scanning_lock);
     free(globals.lv1_items);
+    free(globals.edge_counting);
+    free(globals.thread_edge_counting);
 
 #ifdef USE_GPU
     free(globals.lv2_substrings);
@@ -940,13 +1006,13 @@ void s1_post_proc(read2sdbg_global_t &globals) {
     free(globals.permutation_db);
     free(globals.lv2_read_info);
     free(globals.lv2_read_info_db);
-    free(globals.edge_counting);
-    free(globals.thread_edge_counting);
     free_gpu_buffers(globals.gpu_key_buffer1, globals.gpu_key_buffer2, globals.gpu_value_buffer1, globals.gpu_value_buffer2);
 #endif
 
-    for (int i = 0; i < globals.num_mercy_files; ++i) {
-        fclose(globals.mercy_files[i]);
+    // spilled mercy files stay open for s2_read_mercy_prepare to read back
+    if (cx1_t::kCX1Verbose >= 3 && globals.need_mercy) {
+        int num_spilled = globals.num_mercy_files - std::count(globals.mercy_files.begin(), globals.mercy_files.end(), (FILE *)NULL);
+        xlog("Number of spilled mercy candidate files: %d\n", num_spilled);
     }
 }
 
@@ -33,8 +33,6 @@
 
 #include "lv2_cpu_sort.h"
 
-extern void kt_dfor(int n_threads, void (*func)(void *, long, int), void *data, long n);
-
 namespace cx1_read2sdbg {
 
 namespace s2 {
@@ -44,34 +42,12 @@ typedef CX1<read2sdbg_global_t, kNumBuckets>::readpartition_data_t readpartition
 typedef CX1<read2sdbg_global_t, kNumBuckets>::bucketpartition_data_t bucketpartition_data_t;
 typedef CX1<read2sdbg_global_t, kNumBuckets>::outputpartition_data_t outputpartition_data_t;
 
+template <int kWords> struct Lv2Kernels; // lv1 sorting and lv2 callbacks for kWords words per substring
+
 // helper functions
-inline int64_t EncodeOffset(int64_t read_id, int offset, int strand, SequencePackage &p, int edge_type) {
+inline int64_t EncodeOffset(int64_t start_index, int offset, int strand, int edge_type) {
     // edge_type: 0 left $; 1 solid; 2 right $
-    return ((p.get_start_index(read_id) + offset) << 3) | (edge_type << 1) | strand;
-}
-
-// helper: see whether two lv2 items have the same (k-1)-mer
-inline bool IsDiffKMinusOneMer(uint32_t *item1, uint32_t *item2, int64_t spacing, int kmer_k) {
-    // mask extra bits
-    int chars_in_last_word = (kmer_k - 1) % kCharsPerEdgeWord;
-    int num_full_words = (kmer_k - 1) / kCharsPerEdgeWord;
-
-    if (chars_in_last_word > 0) {
-        uint32_t w1 = item1[num_full_words * spacing];
-        uint32_t w2 = item2[num_full_words * spacing];
-
-        if ((w1 >> (kCharsPerEdgeWord - chars_in_last_word) * kBitsPerEdgeChar) != (w2 >> (kCharsPerEdgeWord - chars_in_last_word) * kBitsPerEdgeChar)) {
-            return true;
-        }
-    }
-
-    for (int i = num_full_words - 1; i >= 0; --i) {
-        if (item1[i * spacing] != item2[i * spacing]) {
-            return true;
-        }
-    }
-
-    return false;
+    return ((start_index + offset) << 3) | (edge_type << 1) | strand;
 }
 
 // helper
@@ -80,8 +56,9 @@ inline int ExtractFirstChar(uint32_t *item) {
 }
 
 // bS'a
-inline int Extract_a(uint32_t *item, int num_words, int64_t spacing, int kmer_k) {
-    int non_dollar = (item[(num_words - 1) * spacing] >> kBWTCharNumBits) & 1;
+template <int kWords>
+inline int Extract_a(uint32_t *item, int64_t spacing, int kmer_k) {
+    int non_dollar = (item[(kWords - 1) * spacing] >> kBWTCharNumBits) & 1;
 
     if (non_dollar) {
         int which_word = (kmer_k - 1) / kCharsPerEdgeWord;
@@ -93,14 +70,15 @@ inline int Extract_a(uint32_t *item, int num_words, int64_t spacing, int kmer_k)
     }
 }
 
-inline int Extract_b(uint32_t *item, int num_words, int64_t spacing) {
-    return item[(num_words - 1) * spacing] & ((1 << kBWTCharNumBits) - 1);
+template <int kWords>
+inline int Extract_b(uint32_t *item, int64_t spacing) {
+    return item[(kWords - 1) * spacing] & ((1 << kBWTCharNumBits) - 1);
 }
 
 
 // cx1 core functions
 int64_t s2_encode_lv1_diff_base(int64_t read_id, read2sdbg_global_t &globals) {
-    return EncodeOffset(read_id, 0, 0, globals.package, 0);
+    return EncodeOffset(globals.package.get_start_index(read_id), 0, 0, 0);
 }
 
 void s2_read_mercy_prepare(read2sdbg_global_t &globals) {
@@ -120,18 +98,31 @@ void s2_read_mercy_prepare(read2sdbg_global_t &globals) {
     read_marker.reset(globals.num_short_reads);
 
     for (int fid = 0; fid < globals.num_mercy_files; ++fid) {
-        FILE *fp = OpenFileAndCheck(FormatString("%s.mercy_cand.%d", globals.output_prefix.c_str(), fid), "rb");
+        // gather the candidates of this file from every thread's buffer, then from the spilled part if any
         mercy_cand.clear();
 
-        int num_read = 0;
-        uint64_t buf[4096];
+        for (size_t b = fid; b < globals.mercy_cand.size(); b += globals.num_mercy_files) {
+            mercy_cand.insert(mercy_cand.end(), globals.mercy_cand[b].begin(), globals.mercy_cand[b].end());
+            std::vector<uint64_t>().swap(globals.mercy_cand[b]);
+        }
+
+        FILE *fp = globals.mercy_files[fid];
+
+        if (fp != NULL) {
+            rewind(fp);
+            int num_read = 0;
+            uint64_t buf[4096];
 
-        while ((num_read = fread(buf, sizeof(uint64_t), 4096, fp)) > 0) {
-            mercy_cand.insert(mercy_cand.end(), buf, buf + num_read);
+            while ((num_read = fread(buf, sizeof(uint64_t), 4096, fp)) > 0) {
+                mercy_cand.insert(mercy_cand.end(), buf, buf + num_read);
+            }
+
+            fclose(fp);
+            remove(FormatString("%s.mercy_cand.%d", globals.output_prefix.c_str(), fid));
         }
 
         if (cx1_t::kCX1Verbose >= 4) {
-            xlog("Mercy file: %s, %lu\n", FormatString("%s.mercy_cand.%d", globals.output_prefix.c_str(), fid), mercy_cand.size());
+            xlog("Mercy candidates %d: %lu%s\n", fid, mercy_cand.size(), fp != NULL ? " (partly spilled)" : "");
         }
 
         omp_set_num_threads(globals.num_cpu_threads);
@@ -152,10 +143,15 @@ void s2_read_mercy_prepare(read2sdbg_global_t &globals) {
             }
 
             uint64_t this_end = std::min(start_idx[tid] + avg, (uint64_t)mercy_cand.size());
-            uint64_t read_id = globals.package.get_id(mercy_cand[this_end] >> 2);
 
-            while (this_end < mercy_cand.size() && globals.package.get_id(mercy_cand[this_end] >> 2) == read_id) {
-                ++this_end;
+            // the candidates of a read go to one thread: extend to the end of the read of the last one
+            if (this_end > start_idx[tid] && this_end < mercy_cand.size()) {
+                uint64_t start_index, end_index;
+                globals.package.get_id(mercy_cand[this_end - 1] >> 2, start_index, end_index);
+
+                while (this_end < mercy_cand.size() && (mercy_cand[this_end] >> 2) < end_index) {
+                    ++this_end;
+                }
             }
 
             end_idx[tid] = this_end;
@@ -172,7 +168,8 @@ void s2_read_mercy_prepare(read2sdbg_global_t &globals) {
 
             // go read by read
             while (i != end_idx[tid]) {
-                uint64_t read_id = globals.package.get_id(mercy_cand[i] >> 2);
+                uint64_t start_index, end_index;
+                uint64_t read_id = globals.package.get_id(mercy_cand[i] >> 2, start_index, end_index);
                 // if (read_id >= globals.num_short_reads) {
                 //     fprintf(stderr, "%llu\n", read_id);
                 // }
@@ -185,8 +182,9 @@ void s2_read_mercy_prepare(read2sdbg_global_t &globals) {
                 std::fill(no_out.begin(), no_out.end(), false);
                 std::fill(has_solid_kmer.begin(), has_solid_kmer.end(), false);
 
-                while (i != end_idx[tid] && globals.package.get_id(mercy_cand[i] >> 2) == read_id) {
-                    int offset = (mercy_cand[i] >> 2) - globals.package.get_start_index(read_id);
+                // candidates are sorted, so those of this read are exactly the ones before its end
+                while (i != end_idx[tid] && (mercy_cand[i] >> 2) < end_index) {
+                    int offset = (mercy_cand[i] >> 2) - start_index;
                     if ((mercy_cand[i] & 3) == 2) {
                         no_out[offset] = true;
                         first_0_out = std::min(first_0_out, offset);
@@ -204,11 +202,11 @@ void s2_read_mercy_prepare(read2sdbg_global_t &globals) {
                     continue;
                 }
 
-                int read_length = globals.package.length(read_id);
+                int read_length = end_index - start_index;
                 int last_no_out = -1;
 
                 for (int i = 0; i + globals.kmer_k < read_length; ++i) {
-                    if (globals.is_solid.get(read_id * globals.num_k1_per_read + i)) {
+                    if (globals.is_solid.get(start_index + i)) {
                         has_solid_kmer[i] = has_solid_kmer[i + 1] = true;
                     }
                 }
@@ -216,7 +214,7 @@ void s2_read_mercy_prepare(read2sdbg_global_t &globals) {
                 for (int i = 0; i + globals.kmer_k <= read_length; ++i) {
                     if (no_in[i] && last_no_out != -1) {
                         for (int j = last_no_out; j < i; ++j) {
-                            globals.is_solid.set(read_id * globals.num_k1_per_read + j);
+                            globals.is_solid.set(start_index + j);
                         }
 
                         num_mercy += i - last_no_out;
@@ -234,9 +232,10 @@ void s2_read_mercy_prepare(read2sdbg_global_t &globals) {
             }
         }
 
-        fclose(fp);
     }
 
+    pthread_mutex_destroy(&globals.mercy_file_lock);
+
     if (cx1_t::kCX1Verbose >= 3) {
         timer.stop();
         xlog("Adding mercy Done. Time elapsed: %.4lf\n", timer.elapsed());
@@ -257,44 +256,46 @@ void *s2_lv0_calc_bucket_size(void *_data) {
     GenericKmer edge, rev_edge; // (k+1)-mer and its rc
 
     for (int64_t read_id = rp.rp_start_id; read_id < rp.rp_end_id; ++read_id) {
-        int read_length = globals.package.length(read_id);
+        uint64_t start_index, end_index;
+        globals.package.get_range(read_id, start_index, end_index);
+        int read_length = end_index - start_index;
 
         if (read_length < globals.kmer_k + 1) {
             continue;
         }
 
-        int64_t which_word = globals.package.get_start_index(read_id) / 16;
-        int64_t offset = globals.package.get_start_index(read_id) % 16;
-        uint32_t *read_p = &globals.package.packed_seq[which_word];
+        int64_t which_word = start_index / 16;
+        int64_t offset = start_index % 16;
+        const uint32_t *read_p = globals.package.get_word_ptr(which_word);
 
         edge.init(read_p, offset, globals.kmer_k + 1);
         rev_edge = edge;
         rev_edge.ReverseComplement(globals.kmer_k + 1);
 
         int last_char_offset = globals.kmer_k;
-        int64_t full_offset = globals.num_k1_per_read * read_id;
+        int64_t full_offset = start_index; // index of the solid bit
         bool is_solid = globals.kmer_freq_threshold == 1 || read_id >= globals.num_short_reads;
 
         while (true) {
             if (is_solid || globals.is_solid.get(full_offset)) {
                 bool is_palindrome = rev_edge.cmp(edge, globals.kmer_k + 1) == 0;
-                bucket_sizes[(edge.data_[0] << 2) >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar]++;
+                bucket_sizes[BucketOf(globals, edge.data_[0] << 2)]++;
 
                 if (!is_palindrome)
-                    bucket_sizes[(rev_edge.data_[0] << 2) >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar]++;
+                    bucket_sizes[BucketOf(globals, rev_edge.data_[0] << 2)]++;
 
                 if (last_char_offset == globals.kmer_k || !(is_solid || globals.is_solid.get(full_offset - 1))) {
-                    bucket_sizes[edge.data_[0] >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar]++;
+                    bucket_sizes[BucketOf(globals, edge.data_[0])]++;
 
                     if (!is_palindrome)
-                        bucket_sizes[(rev_edge.data_[0] << 4) >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar]++;
+                        bucket_sizes[BucketOf(globals, rev_edge.data_[0] << 4)]++;
                 }
 
                 if (last_char_offset == read_length - 1 || !(is_solid || globals.is_solid.get(full_offset + 1))) {
-                    bucket_sizes[(edge.data_[0] << 4) >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar]++;
+                    bucket_sizes[BucketOf(globals, edge.data_[0] << 4)]++;
 
                     if (!is_palindrome)
-                        bucket_sizes[rev_edge.data_[0] >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar]++;
+                        bucket_sizes[BucketOf(globals, rev_edge.data_[0])]++;
                 }
             }
 
@@ -304,7 +305,7 @@ void *s2_lv0_calc_bucket_size(void *_data) {
                 break;
             }
             else {
-                int c = globals.package.get_base(read_id, last_char_offset);
+                int c = globals.package.get_base_at(start_index + last_char_offset);
                 edge.ShiftAppend(c, globals.kmer_k + 1);
                 rev_edge.ShiftPreappend(3 - c, globals.kmer_k + 1);
             }
@@ -335,6 +336,8 @@ void s2_init_global_and_set_cx1(read2sdbg_global_t &globals) {
         xlog("%d words per substring, words per dummy node ($v): %d\n", globals.words_per_substring, globals.words_per_dummy_node);
     }
 
+    SetLv2Kernels<Lv2Kernels>(globals);
+
     // --- calculate lv2 memory ---
 #ifdef USE_GPU
     int64_t lv2_mem = globals.gpu_mem - 1073741824; // should reserver ~1G for GPU sorting
@@ -351,9 +354,9 @@ void s2_init_global_and_set_cx1(read2sdbg_global_t &globals) {
     // --- memory stuff ---
     int64_t mem_remained = globals.host_mem
                            - globals.mem_packed_reads
-                           - kNumBuckets * sizeof(int64_t) * (globals.num_cpu_threads * 3 + 1);
+                           - kNumBuckets * sizeof(int64_t) * (globals.cx1.num_read_partitions_ * 2 + globals.num_cpu_threads + 1);
 
-    int64_t min_lv1_items = globals.tot_bucket_size / (kMaxLv1ScanTime - 0.5);
+    int64_t min_lv1_items = globals.tot_bucket_size / (MaxLv1ScanTime(globals) - 0.5);
     int64_t min_lv2_items = std::max(globals.max_bucket_size, kMinLv2BatchSize);
 
     if (globals.mem_flag == 1) {
@@ -367,7 +370,7 @@ void s2_init_global_and_set_cx1(read2sdbg_global_t &globals) {
     }
     else if (globals.mem_flag == 0) {
         // min memory
-        globals.cx1.max_lv1_items_ = std::max(globals.cx1.max_lv2_items_, int64_t(globals.tot_bucket_size / (kMaxLv1ScanTime - 0.5)));
+        globals.cx1.max_lv1_items_ = std::max(globals.cx1.max_lv2_items_, min_lv1_items);
         int64_t mem_needed = globals.cx1.max_lv1_items_ * cx1_t::kLv1BytePerItem + globals.cx1.max_lv2_items_ * lv2_bytes_per_item;
 
         if (mem_needed > mem_remained) {
@@ -409,8 +412,8 @@ void s2_init_global_and_set_cx1(read2sdbg_global_t &globals) {
     int64_t mem_remained = globals.host_mem
                            - globals.mem_packed_reads
                            - globals.num_cpu_threads * 65536 * sizeof(uint64_t) // radix sort buckets
-                           - kNumBuckets * sizeof(int64_t) * (globals.num_cpu_threads * 3 + 1);
-    int64_t min_lv1_items = globals.tot_bucket_size / (kMaxLv1ScanTime - 0.5);
+                           - kNumBuckets * sizeof(int64_t) * (globals.cx1.num_read_partitions_ * 2 + globals.num_cpu_threads + 1);
+    int64_t min_lv1_items = globals.tot_bucket_size / (MaxLv1ScanTime(globals) - 0.5);
 
     if (globals.mem_flag == 1) {
         // auto set memory
@@ -424,9 +427,9 @@ void s2_init_global_and_set_cx1(read2sdbg_global_t &globals) {
 
     }
     else if (globals.mem_flag == 0) {
-        // min memory
-        globals.cx1.max_lv1_items_ = int64_t(globals.tot_bucket_size / (kMaxLv1ScanTime - 0.5));
-        int64_t mem_needed = globals.cx1.max_lv1_items_ * cx1_t::kLv1BytePerItem;
+        // min memory: lv1 items for the most iterations allowed, sorting items for the largest bucket only
+        globals.cx1.max_lv1_items_ = std::max(min_lv1_items, globals.max_bucket_size);
+        int64_t mem_needed = globals.cx1.max_lv1_items_ * cx1_t::kLv1BytePerItem + globals.max_bucket_size * lv2_bytes_per_item;
 
         if (mem_needed > mem_remained) {
             globals.cx1.adjust_mem_just_go(mem_remained, lv2_bytes_per_item, min_lv1_items, globals.max_bucket_size,
@@ -469,7 +472,10 @@ void s2_init_global_and_set_cx1(read2sdbg_global_t &globals) {
     globals.sdbg_writer.set_kmer_size(globals.kmer_k);
     globals.sdbg_writer.set_num_buckets(kNumBuckets);
     globals.sdbg_writer.set_file_prefix(globals.output_prefix);
+    globals.sdbg_writer.set_direct_io(globals.direct_io);
+    globals.sdbg_writer.set_compress_level(globals.compress_sdbg ? kSdbgCompressLevel : 0);
     globals.sdbg_writer.init_files();
+    globals.lv2_last_output_thread = 0;
 }
 
 void *s2_lv1_fill_offset(void *_data) {
@@ -487,45 +493,51 @@ void *s2_lv1_fill_offset(void *_data) {
     int key;
 
     for (int64_t read_id = rp.rp_start_id; read_id < rp.rp_end_id; ++read_id) {
-        int read_length = globals.package.length(read_id);
+        uint64_t start_index, end_index;
+        globals.package.get_range(read_id, start_index, end_index);
+        int read_length = end_index - start_index;
 
         if (read_length < globals.kmer_k + 1) {
             continue;
         }
 
-        int64_t which_word = globals.package.get_start_index(read_id) / 16;
-        int64_t offset = globals.package.get_start_index(read_id) % 16;
-        uint32_t *read_p = &globals.package.packed_seq[which_word];
+        int64_t which_word = start_index / 16;
+        int64_t offset = start_index % 16;
+        const uint32_t *read_p = globals.package.get_word_ptr(which_word);
 
         edge.init(read_p, offset, globals.kmer_k + 1);
         rev_edge = edge;
         rev_edge.ReverseComplement(globals.kmer_k + 1);
 
         // ===== this is a macro to save some copy&paste ================
-#define CHECK_AND_SAVE_OFFSET(offset, strand, edge_type)                                                                \
-    do {                                                                                                                \
-        if (globals.cx1.cur_lv1_buckets_[key]) {                                                                        \
-            int key_ = globals.cx1.bucket_rank_[key];                                                                   \
-            int64_t full_offset = EncodeOffset(read_id, offset, strand, globals.package, edge_type);                    \
-            int64_t differential = full_offset - prev_full_offsets[key_];                                               \
-            if (differential > cx1_t::kDifferentialLimit) {                                                             \
-                pthread_mutex_lock(&globals.lv1_items_scanning_lock);                                                   \
-                globals.lv1_items[rp.rp_bucket_offsets[key_]++] = -globals.cx1.lv1_items_special_.size() - 1;           \
-                globals.cx1.lv1_items_special_.push_back(full_offset);                                                  \
-                pthread_mutex_unlock(&globals.lv1_items_scanning_lock);                                                 \
-            } else {                                                                                                    \
-                assert ((int) differential >= 0);                                                                       \
-                globals.lv1_items[rp.rp_bucket_offsets[key_]++] = (int) differential;                                   \
-            }                                                                                                           \
-            prev_full_offsets[key_] = full_offset;                                                                      \
-        }                                                                                                               \
+#define CHECK_AND_SAVE_OFFSET(offset, strand, edge_type)                                                          \
+    do {                                                                                                          \
+        if (globals.cx1.cur_lv1_buckets_[key]) {                                                                  \
+            int key_ = globals.cx1.bucket_rank_[key];                                                             \
+            int64_t full_offset = EncodeOffset(start_index, offset, strand, edge_type);                           \
+            if (globals.cx1.lv1_spilling_) {                                                                      \
+                globals.cx1.lv1_spill_item_(rp.rp_id, key_, full_offset);                                         \
+            } else {                                                                                              \
+                int64_t differential = full_offset - prev_full_offsets[key_];                                     \
+                if (differential > cx1_t::kDifferentialLimit) {                                                   \
+                    pthread_mutex_lock(&globals.lv1_items_scanning_lock);                                         \
+                    globals.lv1_items[rp.rp_bucket_offsets[key_]++] = -globals.cx1.lv1_items_special_.size() - 1; \
+                    globals.cx1.lv1_items_special_.push_back(full_offset);                                        \
+                    pthread_mutex_unlock(&globals.lv1_items_scanning_lock);                                       \
+                } else {                                                                                          \
+                    assert ((int) differential >= 0);                                                             \
+                    globals.lv1_items[rp.rp_bucket_offsets[key_]++] = (int) differential;                         \
+                }                                                                                                 \
+            }                                                                                                     \
+            prev_full_offsets[key_] = full_offset;                                                                \
+        }                                                                                                         \
     } while (0)
         // ^^^^^ why is the macro surrounded by a do-while? please ask Google
         // =========== end macro ==========================
 
         // shift the key char by char
         int last_char_offset = globals.kmer_k;
-        int64_t full_offset = globals.num_k1_per_read * read_id;
+        int64_t full_offset = start_index; // index of the solid bit
         bool is_solid = globals.kmer_freq_threshold == 1 || read_id >= globals.num_short_reads;
 
         while (true) {
@@ -534,31 +546,31 @@ void *s2_lv1_fill_offset(void *_data) {
 
                 // left $
                 if (last_char_offset == globals.kmer_k || !(is_solid || globals.is_solid.get(full_offset - 1))) {
-                    key = edge.data_[0] >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar;
+                    key = BucketOf(globals, edge.data_[0]);
                     CHECK_AND_SAVE_OFFSET(last_char_offset - globals.kmer_k, 0, 0);
 
                     if (!is_palindrome) {
-                        key = (rev_edge.data_[0] << 4) >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar;
+                        key = BucketOf(globals, rev_edge.data_[0] << 4);
                         CHECK_AND_SAVE_OFFSET(last_char_offset - globals.kmer_k, 1, 0);
                     }
                 }
 
                 // solid
-                key = (edge.data_[0] << 2) >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar;
+                key = BucketOf(globals, edge.data_[0] << 2);
                 CHECK_AND_SAVE_OFFSET(last_char_offset - globals.kmer_k, 0, 1);
 
                 if (!is_palindrome) {
-                    key = (rev_edge.data_[0] << 2) >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar;
+                    key = BucketOf(globals, rev_edge.data_[0] << 2);
                     CHECK_AND_SAVE_OFFSET(last_char_offset - globals.kmer_k, 1, 1);
                 }
 
                 // right $
                 if (last_char_offset == read_length - 1 || !(is_solid || globals.is_solid.get(full_offset + 1))) {
-                    key = (edge.data_[0] << 4) >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar;
+                    key = BucketOf(globals, edge.data_[0] << 4);
                     CHECK_AND_SAVE_OFFSET(last_char_offset - globals.kmer_k, 0, 2);
 
                     if (!is_palindrome) {
-                        key = rev_edge.data_[0] >> (kCharsPerEdgeWord - kBucketPrefixLength) * kBitsPerEdgeChar;
+                        key = BucketOf(globals, rev_edge.data_[0]);
                         CHECK_AND_SAVE_OFFSET(last_char_offset - globals.kmer_k, 1, 2);
                     }
                 }
@@ -570,7 +582,7 @@ void *s2_lv1_fill_offset(void *_data) {
                 break;
             }
             else {
-                int c = globals.package.get_base(read_id, last_char_offset);
+                int c = globals.package.get_base_at(start_index + last_char_offset);
                 edge.ShiftAppend(c, globals.kmer_k + 1);
                 rev_edge.ShiftPreappend(3 - c, globals.kmer_k + 1);
             }
@@ -583,11 +595,12 @@ void *s2_lv1_fill_offset(void *_data) {
     return NULL;
 }
 
+template <int kWords>
 void s2_lv2_extract_substr_(int bp_from, int bp_to, read2sdbg_global_t &globals, uint32_t *substr, int num_items) {
     int *lv1_p = globals.lv1_items + globals.cx1.rp_[0].rp_bucket_offsets[bp_from];
 
     for (int b = bp_from; b < bp_to; ++b) {
-        for (int t = 0; t < globals.num_cpu_threads; ++t) {
+        for (int t = 0; t < globals.cx1.num_read_partitions_; ++t) {
             int64_t full_offset = globals.cx1.rp_[t].rp_lv1_differential_base;
             int num = globals.cx1.rp_[t].rp_bucket_sizes[b];
 
@@ -599,15 +612,16 @@ void s2_lv2_extract_substr_(int bp_from, int bp_to, read2sdbg_global_t &globals,
                     full_offset = globals.cx1.lv1_items_special_[-1 - * (lv1_p++)];
                 }
 
-                int64_t read_id = globals.package.get_id(full_offset >> 3);
-                int offset = (full_offset >> 3) - globals.package.get_start_index(read_id);
+                uint64_t start_index, end_index;
+                globals.package.get_id(full_offset >> 3, start_index, end_index);
+                int offset = (full_offset >> 3) - start_index;
                 int strand = full_offset & 1;
                 int edge_type = (full_offset >> 1) & 3;
-                int read_length = globals.package.length(read_id);
+                int read_length = end_index - start_index;
 
-                int64_t which_word = globals.package.get_start_index(read_id) / 16;
-                int start_offset = globals.package.get_start_index(read_id) % 16;
-                uint32_t *read_p = &globals.package.packed_seq[which_word];
+                int64_t which_word = start_index / 16;
+                int start_offset = start_index % 16;
+                const uint32_t *read_p = globals.package.get_word_ptr(which_word);
                 int words_this_read = DivCeiling(start_offset + read_length, 16);
 
                 if (strand == 0) {
@@ -619,12 +633,12 @@ void s2_lv2_extract_substr_(int bp_from, int bp_to, read2sdbg_global_t &globals,
                         break;
 
                     case 1:
-                        prev = globals.package.get_base(read_id, offset);
+                        prev = globals.package.get_base_at(start_index + offset);
                         offset++;
                         break;
 
                     case 2:
-                        prev = globals.package.get_base(read_id, offset + 1);
+                        prev = globals.package.get_base_at(start_index + offset + 1);
                         offset += 2;
                         num_chars_to_copy--;
                         break;
@@ -634,9 +648,9 @@ void s2_lv2_extract_substr_(int bp_from, int bp_to, read2sdbg_global_t &globals,
                     }
 
                     CopySubstring(substr, read_p, offset + start_offset, num_chars_to_copy,
-                                  num_items, words_this_read, globals.words_per_substring);
+                                  num_items, words_this_read, kWords);
 
-                    uint32_t *last_word = substr + int64_t(globals.words_per_substring - 1) * num_items;
+                    uint32_t *last_word = substr + int64_t(kWords - 1) * num_items;
                     *last_word |= int(num_chars_to_copy == globals.kmer_k) << kBWTCharNumBits;
                     *last_word |= prev;
                 }
@@ -647,11 +661,11 @@ void s2_lv2_extract_substr_(int bp_from, int bp_to, read2sdbg_global_t &globals,
                     switch (edge_type) {
                     case 0:
                         num_chars_to_copy--;
-                        prev = 3 - globals.package.get_base(read_id, offset + globals.kmer_k - 1);
+                        prev = 3 - globals.package.get_base_at(start_index + offset + globals.kmer_k - 1);
                         break;
 
                     case 1:
-                        prev = 3 - globals.package.get_base(read_id, offset + globals.kmer_k);
+                        prev = 3 - globals.package.get_base_at(start_index + offset + globals.kmer_k);
                         break;
 
                     case 2:
@@ -663,9 +677,9 @@ void s2_lv2_extract_substr_(int bp_from, int bp_to, read2sdbg_global_t &globals,
                     }
 
                     CopySubstringRC(substr, read_p, offset + start_offset, num_chars_to_copy,
-                                    num_items, words_this_read, globals.words_per_substring);
+                                    num_items, words_this_read, kWords);
 
-                    uint32_t *last_word = substr + int64_t(globals.words_per_substring - 1) * num_items;
+                    uint32_t *last_word = substr + int64_t(kWords - 1) * num_items;
                     *last_word |= int(num_chars_to_copy == globals.kmer_k) << kBWTCharNumBits;
                     *last_word |= prev;
                 }
@@ -676,12 +690,13 @@ void s2_lv2_extract_substr_(int bp_from, int bp_to, read2sdbg_global_t &globals,
     }
 }
 
+template <int kWords>
 void *s2_lv2_extract_substr(void *_data) {
     bucketpartition_data_t &bp = *((bucketpartition_data_t *) _data);
     read2sdbg_global_t &globals = *(bp.globals);
     uint32_t *substr = globals.lv2_substrings +
                        (globals.cx1.rp_[0].rp_bucket_offsets[bp.bp_start_bucket] - globals.cx1.rp_[0].rp_bucket_offsets[globals.cx1.lv2_start_bucket_]);
-    s2_lv2_extract_substr_(bp.bp_start_bucket, bp.bp_end_bucket, globals, substr, globals.cx1.lv2_num_items_);
+    s2_lv2_extract_substr_<kWords>(bp.bp_start_bucket, bp.bp_end_bucket, globals, substr, globals.cx1.lv2_num_items_);
     return NULL;
 }
 
@@ -711,40 +726,43 @@ void s2_lv2_pre_output_partition(read2sdbg_global_t &globals) {
     std::swap(globals.lv2_substrings_db, globals.lv2_substrings);
     std::swap(globals.permutation_db, globals.permutation);
 
-    // distribute threads
+    // distribute threads; the SdBG is written in prefix buckets, each by one thread, so with adaptive buckets
+    // threads only split between prefixes, and a prefix continued from the last batch goes to the thread writing it
     int64_t items_per_thread = globals.lv2_num_items_db / globals.num_output_threads;
-    int64_t acc = 0, t = 0;
-    globals.cx1.op_[t].op_start_index = 0;
+    std::vector<int64_t> range_start(1, 0);
+    int64_t acc = 0;
 
     for (int b = globals.cx1.lv2_start_bucket_; b < globals.cx1.lv2_end_bucket_; ++b) {
-        if (globals.cx1.bucket_sizes_[b] + acc > (t + 1) * items_per_thread) {
-            globals.cx1.op_[t].op_end_index = acc;
-            ++t;
-
-            globals.cx1.op_[t].op_start_index = acc;
-
-            if (t == globals.num_output_threads - 1) {
-                break;
-            }
+        if ((int)range_start.size() < globals.num_output_threads &&
+                globals.cx1.bucket_sizes_[b] + acc > (int64_t)range_start.size() * items_per_thread && globals.cx1.is_prefix_start(b)) {
+            range_start.push_back(acc);
         }
 
         acc += globals.cx1.bucket_sizes_[b];
     }
 
-    globals.cx1.op_[t].op_end_index = globals.lv2_num_items_db;
+    range_start.resize(globals.num_output_threads, globals.lv2_num_items_db);
+    int first_thread = globals.cx1.is_prefix_start(globals.cx1.lv2_start_bucket_) ? 0 : globals.lv2_last_output_thread;
+
+    for (int r = 0; r < globals.num_output_threads; ++r) {
+        int t = (first_thread + r) % globals.num_output_threads;
+        globals.cx1.op_[t].op_start_index = range_start[r];
+        globals.cx1.op_[t].op_end_index = r + 1 < globals.num_output_threads ? range_start[r + 1] : globals.lv2_num_items_db;
 
-    for (++t; t < globals.num_output_threads; ++t) {
-        globals.cx1.op_[t].op_end_index = globals.lv2_num_items_db;
-        globals.cx1.op_[t].op_start_index = globals.lv2_num_items_db;
+        if (globals.cx1.op_[t].op_end_index > globals.cx1.op_[t].op_start_index) {
+            globals.lv2_last_output_thread = t;
+        }
     }
 }
 
+template <int kWords>
 void output_(int64_t from, int64_t to, read2sdbg_global_t &globals, uint32_t *substr, uint32_t *permutation, int tid, int num_items) {
     int start_idx, end_idx;
     int has_solid_a = 0; // has solid (k+1)-mer aSb
     int has_solid_b = 0; // has solid aSb
     int last_a[4], outputed_b;
     uint32_t tip_label[32];
+    KMinusOneMerMask<kWords> k_minus1_mer_mask(globals.kmer_k);
 
     for (start_idx = from; start_idx < to; start_idx = end_idx) {
         end_idx = start_idx + 1;
@@ -755,7 +773,7 @@ void output_(int64_t from, int64_t to, read2sdbg_global_t &globals, uint32_t *su
                     item,
                     substr + permutation[end_idx],
                     num_items,
-                    globals.kmer_k)) {
+                    k_minus1_mer_mask)) {
             ++end_idx;
         }
 
@@ -765,8 +783,8 @@ void output_(int64_t from, int64_t to, read2sdbg_global_t &globals, uint32_t *su
 
         for (int i = start_idx; i < end_idx; ++i) {
             uint32_t *cur_item = substr + permutation[i];
-            int a = Extract_a(cur_item, globals.words_per_substring, num_items, globals.kmer_k);
-            int b = Extract_b(cur_item, globals.words_per_substring, num_items);
+            int a = Extract_a<kWords>(cur_item, num_items, globals.kmer_k);
+            int b = Extract_b<kWords>(cur_item, num_items);
 
             if (a != kSentinelValue && b != kSentinelValue) {
                 has_solid_a |= 1 << a;
@@ -781,16 +799,16 @@ void output_(int64_t from, int64_t to, read2sdbg_global_t &globals, uint32_t *su
 
         for (int i = start_idx, j; i < end_idx; i = j) {
             uint32_t *cur_item = substr + permutation[i];
-            int a = Extract_a(cur_item, globals.words_per_substring, num_items, globals.kmer_k);
-            int b = Extract_b(cur_item, globals.words_per_substring, num_items);
+            int a = Extract_a<kWords>(cur_item, num_items, globals.kmer_k);
+            int b = Extract_b<kWords>(cur_item, num_items);
 
             j = i + 1;
 
             while (j < end_idx) {
                 uint32_t *next_item = substr + permutation[j];
 
-                if (Extract_a(next_item, globals.words_per_substring, num_items, globals.kmer_k) != a ||
-                        Extract_b(next_item, globals.words_per_substring, num_items) != b) {
+                if (Extract_a<kWords>(next_item, num_items, globals.kmer_k) != a ||
+                        Extract_b<kWords>(next_item, num_items) != b) {
                     break;
                 }
                 else {
@@ -834,13 +852,14 @@ void output_(int64_t from, int64_t to, read2sdbg_global_t &globals, uint32_t *su
     }
 }
 
+template <int kWords>
 void *s2_lv2_output(void *_op) {
     outputpartition_data_t *op = (outputpartition_data_t *) _op;
     read2sdbg_global_t &globals = *(op->globals);
     int64_t op_start_index = op->op_start_index;
     int64_t op_end_index = op->op_end_index;
 
-    output_(op_start_index, op_end_index, globals, globals.lv2_substrings_db, globals.permutation_db, op->op_id, globals.lv2_num_items_db);
+    output_<kWords>(op_start_index, op_end_index, globals, globals.lv2_substrings_db, globals.permutation_db, op->op_id, globals.lv2_num_items_db);
 
     return NULL;
 }
@@ -854,48 +873,74 @@ struct kt_sort_t {
     int activated_threads;
     std::vector<int64_t> thread_offset;
     std::vector<int> tid_map;
+    std::vector<int> group_start; // the group of each task
     volatile int lock_;
 };
 
+template <int kWords>
 void kt_sort(void *_g, long i, int tid) {
     kt_sort_t *kg = (kt_sort_t *)_g;
-    int b = kg->globals->cx1.lv1_start_bucket_ + i;
+    int first = kg->group_start[i];
+    int64_t max_size = kg->globals->cx1.group_max_bucket_size(first);
 
-    if (kg->globals->cx1.bucket_sizes_[b] == 0) {
+    if (max_size == 0) {
         return;
     }
 
     if (tid + 1 < kg->globals->num_cpu_threads) {
-        kg->thread_offset[tid + 1] = kg->thread_offset[tid] + kg->globals->cx1.bucket_sizes_[b];
+        kg->thread_offset[tid + 1] = kg->thread_offset[tid] + max_size;
     }
 
     size_t offset = kg->globals->cx1.lv1_num_items_ * sizeof(int32_t) +
                     kg->thread_offset[tid] * kg->globals->cx1.bytes_per_sorting_item_ +
                     tid * sizeof(uint64_t) * 65536;
 
-    uint32_t *substr_ptr = (uint32_t *) ((char *)kg->globals->lv1_items + offset);
-    uint64_t *bucket = (uint64_t *)(substr_ptr + kg->globals->cx1.bucket_sizes_[b] * kg->globals->words_per_substring);
-    uint32_t *permutation_ptr = (uint32_t *)(bucket + 65536);
-    uint32_t *cpu_sort_space_ptr = permutation_ptr + kg->globals->cx1.bucket_sizes_[b];
+    // the buckets of a prefix go to the SdBG in order, by one thread
+    for (int b = first; b < kg->globals->cx1.group_end_[first]; ++b) {
+        int64_t size = kg->globals->cx1.bucket_sizes_[b];
 
-    s2_lv2_extract_substr_(b, b + 1, *(kg->globals), substr_ptr, kg->globals->cx1.bucket_sizes_[b]);
-    lv2_cpu_radix_sort_st(substr_ptr, permutation_ptr, cpu_sort_space_ptr, bucket, kg->globals->words_per_substring, kg->globals->cx1.bucket_sizes_[b]);
-    output_(0, kg->globals->cx1.bucket_sizes_[b], *(kg->globals), substr_ptr, permutation_ptr, tid, kg->globals->cx1.bucket_sizes_[b]);
+        if (size == 0) {
+            continue;
+        }
+
+        uint32_t *substr_ptr = (uint32_t *) ((char *)kg->globals->lv1_items + offset);
+        uint64_t *bucket = (uint64_t *)(substr_ptr + size * kWords);
+        uint32_t *permutation_ptr = (uint32_t *)(bucket + 65536);
+        uint32_t *cpu_sort_space_ptr = permutation_ptr + size;
+
+        s2_lv2_extract_substr_<kWords>(b, b + 1, *(kg->globals), substr_ptr, size);
+        lv2_cpu_radix_sort_st(substr_ptr, permutation_ptr, cpu_sort_space_ptr, bucket, kWords, size);
+        output_<kWords>(0, size, *(kg->globals), substr_ptr, permutation_ptr, tid, size);
+    }
 }
 
+template <int kWords>
 void s2_lv1_direct_sort_and_proc(read2sdbg_global_t &globals) {
     kt_sort_t kg;
     kg.globals = &globals;
     int64_t acc_size = 0;
 
-    for (int i = 0, b = globals.cx1.lv1_start_bucket_; i < globals.num_cpu_threads && b < globals.cx1.lv1_end_bucket_; ++i, ++b) {
-        kg.thread_offset.push_back(acc_size);
-        acc_size += globals.cx1.bucket_sizes_[b];
+    for (int b = globals.cx1.lv1_start_bucket_; b < globals.cx1.lv1_end_bucket_; b = globals.cx1.group_end_[b]) {
+        if ((int)kg.group_start.size() < globals.num_cpu_threads) {
+            kg.thread_offset.push_back(acc_size);
+            acc_size += globals.cx1.group_max_bucket_size(b);
+        }
+
+        kg.group_start.push_back(b);
     }
 
-    kt_dfor(globals.num_cpu_threads, kt_sort, &kg, globals.cx1.lv1_end_bucket_ - globals.cx1.lv1_start_bucket_);
+    globals.cx1.thread_pool_.ForEach(kg.group_start.size(), kt_sort<kWords>, &kg);
 }
 
+template <int kWords>
+struct Lv2Kernels {
+    static void Set(read2sdbg_global_t &globals) {
+        globals.cx1.lv1_sort_and_proc = s2_lv1_direct_sort_and_proc<kWords>;
+        globals.cx1.lv2_extract_substr_func_ = s2_lv2_extract_substr<kWords>;
+        globals.cx1.lv2_output_func_ = s2_lv2_output<kWords>;
+    }
+};
+
 void s2_post_proc(read2sdbg_global_t &globals) {
     if (cx1_t::kCX1Verbose >= 2) {
         xlog("Number of $ A C G T A- C- G- T-:\n");
@@ -916,6 +961,7 @@ void s2_post_proc(read2sdbg_global_t &globals) {
     }
 
     // --- clean ---
+    globals.sdbg_writer.destroy(); // closes the files, so that the next k can reuse the writer
     pthread_mutex_destroy(&globals.lv1_items_scanning_lock);
     free(globals.lv1_items);
 #ifdef USE_GPU
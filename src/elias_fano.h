@@ -0,0 +1,272 @@
+#ifndef ELIAS_FANO_H__
+#define ELIAS_FANO_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <assert.h>
+#include <vector>
+
+/**
+ * @brief Elias-Fano encoding of a non-decreasing sequence of uint64_t
+ * each value costs low_bits_ + 2 bits (plus 1 bit per 64 values for select samples),
+ * which is about 1.2 bytes per read for short reads.
+ * values can only be appended; a read-only view can be attached to serialized words (e.g. mmapped)
+ */
+class EliasFano {
+  public:
+    static const int kSelectSampleShift = 6; // sample the position of every 64-th one
+    static const int kDefaultLowBits = 7;    // 128bp reads, used when no size hint is given
+
+    EliasFano() {
+        clear();
+    }
+
+    void clear() {
+        low_.clear();
+        high_.clear();
+        samples_.clear();
+        low_bits_ = -1;
+        size_ = 0;
+        last_ = 0;
+        is_view_ = false;
+        sync_();
+    }
+
+    static int OptimalLowBits(uint64_t universe, uint64_t num_values) {
+        int low_bits = 0;
+
+        while (num_values > 0 && (num_values << (low_bits + 1)) <= universe && low_bits < 56) {
+            ++low_bits;
+        }
+
+        return low_bits;
+    }
+
+    void set_low_bits(int low_bits) {
+        assert(size_ == 0);
+        low_bits_ = low_bits;
+    }
+
+    int low_bits() const {
+        return low_bits_;
+    }
+
+    void reserve(size_t num_values) {
+        int low_bits = low_bits_ < 0 ? kDefaultLowBits : low_bits_;
+        low_.reserve(num_values * low_bits / 64 + 2);
+        high_.reserve(num_values * 2 / 64 + 2);
+        samples_.reserve((num_values >> kSelectSampleShift) + 2);
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    uint64_t back() const {
+        return last_;
+    }
+
+    size_t size_in_byte() const {
+        return sizeof(uint64_t) * (low_.capacity() + high_.capacity() + samples_.capacity());
+    }
+
+    void push_back(uint64_t value) {
+        assert(!is_view_);
+        assert(size_ == 0 || value >= last_);
+
+        if (low_bits_ < 0) {
+            low_bits_ = kDefaultLowBits;
+        }
+
+        if (low_bits_ > 0) {
+            uint64_t bit = size_ * low_bits_;
+            uint64_t low = value & ((1ULL << low_bits_) - 1);
+
+            while (low_.size() <= (bit + low_bits_) / 64) {
+                low_.push_back(0);
+            }
+
+            low_[bit / 64] |= low << (bit % 64);
+
+            if (bit % 64 + low_bits_ > 64) {
+                low_[bit / 64 + 1] |= low >> (64 - bit % 64);
+            }
+        }
+
+        uint64_t pos = (value >> low_bits_) + size_;
+
+        while (high_.size() <= pos / 64 + 1) {
+            high_.push_back(0);
+        }
+
+        high_[pos / 64] |= 1ULL << (pos % 64);
+
+        if ((size_ & ((1 << kSelectSampleShift) - 1)) == 0) {
+            samples_.push_back(pos);
+        }
+
+        ++size_;
+        last_ = value;
+        sync_();
+    }
+
+    uint64_t operator[](size_t i) const {
+        return ((Select_(i) - i) << low_bits_) | Low_(i);
+    }
+
+    /**
+     * @brief get the i-th and the (i+1)-th values with a single select
+     */
+    void get_pair(size_t i, uint64_t &first, uint64_t &second) const {
+        uint64_t pos = Select_(i);
+        first = ((pos - i) << low_bits_) | Low_(i);
+        pos = NextOne_(pos);
+        second = ((pos - i - 1) << low_bits_) | Low_(i + 1);
+    }
+
+    /**
+     * @brief find the largest i >= from such that value[i] <= value < value[i+1], walking forward from
+     * a single select; value[from] <= value < back() is required, so the walk is short when from is close.
+     * the walk stops at the last pair even if value is out of range, leaving the check to the caller
+     * @return i, with value[i] and value[i+1] in first and second
+     */
+    size_t Locate(size_t from, uint64_t value, uint64_t &first, uint64_t &second) const {
+        assert(value < last_ && from + 1 < size_);
+        uint64_t pos = Select_(from);
+        size_t i = from;
+        first = ((pos - i) << low_bits_) | Low_(i);
+        assert(first <= value);
+        pos = NextOne_(pos);
+        second = ((pos - i - 1) << low_bits_) | Low_(i + 1);
+
+        while (second <= value && i + 2 < size_) {
+            ++i;
+            first = second;
+            pos = NextOne_(pos);
+            second = ((pos - i - 1) << low_bits_) | Low_(i + 1);
+        }
+
+        return i;
+    }
+
+    /**
+     * @brief serialized layout: size, low_bits, last, #low words, #high words, #samples, then the three arrays
+     */
+    size_t serialized_words() const {
+        return 6 + low_.size() + high_.size() + samples_.size();
+    }
+
+    void Serialize(FILE *fp) const {
+        uint64_t meta[6] = {size_, (uint64_t)low_bits_, last_, low_.size(), high_.size(), samples_.size()};
+        fwrite(meta, sizeof(uint64_t), 6, fp);
+        fwrite(low_p_, sizeof(uint64_t), low_.size(), fp);
+        fwrite(high_p_, sizeof(uint64_t), high_.size(), fp);
+        fwrite(samples_p_, sizeof(uint64_t), samples_.size(), fp);
+    }
+
+    /**
+     * @brief attach a read-only view to serialized words; they must outlive this object
+     * @return number of words used, 0 if the words are not a valid serialization
+     */
+    size_t Attach(const uint64_t *words, size_t num_words) {
+        clear();
+
+        if (num_words < 6 || num_words < 6 + words[3] + words[4] + words[5] || words[1] > 56) {
+            return 0;
+        }
+
+        size_ = words[0];
+        low_bits_ = words[1];
+        last_ = words[2];
+        low_p_ = words + 6;
+        high_p_ = low_p_ + words[3];
+        samples_p_ = high_p_ + words[4];
+        is_view_ = true;
+        return 6 + words[3] + words[4] + words[5];
+    }
+
+  private:
+    uint64_t Low_(size_t i) const {
+        if (low_bits_ == 0) {
+            return 0;
+        }
+
+        uint64_t bit = i * low_bits_;
+        uint64_t low = low_p_[bit / 64] >> (bit % 64);
+
+        if (bit % 64 + low_bits_ > 64) {
+            low |= low_p_[bit / 64 + 1] << (64 - bit % 64);
+        }
+
+        return low & ((1ULL << low_bits_) - 1);
+    }
+
+    // position of the i-th one in high_
+    uint64_t Select_(size_t i) const {
+        uint64_t pos = samples_p_[i >> kSelectSampleShift];
+        int remain = i & ((1 << kSelectSampleShift) - 1);
+        size_t w = pos / 64;
+        uint64_t word = high_p_[w] & (~0ULL << (pos % 64));
+        int count;
+
+        while (remain >= (count = __builtin_popcountll(word))) {
+            remain -= count;
+            word = high_p_[++w];
+        }
+
+        return w * 64 + SelectInWord_(word, remain);
+    }
+
+    // position of the rank-th one in word, which has more than rank ones: the byte is found from the
+    // byte-wise prefix popcounts in parallel, so at most 7 ones are cleared instead of 63
+    static int SelectInWord_(uint64_t word, int rank) {
+        const uint64_t kOnesStep8 = 0x0101010101010101ULL;
+        const uint64_t kMsbsStep8 = 0x8080808080808080ULL;
+        uint64_t byte_sums = word - ((word >> 1) & 0x5555555555555555ULL);
+        byte_sums = (byte_sums & 0x3333333333333333ULL) + ((byte_sums >> 2) & 0x3333333333333333ULL);
+        byte_sums = ((byte_sums + (byte_sums >> 4)) & 0x0F0F0F0F0F0F0F0FULL) * kOnesStep8;
+        // bytes whose prefix count is <= rank precede the byte holding the one
+        int byte_shift = __builtin_popcountll(((rank * kOnesStep8 | kMsbsStep8) - byte_sums) & kMsbsStep8) * 8;
+        rank -= ((byte_sums << 8) >> byte_shift) & 0xFF;
+        word >>= byte_shift;
+
+        for (; rank > 0; --rank) {
+            word &= word - 1;
+        }
+
+        return byte_shift + __builtin_ctzll(word);
+    }
+
+    uint64_t NextOne_(uint64_t pos) const {
+        ++pos;
+        size_t w = pos / 64;
+        uint64_t word = high_p_[w] & (~0ULL << (pos % 64));
+
+        while (word == 0) {
+            word = high_p_[++w];
+        }
+
+        return w * 64 + __builtin_ctzll(word);
+    }
+
+    void sync_() {
+        if (!is_view_) {
+            low_p_ = low_.empty() ? NULL : &low_[0];
+            high_p_ = high_.empty() ? NULL : &high_[0];
+            samples_p_ = samples_.empty() ? NULL : &samples_[0];
+        }
+    }
+
+    std::vector<uint64_t> low_;
+    std::vector<uint64_t> high_;
+    std::vector<uint64_t> samples_;
+    const uint64_t *low_p_;
+    const uint64_t *high_p_;
+    const uint64_t *samples_p_;
+    int low_bits_;
+    uint64_t size_;
+    uint64_t last_;
+    bool is_view_;
+};
+
+#endif // ELIAS_FANO_H__
@@ -45,6 +45,8 @@ struct Seed {
 
 bool fexists(const char *filename);
 void ProcessSequenceMulti(const string &sequence, HashSetST<ProtKmer> &kmerSet, const int &kmer_size, vector<Seed> &candidates);
+void ProcessPackage(const SequencePackage &package, int64_t from, int64_t to, bool is_reverse,
+                    HashSetST<ProtKmer> &kmerSet, int kmer_size, vector<vector<Seed> > &seeds);
 
 int find_start(int argc, char **argv) {
     ProtKmer::setUp();
@@ -104,35 +106,29 @@ int find_start(int argc, char **argv) {
 
     SequenceManager seq_manager;
     SequencePackage package;
-    seq_manager.set_file_type(SequenceManager::kBinaryReads);
+    vector<vector<Seed> > seeds(num_threads);
+    SequenceImageHeader header;
 
-    seq_manager.set_file(argv[2]);
-    seq_manager.set_readlib_type(SequenceManager::kSingle); // PE info not used
-    seq_manager.set_package(&package);
+    if (SequencePackage::ReadImageHeader(argv[2], header) > 0) {
+        // versioned library: share the mapped pages with other stages instead of reading a private copy
+        if (!package.MapImage(argv[2])) {
+            xerr_and_exit("Failed to map read library %s\n", argv[2]);
+        }
 
-    vector<vector<Seed> > seeds(num_threads);
+        xlog("Processing %lld reads\n", (long long)package.size());
+        ProcessPackage(package, 0, package.size(), package.view_is_reverse(), kmerSet, kmer_size, seeds);
+        package.clear();
+    }
+    else {
+        seq_manager.set_file_type(SequenceManager::kBinaryReads);
+        seq_manager.set_file(argv[2]);
+        seq_manager.set_readlib_type(SequenceManager::kSingle); // PE info not used
+        seq_manager.set_package(&package);
 
-    while ((count = seq_manager.ReadShortReads(kMaxNumReads, kMaxNumBases, append, reverse)) > 0) {
-        xlog("Processing %d reads\n", count);
-    #pragma omp parallel for schedule(dynamic, 1)
-            for (int i = 0; i < count; i++) {
-                int len = package.length(i);
-                if (len >= kmer_size) {
-                    string s;
-                    s.resize(len);
-
-                    for (int j = 0; j < len; ++j) {
-                        s[j] = "ACGT"[package.get_base(i, j)];
-                    }
-                    ProcessSequenceMulti(s, kmerSet, kmer_size, seeds[omp_get_thread_num()]);
-
-                    for (int j = 0; j < len; ++j) {
-                        s[j] = "ACGT"[3 - package.get_base(i, len - 1 - j)];
-                    }
-
-                    ProcessSequenceMulti(s, kmerSet, kmer_size, seeds[omp_get_thread_num()]);
-                }
-            }
+        while ((count = seq_manager.ReadShortReads(kMaxNumReads, kMaxNumBases, append, reverse)) > 0) {
+            xlog("Processing %d reads\n", count);
+            ProcessPackage(package, 0, count, reverse, kmerSet, kmer_size, seeds);
+        }
     }
 
     if (argc > 5) {
@@ -144,25 +140,7 @@ int find_start(int argc, char **argv) {
 
         while ((count = seq_manager.ReadShortReads(kMaxNumReads, kMaxNumBases, append, reverse)) > 0) {
             xlog("Processing %d contigs\n", count);
-    #pragma omp parallel for schedule(dynamic, 1)
-            for (int i = 0; i < count; i++) {
-                int len = package.length(i);
-                if (len >= kmer_size) {
-                    string s;
-                    s.resize(len);
-
-                    for (int j = 0; j < len; ++j) {
-                        s[j] = "ACGT"[package.get_base(i, j)];
-                    }
-                    ProcessSequenceMulti(s, kmerSet, kmer_size, seeds[omp_get_thread_num()]);
-
-                    for (int j = 0; j < len; ++j) {
-                        s[j] = "ACGT"[3 - package.get_base(i, len - 1 - j)];
-                    }
-
-                    ProcessSequenceMulti(s, kmerSet, kmer_size, seeds[omp_get_thread_num()]);
-                }
-            }
+            ProcessPackage(package, 0, count, reverse, kmerSet, kmer_size, seeds);
         }
     }
 
@@ -192,6 +170,30 @@ int find_start(int argc, char **argv) {
     return 0;
 }
 
+// both strands of package[from, to) are scanned; reads stored reversed (is_reverse) are read backwards
+void ProcessPackage(const SequencePackage &package, int64_t from, int64_t to, bool is_reverse,
+                    HashSetST<ProtKmer> &kmerSet, int kmer_size, vector<vector<Seed> > &seeds) {
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int64_t i = from; i < to; i++) {
+        int len = package.length(i);
+        if (len >= kmer_size) {
+            string s;
+            s.resize(len);
+
+            for (int j = 0; j < len; ++j) {
+                s[j] = "ACGT"[package.get_base(i, is_reverse ? len - 1 - j : j)];
+            }
+            ProcessSequenceMulti(s, kmerSet, kmer_size, seeds[omp_get_thread_num()]);
+
+            for (int j = 0; j < len; ++j) {
+                s[j] = "ACGT"[3 - package.get_base(i, is_reverse ? j : len - 1 - j)];
+            }
+
+            ProcessSequenceMulti(s, kmerSet, kmer_size, seeds[omp_get_thread_num()]);
+        }
+    }
+}
+
 void ProcessSequenceMulti(const string &sequence, HashSetST<ProtKmer> &kmerSet, const int &kmer_size, vector<Seed> &candidates) {
     vector<ProtKmerGenerator> kmer_gens;
     seq::NTSequence nts = seq::NTSequence("", "", sequence);
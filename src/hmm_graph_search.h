@@ -29,10 +29,11 @@ class HMMGraphSearch {
     HashMapST<AStarNodePtr, AStarNodePtr> open_hash;
 
     PoolST<AStarNode> *pool_;
+    int64_t num_expanded_; // nodes taken from the open set and enumerated, over all searches
 
   public:
     HMMGraphSearch(const int &pruning) 
-        : heuristic_pruning(pruning), pool_(NULL) {}
+        : heuristic_pruning(pruning), pool_(NULL), num_expanded_(0) {}
     void constructPool() {
         assert(!pool_);
         pool_ = new PoolST<AStarNode>;
@@ -45,6 +46,10 @@ class HMMGraphSearch {
         }
     }
 
+    int64_t num_expanded() const {
+        return num_expanded_;
+    }
+
     static void setUp() {
         for (int i = 0; i < 3000; i++) {
             exit_probabilities[i] = log(2.0 / (i + 2)) * 2;
@@ -277,6 +282,7 @@ class HMMGraphSearch {
             }
 
             got_term_node = term_nodes.find(curr);
+            ++num_expanded_;
 
             if (got_term_node == term_nodes.end()) {
                 node_enumerator.enumerateNodes(temp_nodes_to_open, curr, forward, dbg);
@@ -18,72 +18,11 @@
 
 /* contact: Dinghua Li <dhli@cs.hku.hk> */
 
-#include <parallel/algorithm>
+#include <string.h>
 #include <algorithm>
 #include <assert.h>
 #include "definitions.h"
 
-inline void lv2_cpu_sort(uint32_t *lv2_substrings, uint32_t *permutation, uint64_t *cpu_sort_space, int words_per_substring, int64_t lv2_num_items) {
-    #pragma omp parallel for
-
-    for (uint32_t i = 0; i < lv2_num_items; ++i) {
-        permutation[i] = i;
-    }
-
-    for (int64_t iteration = words_per_substring - 1; iteration >= 0; --iteration) {
-        uint32_t *lv2_substr_p = lv2_substrings + lv2_num_items * iteration;
-        #pragma omp parallel for
-
-        for (uint32_t i = 0; i < lv2_num_items; ++i) {
-            cpu_sort_space[i] = uint64_t(*(lv2_substr_p + permutation[i])) << 32;
-            cpu_sort_space[i] |= i;
-        }
-
-        // pss::parallel_stable_sort(cpu_sort_space, cpu_sort_space + lv2_num_items, CompareHigh32Bits());
-        __gnu_parallel::sort(cpu_sort_space, cpu_sort_space + lv2_num_items);
-
-        #pragma omp parallel for
-
-        for (uint32_t i = 0; i < lv2_num_items; ++i) {
-            cpu_sort_space[i] &= 0xFFFFFFFFULL;
-            cpu_sort_space[i] |= uint64_t(permutation[cpu_sort_space[i]]) << 32;
-        }
-
-        #pragma omp parallel for
-
-        for (uint32_t i = 0; i < lv2_num_items; ++i) {
-            permutation[i] = cpu_sort_space[i] >> 32;
-        }
-    }
-}
-
-inline void lv2_cpu_sort_st(uint32_t *lv2_substrings, uint32_t *permutation, uint64_t *cpu_sort_space, int words_per_substring, int64_t lv2_num_items) {
-    for (uint32_t i = 0; i < lv2_num_items; ++i) {
-        permutation[i] = i;
-    }
-
-    for (int64_t iteration = words_per_substring - 1; iteration >= 0; --iteration) {
-        uint32_t *lv2_substr_p = lv2_substrings + lv2_num_items * iteration;
-
-        for (uint32_t i = 0; i < lv2_num_items; ++i) {
-            cpu_sort_space[i] = uint64_t(*(lv2_substr_p + permutation[i])) << 32;
-            cpu_sort_space[i] |= i;
-        }
-
-        // pss::parallel_stable_sort(cpu_sort_space, cpu_sort_space + lv2_num_items, CompareHigh32Bits());
-        std::sort(cpu_sort_space, cpu_sort_space + lv2_num_items);
-
-        for (uint32_t i = 0; i < lv2_num_items; ++i) {
-            cpu_sort_space[i] &= 0xFFFFFFFFULL;
-            cpu_sort_space[i] |= uint64_t(permutation[cpu_sort_space[i]]) << 32;
-        }
-
-        for (uint32_t i = 0; i < lv2_num_items; ++i) {
-            permutation[i] = cpu_sort_space[i] >> 32;
-        }
-    }
-}
-
 struct CmpSubStr {
     uint32_t *substr;
     int64_t num_items;
@@ -110,13 +49,19 @@ struct CmpSubStr {
     }
 };
 
-inline void sort_digit(uint32_t *arr, uint32_t *permutation, uint32_t *buf, uint64_t *buckets, int64_t num_items, int shift_bits) {
+// stable counting sort of permutation[0, num_items) into buf by a 16-bit digit of arr[]
+// returns false without touching buf if all items have the same digit
+inline bool sort_digit(uint32_t *arr, uint32_t *permutation, uint32_t *buf, uint64_t *buckets, int64_t num_items, int shift_bits) {
     memset(buckets, 0, sizeof(buckets[0]) * (1 << 16));
 
     for (int64_t i = 0; i < num_items; ++i) {
         buckets[(arr[permutation[i]] >> shift_bits) & 0xFFFF]++;
     }
 
+    if (buckets[(arr[permutation[0]] >> shift_bits) & 0xFFFF] == (uint64_t)num_items) {
+        return false;
+    }
+
     int64_t acc = 0;
 
     for (unsigned i = 0; i < (1 << 16); ++i) {
@@ -128,24 +73,153 @@ inline void sort_digit(uint32_t *arr, uint32_t *permutation, uint32_t *buf, uint
     for (int64_t i = 0; i < num_items; ++i) {
         buf[buckets[(arr[permutation[i]] >> shift_bits) & 0xFFFF]++] = permutation[i];
     }
+
+    return true;
 }
 
-inline void lv2_cpu_radix_sort_st(uint32_t *lv2_substrings, uint32_t *permutation, uint32_t *cpu_sort_space, uint64_t *buckets, int words_per_substring, int64_t lv2_num_items) {
-    for (uint32_t i = 0; i < lv2_num_items; ++i) {
-        permutation[i] = i;
+struct SortKey64 {
+    uint64_t key;
+    uint32_t idx;
+    bool operator<(const SortKey64 &rhs) const {
+        return key < rhs.key;
     }
+};
 
-    if (lv2_num_items < 65536 * 2) {
-        std::sort(permutation, permutation + lv2_num_items, CmpSubStr(lv2_substrings, lv2_num_items, words_per_substring));
+// LSD radix sort by bytes, skipping the bytes shared by all keys (e.g. the bucket prefix); the result ends up in keys
+inline void radix_sort_keys_(SortKey64 *keys, SortKey64 *buf, int64_t num_items) {
+    SortKey64 *result = keys;
+    uint32_t counts[8][256];
+    memset(counts, 0, sizeof(counts));
+
+    for (int64_t i = 0; i < num_items; ++i) {
+        uint64_t key = keys[i].key;
+
+        for (int b = 0; b < 8; ++b) {
+            counts[b][(key >> (b * 8)) & 0xFF]++;
+        }
+    }
+
+    for (int b = 0; b < 8; ++b) {
+        if (counts[b][(keys[0].key >> (b * 8)) & 0xFF] == (uint32_t)num_items) {
+            continue;
+        }
+
+        uint32_t acc = 0;
+
+        for (int i = 0; i < 256; ++i) {
+            uint32_t tmp = acc;
+            acc += counts[b][i];
+            counts[b][i] = tmp;
+        }
+
+        for (int64_t i = 0; i < num_items; ++i) {
+            buf[counts[b][(keys[i].key >> (b * 8)) & 0xFF]++] = keys[i];
+        }
+
+        std::swap(keys, buf);
+    }
+
+    if (keys != result) {
+        memcpy(result, keys, sizeof(SortKey64) * num_items);
+    }
+}
+
+/**
+ * @brief sort a small range on two words at a time, gathered into contiguous (key, index) pairs in the bucket space,
+ * so that the sort does not chase the permutation; ties on both words go on to the next two words
+ */
+inline void lv2_small_sort_(uint32_t *lv2_substrings, uint32_t *permutation, uint64_t *buckets, int words_per_substring,
+                            int64_t lv2_num_items, int word, int64_t num_items) {
+    static const int64_t kMinItemsForKeyRadix = 64;
+    uint32_t *lv2_substr_p = lv2_substrings + lv2_num_items * word;
+
+    // the keys and the radix buffer share the 2^16 words of bucket space
+    if (num_items * sizeof(SortKey64) * 2 > sizeof(uint64_t) * (1 << 16)) {
+        std::sort(permutation, permutation + num_items, CmpSubStr(lv2_substr_p, lv2_num_items, words_per_substring - word));
+        return;
+    }
+
+    SortKey64 *keys = (SortKey64 *)buckets;
+    uint32_t *next_p = word + 1 < words_per_substring ? lv2_substr_p + lv2_num_items : NULL;
+
+    for (int64_t i = 0; i < num_items; ++i) {
+        uint32_t idx = permutation[i];
+        keys[i].key = (uint64_t)lv2_substr_p[idx] << 32 | (next_p ? next_p[idx] : 0);
+        keys[i].idx = idx;
+    }
+
+    if (num_items < kMinItemsForKeyRadix) {
+        std::sort(keys, keys + num_items);
+    }
+    else {
+        radix_sort_keys_(keys, keys + num_items, num_items);
+    }
+
+    for (int64_t i = 0; i < num_items; ++i) {
+        permutation[i] = keys[i].idx;
+    }
+
+    if (word + 2 >= words_per_substring) {
+        return;
+    }
+
+    // the keys are overwritten by the recursion, so the runs of ties are found from the substrings again
+    for (int64_t i = 0, j; i < num_items; i = j) {
+        uint32_t first = lv2_substr_p[permutation[i]], second = next_p[permutation[i]];
+
+        for (j = i + 1; j < num_items && lv2_substr_p[permutation[j]] == first && next_p[permutation[j]] == second; ++j) {
+        }
+
+        if (j - i > 1) {
+            lv2_small_sort_(lv2_substrings, permutation + i, buckets, words_per_substring, lv2_num_items, word + 2, j - i);
+        }
+    }
+}
+
+/**
+ * @brief MSD by 32-bit words: radix sort a range by one word, then only the runs sharing that word go on to the next word.
+ * ranges too small to pay for counting passes over 2^16 buckets go to lv2_small_sort_
+ */
+inline void lv2_msd_sort_(uint32_t *lv2_substrings, uint32_t *permutation, uint32_t *cpu_sort_space, uint64_t *buckets, int words_per_substring,
+                          int64_t lv2_num_items, int word, int64_t num_items) {
+    static const int64_t kMinItemsForRadix = 65536 * 2;
+    uint32_t *lv2_substr_p = lv2_substrings + lv2_num_items * word;
+
+    if (num_items < kMinItemsForRadix) {
+        lv2_small_sort_(lv2_substrings, permutation, buckets, words_per_substring, lv2_num_items, word, num_items);
         return;
     }
 
-    for (int64_t iteration = words_per_substring - 1; iteration >= 0; --iteration) {
-        uint32_t *lv2_substr_p = lv2_substrings + lv2_num_items * iteration;
+    // low 16 bits then high 16 bits, the result ends up in permutation either way
+    if (sort_digit(lv2_substr_p, permutation, cpu_sort_space, buckets, num_items, 0)) {
+        if (!sort_digit(lv2_substr_p, cpu_sort_space, permutation, buckets, num_items, 16)) {
+            memcpy(permutation, cpu_sort_space, sizeof(uint32_t) * num_items);
+        }
+    }
+    else if (sort_digit(lv2_substr_p, permutation, cpu_sort_space, buckets, num_items, 16)) {
+        memcpy(permutation, cpu_sort_space, sizeof(uint32_t) * num_items);
+    }
 
-        // 1 pass low  16 bits
-        sort_digit(lv2_substr_p, permutation, cpu_sort_space, buckets, lv2_num_items, 0);
-        // 2 pass high 16 bits
-        sort_digit(lv2_substr_p, cpu_sort_space, permutation, buckets, lv2_num_items, 16);
+    if (word + 1 == words_per_substring) {
+        return;
     }
-}
\ No newline at end of file
+
+    for (int64_t i = 0, j; i < num_items; i = j) {
+        uint32_t key = lv2_substr_p[permutation[i]];
+
+        for (j = i + 1; j < num_items && lv2_substr_p[permutation[j]] == key; ++j) {
+        }
+
+        if (j - i > 1) {
+            lv2_msd_sort_(lv2_substrings, permutation + i, cpu_sort_space + i, buckets, words_per_substring, lv2_num_items, word + 1, j - i);
+        }
+    }
+}
+
+inline void lv2_cpu_radix_sort_st(uint32_t *lv2_substrings, uint32_t *permutation, uint32_t *cpu_sort_space, uint64_t *buckets, int words_per_substring, int64_t lv2_num_items) {
+    for (uint32_t i = 0; i < lv2_num_items; ++i) {
+        permutation[i] = i;
+    }
+
+    lv2_msd_sort_(lv2_substrings, permutation, cpu_sort_space, buckets, words_per_substring, lv2_num_items, 0, lv2_num_items);
+}
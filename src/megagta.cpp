@@ -7,8 +7,10 @@
 
 int build_lib(int argc, char **argv);
 int build_graph(int argc, char **argv);
+int merge_graph(int argc, char **argv);
 int read_stat(int argc, char **argv);
 int find_start(int argc, char **argv);
+int recruit(int argc, char **argv);
 int search(int argc, char **argv);
 int filter_by_len(int argc, char **argv);
 int translate(int argc, char **argv);
@@ -20,7 +22,9 @@ void show_help(const char *program_name) {
             "    sub-programs:\n"
             "       buildlib              build read library\n"
             "       buildgraph            build the SdBG\n"
+            "       mergegraph            merge two SdBGs of the same k\n"
             "       denovo                de novo assemble contigs from SDBG\n"
+            "       recruit               keep reads sharing k-mers with the reference genes\n"
             "       findstart             find starting kmers\n"
             "       search                A* search\n"
             "       dumpversion           dump MEGAHIT-GT version\n"
@@ -44,12 +48,20 @@ int main(int argc, char **argv) {
         AutoMaxRssRecorder recorder;
         return build_graph(argc - 1, argv + 1);
     }
+    else if (strcmp(argv[1], "mergegraph") == 0) {
+        AutoMaxRssRecorder recorder;
+        return merge_graph(argc - 1, argv + 1);
+    }
     else if (strcmp(argv[1], "readstat") == 0) {
         return read_stat(argc - 1, argv + 1);
     }
     else if (strcmp(argv[1], "filterbylen") == 0) {
         return filter_by_len(argc - 1, argv + 1);
     }
+    else if (strcmp(argv[1], "recruit") == 0) {
+        AutoMaxRssRecorder recorder;
+        return recruit(argc - 1, argv + 1);
+    }
     else if (strcmp(argv[1], "findstart") == 0) {
         AutoMaxRssRecorder recorder;
         return find_start(argc - 1 , argv + 1);
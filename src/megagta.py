@@ -55,8 +55,15 @@ Optional Arguments:
                                             the last k must be a multiple of 3) [30,36,45]
     -p/--prune-len           <int>          prune the search if the score does not improve after <int> steps [20]
     -l/--low-cov-penalty     <float>        penalty for coverage one edges (in [0,1]) [0.5]
+    --cov-weight             <float>        weight of the graded log-coverage score of codons, 0 to disable [0]
     --max-tip-len            <int>          max tip length [150]
     --no-mercy                              do not add mercy kmers
+    --one-pass-graphs                       build the SdBGs of all k in one run sharing the loaded reads; the contigs
+                                            of a smaller k are then not used to build the SdBG of the next k
+    --norm-cov               <int>          drop reads whose median k-mer coverage has reached <int> when building
+                                            the read library, 0 to keep all reads [0]
+    --recruit-rounds         <int>          only assemble reads sharing protein k-mers with the ref_aligned.faa of the genes,
+                                            plus <int> rounds of nucleotide k-mer expansion; -1 to use all reads [-1]
 
   Hardware options:
     -m/--memory              <float>        max memory in byte to be used in SdBG construction [0.9]
@@ -66,6 +73,14 @@ Optional Arguments:
     --use-gpu                               use GPU
     --gpu-mem                <float>        GPU memory in byte to be used. Default: auto detect to use up all free GPU memory [0]
     -t/--num-cpu-threads     <int>          number of CPU threads, at least 2. Default: auto detect to use all CPU threads [auto]
+    --spill-dir              <string>       build SdBGs in external memory mode, spilling sorting items to this directory
+                                            (preferably on local disk); the reads still need to fit in memory
+    --direct-io                             write SdBGs with direct I/O, bypassing the page cache
+    --adaptive-buckets                      split the sorting buckets of heavy k-mer prefixes, to build
+                                            skewed data in less memory
+    --compress-sdbg                         write SdBGs as zlib blocks per bucket, to save disk space
+    --numa                                  interleave the SdBG over the NUMA nodes for the search
+    --clean-search-graph                    search on the graph with tips and bubbles of the last k removed
 
   Output options:
     -o/--out-dir             <string>       output directory [./megagta_out]
@@ -93,6 +108,7 @@ class Options():
         self.max_tip_len = 150
         self.prune_len = 20
         self.low_cov_penalty = 0.5
+        self.cov_weight = 0
         self.k_list = [30,36,45]
         self.min_count = 1
         self.bin_dir = sys.path[0] + "/"
@@ -114,6 +130,15 @@ class Options():
         self.input_cmd = ""
         self.gene_info = {}
         self.gene_list = ""
+        self.recruit_rounds = -1
+        self.norm_cov = 0
+        self.spill_dir = ""
+        self.direct_io = False
+        self.adaptive_buckets = False
+        self.compress_sdbg = False
+        self.numa = False
+        self.clean_search_graph = False
+        self.one_pass_graphs = False
 
 opt = Options()
 cp = 0
@@ -158,6 +183,7 @@ def parse_opt(argv):
                     "max-tip-len=",
                     "--low-cov-penalty=",
                     "--prune-len=",
+                    "cov-weight=",
                     "use-gpu",
                     "num-cpu-threads=",
                     "gpu-mem=",
@@ -171,7 +197,16 @@ def parse_opt(argv):
                     "continue",
                     "version",
                     "verbose",
-                    "gene-list="])
+                    "gene-list=",
+                    "recruit-rounds=",
+                    "norm-cov=",
+                    "spill-dir=",
+                    "direct-io",
+                    "adaptive-buckets",
+                    "compress-sdbg",
+                    "numa",
+                    "clean-search-graph",
+                    "one-pass-graphs"])
     except getopt.error as msg:
         raise Usage(megagta_version_str + '\n' + str(msg))
     if len(opts) == 0:
@@ -232,6 +267,26 @@ def parse_opt(argv):
             opt.prune_len = int(value)
         elif option in ("--low-cov-penalty", "-l"):
             opt.low_cov_penalty = float(value)
+        elif option == "--cov-weight":
+            opt.cov_weight = float(value)
+        elif option == "--recruit-rounds":
+            opt.recruit_rounds = int(value)
+        elif option == "--norm-cov":
+            opt.norm_cov = int(value)
+        elif option == "--spill-dir":
+            opt.spill_dir = value
+        elif option == "--direct-io":
+            opt.direct_io = True
+        elif option == "--adaptive-buckets":
+            opt.adaptive_buckets = True
+        elif option == "--compress-sdbg":
+            opt.compress_sdbg = True
+        elif option == "--numa":
+            opt.numa = True
+        elif option == "--clean-search-graph":
+            opt.clean_search_graph = True
+        elif option == "--one-pass-graphs":
+            opt.one_pass_graphs = True
 
         else:
             raise Usage("Invalid option %s", option)
@@ -286,6 +341,10 @@ def check_opt():
         raise Usage("prune length should be >= 1")
     if opt.low_cov_penalty < 0 or opt.low_cov_penalty > 1:
         raise Usage("low coverage penalty should be between [0, 1]")
+    if opt.cov_weight < 0:
+        raise Usage("coverage weight should be >= 0")
+    if opt.spill_dir != "" and not os.path.isdir(opt.spill_dir):
+        raise Usage("Spill directory " + opt.spill_dir + " does not exist")
 
     # reads
     if len(opt.pe1) != len(opt.pe2):
@@ -369,6 +428,9 @@ def graph_prefix(kmer_k):
 def contig_file(kmer_k):
     return graph_prefix(kmer_k) + ".contigs.fa"
 
+def invalid_mask_file(kmer_k):
+    return graph_prefix(kmer_k) + ".invalid_mask"
+
 def delect_file_if_exist(file_name):
     if os.path.exists(file_name):
         os.remove(file_name)
@@ -440,6 +502,10 @@ def build_lib():
                          opt.lib,
                          opt.lib]
 
+        if opt.norm_cov > 0:
+            # the sketch takes a quarter of the memory budget, at most 4GB
+            build_lib_cmd += [str(opt.norm_cov), str(min(opt.host_mem // 4, 4 << 30))]
+
         fifos = list()
         pipes = list()
         try:
@@ -535,16 +601,21 @@ def build_lib():
 
     write_cp()
 
-def build_graph(k, assist_seq):
+def build_graph(ks, assist_seq):
     global cp
     phase1_out_threads = max(1, int(opt.num_cpu_threads / 3))
     if (not opt.continue_mode) or (cp > opt.last_cp):
-        count_opt = ["-k", str(k),
-                     "-m", str(opt.min_count),
+        if len(ks) == 1:
+            k_opt = ["-k", str(ks[0])]
+        else:
+            k_opt = ["--k_list", ",".join(map(str, ks))]
+
+        count_opt = k_opt + \
+                    ["-m", str(opt.min_count),
                      "--host_mem", str(opt.host_mem),
                      "--mem_flag", str(opt.mem_flag),
                      "--gpu_mem", str(opt.gpu_mem),
-                     "--output_prefix", graph_prefix(k),
+                     "--output_prefix", ",".join(map(graph_prefix, ks)),
                      "--num_cpu_threads", str(opt.num_cpu_threads),
                      "--num_output_threads", str(phase1_out_threads),
                      "--read_lib_file", opt.lib]
@@ -553,11 +624,23 @@ def build_graph(k, assist_seq):
         if not opt.no_mercy:
             cmd.append("--need_mercy")
 
+        if opt.spill_dir != "":
+            cmd += ["--spill_dir", opt.spill_dir]
+
+        if opt.direct_io:
+            cmd.append("--direct_io")
+
+        if opt.adaptive_buckets:
+            cmd.append("--adaptive_buckets")
+
+        if opt.compress_sdbg:
+            cmd.append("--compress_sdbg")
+
         if assist_seq != "":
             cmd += ["--assist_seq", assist_seq]
 
         try:
-            logging.info("--- [%s] Building sdbg for k = %d ---" % (datetime.now().strftime("%c"), k))
+            logging.info("--- [%s] Building sdbg for k = %s ---" % (datetime.now().strftime("%c"), ",".join(map(str, ks))))
 
             logging.debug("cmd: %s" % (" ").join(cmd))
             p = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
@@ -585,7 +668,7 @@ def build_graph(k, assist_seq):
 
     write_cp()
 
-def assemble(k):
+def assemble(k, mask_only = False):
     global cp
     if (not opt.continue_mode) or (cp > opt.last_cp):
         min_standalone = 400 # TODO HARDCODE
@@ -597,8 +680,12 @@ def assemble(k):
                         "--min_standalone", str(min_standalone),
                         "--max_tip_len", str(opt.max_tip_len)]
 
-        index_k = opt.k_list.index(k);
-        assembly_cmd += ["--min_contig", str(opt.k_list[index_k + 1] + 1)]
+        if mask_only:
+            # the last k only needs the cleaned graph for searching
+            assembly_cmd += ["--mask_only"]
+        else:
+            index_k = opt.k_list.index(k);
+            assembly_cmd += ["--min_contig", str(opt.k_list[index_k + 1] + 1)]
             
         try:
             logging.info("--- [%s] De novo assembling contigs from SdBG for k = %d ---" % (datetime.now().strftime("%c"), k))
@@ -637,6 +724,49 @@ def parse_gene_list():
             opt.gene_info[words[0]] = [words[1], words[2], words[3]]
     f.close()
 
+def recruit():
+    global cp
+    recruited_lib = opt.temp_dir + "recruited.lib"
+    if (not opt.continue_mode) or (cp > opt.last_cp):
+        recruit_cmd = [opt.bin_dir + "megagta", "recruit",
+                       "-g", opt.gene_list,
+                       "-r", opt.lib,
+                       "-o", recruited_lib,
+                       "--prot_k", str(opt.k_list[-1]),
+                       "--rounds", str(opt.recruit_rounds),
+                       "-t", str(opt.num_cpu_threads)]
+
+        try:
+            logging.info("--- [%s] Recruiting reads of the genes ---" % datetime.now().strftime("%c"))
+            logging.debug("cmd: %s" % (" ").join(recruit_cmd))
+
+            p = subprocess.Popen(recruit_cmd, stdout = subprocess.PIPE, stderr = subprocess.PIPE)
+
+            while True:
+                line = p.stderr.readline().rstrip()
+                if not line:
+                    break;
+                logging.debug(line)
+
+            ret_code = p.wait()
+
+            if ret_code != 0:
+                logging.error("Error occurs when recruiting reads, please refer to %s for detail" % log_file_name())
+                logging.error("[Exit code %d]" % ret_code)
+                exit(ret_code)
+
+        except OSError as o:
+            if o.errno == errno.ENOTDIR or o.errno == errno.ENOENT:
+                logging.error("Error: sub-program megagta not found, please recompile MEGAHIT-GT")
+            exit(1)
+        except KeyboardInterrupt:
+            p.terminate()
+            exit(1)
+
+    # later stages read the reduced library, also when continuing
+    opt.lib = recruited_lib
+    write_cp()
+
 def find_seed(k, gene):
     global cp
     if (not opt.continue_mode) or (cp > opt.last_cp):
@@ -680,7 +810,8 @@ def search_contigs(k):
     global cp
     if (not opt.continue_mode) or (cp > opt.last_cp):
         parameter = [graph_prefix(k), opt.gene_list, graph_prefix(k), graph_prefix(k),
-                     str(opt.prune_len), str(opt.low_cov_penalty), str(min(12, opt.num_cpu_threads))]
+                     str(opt.prune_len), str(opt.low_cov_penalty), str(min(12, opt.num_cpu_threads)),
+                     str(opt.cov_weight), invalid_mask_file(k) if opt.clean_search_graph else "", "1" if opt.numa else "0"]
         cmd = [opt.bin_dir + "megagta", "search"] + parameter
 
         try:
@@ -812,19 +943,28 @@ def main(argv = None):
         build_lib()
         parse_gene_list()
 
+        if opt.recruit_rounds >= 0:
+            recruit()
+
         for i in range(len(opt.k_list)):
             opt.k_list[i] -= 1
 
+        if opt.one_pass_graphs:
+            build_graph(opt.k_list, "")
+
         for i in range(len(opt.k_list)):
             k = opt.k_list[i]
-            assist_seq = ""
-            if i > 0:
-                assist_seq = contig_file(opt.k_list[i-1])
-            build_graph(k, assist_seq)
+            if not opt.one_pass_graphs:
+                assist_seq = ""
+                if i > 0:
+                    assist_seq = contig_file(opt.k_list[i-1])
+                build_graph([k], assist_seq)
 
             if i != (len(opt.k_list)) - 1:
                 assemble(k)
             else:
+                if opt.clean_search_graph:
+                    assemble(k, mask_only = True)
                 for gene_name in opt.gene_info:
                     find_seed(k, gene_name)
                 search_contigs(k)
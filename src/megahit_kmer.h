@@ -39,7 +39,7 @@ struct MegahitKmer {
         init(seq, offset, k);
     }
 
-    void init(word_t *seq, int offset, int k) {
+    void init(const word_t *seq, int offset, int k) {
         seq += offset / kCharsPerWord;
         offset %= kCharsPerWord;
         offset <<= 1;
@@ -0,0 +1,703 @@
+/*
+ *  MEGAHIT
+ *  Copyright (C) 2014 - 2015 The University of Hong Kong
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* contact: Dinghua Li <dhli@cs.hku.hk> */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "cx1_read2sdbg.h"
+#include "sdbg_multi_io.h"
+#include "utils.h"
+
+using namespace cx1_read2sdbg;
+
+namespace {
+
+inline bool GetBit(const std::vector<uint64_t> &bits, int64_t i) {
+    return (bits[i / 64] >> (i % 64)) & 1;
+}
+
+inline void SetBit(std::vector<uint64_t> &bits, int64_t i, bool value) {
+    bits[i / 64] = (bits[i / 64] & ~(1ULL << (i % 64))) | (uint64_t(value) << (i % 64));
+}
+
+// sets the bits in [from, to) to value
+inline void FillBits(std::vector<uint64_t> &bits, int64_t from, int64_t to, bool value) {
+    if (from >= to) {
+        return;
+    }
+
+    int64_t first = from / 64, last = (to - 1) / 64;
+    uint64_t head_mask = ~0ULL << (from % 64);
+    uint64_t tail_mask = ~0ULL >> (63 - (to - 1) % 64);
+    uint64_t fill = value ? ~0ULL : 0;
+
+    if (first == last) {
+        bits[first] = (bits[first] & ~(head_mask & tail_mask)) | (fill & head_mask & tail_mask);
+        return;
+    }
+
+    bits[first] = (bits[first] & ~head_mask) | (fill & head_mask);
+    bits[last] = (bits[last] & ~tail_mask) | (fill & tail_mask);
+    std::fill(bits.begin() + first + 1, bits.begin() + last, fill);
+}
+
+// the number of ones in [from, to)
+inline int64_t CountOnes(const std::vector<uint64_t> &bits, int64_t from, int64_t to) {
+    if (from >= to) {
+        return 0;
+    }
+
+    int64_t first = from / 64, last = (to - 1) / 64;
+    uint64_t head = bits[first] & (~0ULL << (from % 64));
+    uint64_t tail_mask = ~0ULL >> (63 - (to - 1) % 64);
+
+    if (first == last) {
+        return __builtin_popcountll(head & tail_mask);
+    }
+
+    int64_t ret = __builtin_popcountll(head) + __builtin_popcountll(bits[last] & tail_mask);
+
+    for (int64_t w = first + 1; w < last; ++w) {
+        ret += __builtin_popcountll(bits[w]);
+    }
+
+    return ret;
+}
+
+// the first i >= from with bit i equal to value, or size if none
+inline int64_t NextBit(const std::vector<uint64_t> &bits, int64_t from, int64_t size, bool value) {
+    if (from >= size) {
+        return size;
+    }
+
+    uint64_t flip = value ? 0 : ~0ULL;
+    uint64_t word = (bits[from / 64] ^ flip) & (~0ULL << (from % 64));
+    int64_t w = from / 64;
+
+    while (word == 0) {
+        if (++w * 64 >= size) {
+            return size;
+        }
+
+        word = bits[w] ^ flip;
+    }
+
+    return std::min(w * 64 + __builtin_ctzll(word), size);
+}
+
+// an edge of a unit, with what the output needs of it
+struct UnitEdge {
+    int b;
+    int count;
+    int bucket;
+    const uint32_t *tip_label; // of a $ edge, NULL otherwise
+};
+
+/**
+ * @brief an SdBG as its units in the sorted order: a node (its edges up to the one with the last flag) or a $ edge
+ * @details the .sdbg keeps no node labels, and they are not rebuilt: their chars are computed one position at a time,
+ *          like a BWT inversion. The i-th node ending with c is entered by the i-th plus edge of W = c, so char j of
+ *          a node is char j-1 of the node (or $ edge) that edge comes from, and one linear scan of the edges moves all
+ *          nodes to the next char. Only the chars at two positions are kept, 2 bits per node
+ */
+class SdbgUnits {
+  public:
+    // a position in the units, for NextChar()
+    struct Cursor {
+        int64_t unit;
+        int64_t node;
+        int64_t tip;
+
+        Cursor(): unit(0), node(0), tip(0) {}
+    };
+
+    explicit SdbgUnits(const char *sdbg_name): num_units_(0) {
+        SdbgReader reader;
+        reader.set_file_prefix(std::string(sdbg_name));
+        reader.read_info();
+        reader.init_files();
+
+        kmer_k_ = reader.kmer_size();
+        words_per_tip_label_ = reader.words_per_tip_label();
+        items_.resize(reader.num_items());
+        tip_labels_.resize(reader.num_tips() * words_per_tip_label_);
+        is_tip_unit_.resize(DivCeiling(items_.size(), 64));
+        bucket_end_.resize(reader.num_buckets());
+        bucket_units_.resize(reader.num_buckets(), 0);
+
+        for (int i = 0; i < reader.num_buckets(); ++i) {
+            bucket_end_[i] = (i == 0 ? 0 : bucket_end_[i - 1]) + reader.bucket_size(i);
+        }
+
+        const long long *f = reader.f();
+        int64_t num_nodes = 0, num_tips = 0;
+        int c = 1, bucket = 0;
+
+        for (int64_t x = 0; x < (int64_t)items_.size(); ++x) {
+            for (; c <= 4 && f[c] == x; ++c) {
+                node_start_[c] = num_nodes;
+            }
+
+            while (x >= bucket_end_[bucket]) {
+                ++bucket;
+            }
+
+            if (!reader.NextItem(items_[x])) {
+                xerr_and_exit("%s.sdbg has fewer edges than its info\n", sdbg_name);
+            }
+
+            if ((items_[x] >> 8) == kMulti2Sp) {
+                large_muls_.push_back(reader.NextLargeMul());
+            }
+
+            if ((items_[x] >> 5) & 1) {
+                reader.NextTipLabel(&tip_labels_[num_tips++ * words_per_tip_label_]);
+                SetBit(is_tip_unit_, num_units_++, true);
+                ++bucket_units_[bucket];
+            }
+            else if ((items_[x] >> 4) & 1) {
+                ++num_units_;
+                ++num_nodes;
+                ++bucket_units_[bucket];
+            }
+        }
+
+        for (; c <= 5; ++c) {
+            node_start_[c] = num_nodes;
+        }
+
+        chars_.resize(DivCeiling(num_nodes + 1, kCharsPerWord));
+        prev_chars_.resize(chars_.size());
+        Rewind();
+    }
+
+    int kmer_k() const {
+        return kmer_k_;
+    }
+
+    int words_per_tip_label() const {
+        return words_per_tip_label_;
+    }
+
+    int64_t size() const {
+        return items_.size();
+    }
+
+    int64_t num_units() const {
+        return num_units_;
+    }
+
+    int num_buckets() const {
+        return bucket_units_.size();
+    }
+
+    int64_t bucket_units(int bucket) const {
+        return bucket_units_[bucket];
+    }
+
+    // moves the nodes from char j-1 of their labels to char j; char 0 is the F block
+    void ComputeChars(int j) {
+        chars_.swap(prev_chars_);
+        std::fill(chars_.begin(), chars_.end(), 0);
+
+        if (j == 0) {
+            for (int c = 1; c <= 4; ++c) {
+                for (int64_t r = node_start_[c]; r < node_start_[c + 1]; ++r) {
+                    SetChar_(chars_, r, c - 1);
+                }
+            }
+
+            return;
+        }
+
+        // without a branch on W: the edges that enter no node (W = $ or a minus) write to the spare char past the nodes
+        int64_t next_node[16];
+        std::fill(next_node, next_node + 16, node_start_[5]);
+        std::copy(node_start_ + 1, node_start_ + 5, next_node + 1);
+        int64_t node = 0, tip = 0;
+
+        for (int64_t x = 0; x < (int64_t)items_.size(); ++x) {
+            unsigned w = items_[x] & 0xF;
+            int is_tip = (items_[x] >> 5) & 1;
+            int c = UNLIKELY(is_tip) ? GetLabelChar_(&tip_labels_[tip * words_per_tip_label_], j - 1) : GetChar_(prev_chars_, node);
+            SetChar_(chars_, next_node[w], c);
+            next_node[w] += w - 1 < 4;
+            tip += is_tip;
+            node += (items_[x] >> 4) & 1;
+        }
+
+        for (int c = 1; c <= 4; ++c) {
+            assert(next_node[c] == node_start_[c + 1]);
+        }
+    }
+
+    // char j of the label of the unit at cur, plus one, and moves cur to the next unit;
+    // 0 for the $ that ends the (k-1)-mer of a $ edge
+    int NextChar(int j, Cursor &cur) const {
+        if (GetBit(is_tip_unit_, cur.unit++)) {
+            const uint32_t *label = &tip_labels_[cur.tip++ * words_per_tip_label_];
+            return j < kmer_k_ - 1 ? GetLabelChar_(label, j) + 1 : 0;
+        }
+
+        return GetChar_(chars_, cur.node++) + 1;
+    }
+
+    // adds the next num_units units to counts by NextChar(), and moves cur past them
+    void CountChars(int j, int64_t num_units, Cursor &cur, int64_t counts[5]) const {
+        int64_t end = cur.unit + num_units;
+        int64_t num_tips = 0;
+
+        for (int64_t u = NextBit(is_tip_unit_, cur.unit, end, true); u < end; u = NextBit(is_tip_unit_, u + 1, end, true)) {
+            const uint32_t *label = &tip_labels_[(cur.tip + num_tips++) * words_per_tip_label_];
+            ++counts[j < kmer_k_ - 1 ? GetLabelChar_(label, j) + 1 : 0];
+        }
+
+        // the nodes a word at a time: a char is 2 bits, counted by its low and high bit
+        int64_t from = cur.node, to = cur.node + num_units - num_tips;
+
+        for (int64_t w = from / kCharsPerWord; w * kCharsPerWord < to; ++w) {
+            uint64_t valid = 0x5555555555555555ULL;
+
+            if (w == from / kCharsPerWord) {
+                valid &= ~0ULL << (from % kCharsPerWord * 2);
+            }
+
+            if ((w + 1) * kCharsPerWord > to) {
+                valid &= ~0ULL >> (64 - (to - w * kCharsPerWord) * 2);
+            }
+
+            uint64_t lo = chars_[w] & valid, hi = (chars_[w] >> 1) & valid;
+            counts[1] += __builtin_popcountll(valid & ~(lo | hi));
+            counts[2] += __builtin_popcountll(lo & ~hi);
+            counts[3] += __builtin_popcountll(hi & ~lo);
+            counts[4] += __builtin_popcountll(lo & hi);
+        }
+
+        cur.unit = end;
+        cur.tip += num_tips;
+        cur.node = to;
+    }
+
+    void Skip(int64_t num_units, Cursor &cur) const {
+        int64_t num_tips = CountOnes(is_tip_unit_, cur.unit, cur.unit + num_units);
+        cur.unit += num_units;
+        cur.tip += num_tips;
+        cur.node += num_units - num_tips;
+    }
+
+    // back to the first unit, for NextEdges()
+    void Rewind() {
+        x_ = unit_ = tip_ = large_mul_ = 0;
+        bucket_ = 0;
+    }
+
+    // appends the edges of the next unit
+    void NextEdges(std::vector<UnitEdge> &edges) {
+        bool is_tip = GetBit(is_tip_unit_, unit_++);
+        int last;
+
+        do {
+            while (x_ >= bucket_end_[bucket_]) {
+                ++bucket_;
+            }
+
+            int w = items_[x_] & 0xF;
+            UnitEdge edge;
+            edge.b = w == 0 ? kSentinelValue : (w - 1) % 4;
+            edge.count = items_[x_] >> 8;
+            edge.bucket = bucket_;
+            edge.tip_label = is_tip ? &tip_labels_[tip_++ * words_per_tip_label_] : NULL;
+
+            if (edge.count == kMulti2Sp) {
+                edge.count = large_muls_[large_mul_++];
+            }
+
+            edges.push_back(edge);
+            last = (items_[x_++] >> 4) & 1;
+        }
+        while (!is_tip && !last);
+    }
+
+  private:
+    static const int kCharsPerWord = 32; // of chars_
+
+    static int GetLabelChar_(const uint32_t *label, int i) {
+        return (label[i / kCharsPerEdgeWord] >> (kTopCharShift - i % kCharsPerEdgeWord * kBitsPerEdgeChar)) & 3;
+    }
+
+    static int GetChar_(const std::vector<uint64_t> &chars, int64_t i) {
+        return (chars[i / kCharsPerWord] >> (i % kCharsPerWord * 2)) & 3;
+    }
+
+    static void SetChar_(std::vector<uint64_t> &chars, int64_t i, int c) {
+        chars[i / kCharsPerWord] |= uint64_t(c) << (i % kCharsPerWord * 2);
+    }
+
+    int kmer_k_;
+    int words_per_tip_label_;
+    std::vector<uint16_t> items_;
+    std::vector<multi_t> large_muls_;
+    std::vector<uint32_t> tip_labels_;
+    std::vector<int64_t> bucket_end_; // the end of each bucket in items_
+    std::vector<int64_t> bucket_units_;
+    std::vector<uint64_t> is_tip_unit_; // a bit per unit
+    int64_t num_units_;
+    std::vector<uint64_t> chars_; // of the nodes, at the current position
+    std::vector<uint64_t> prev_chars_;
+    int64_t node_start_[6]; // the first node of each F block
+
+    // the cursor of NextEdges()
+    int64_t x_;
+    int64_t unit_;
+    int64_t tip_;
+    int64_t large_mul_;
+    int bucket_;
+};
+
+/**
+ * @brief the units of two SdBGs in the order of their labels, refined one char at a time like an MSD radix sort.
+ *        Each SdBG keeps its own order, so the merged order is just the SdBG of each position; the blocks are the
+ *        runs of units with equal label prefixes, and are only split in place. Starting from the buckets, a block
+ *        never outgrows its bucket
+ */
+class MergedOrder {
+  public:
+    // with by_bucket, the blocks are the buckets, i.e. the units are sorted by their first kBucketPrefixLength chars
+    MergedOrder(const SdbgUnits &graph1, const SdbgUnits &graph2, bool by_bucket):
+        size_(graph1.num_units() + graph2.num_units()), from_(DivCeiling(size_, 64), 0), starts_(DivCeiling(size_, 64), 0) {
+        if (!by_bucket) {
+            for (int64_t i = graph1.num_units(); i < size_; ++i) {
+                SetBit(from_, i, true);
+            }
+
+            if (size_ > 0) {
+                SetBit(starts_, 0, true);
+            }
+
+            return;
+        }
+
+        for (int64_t b = 0, i = 0; b < graph1.num_buckets(); ++b) {
+            int64_t end = i + graph1.bucket_units(b) + graph2.bucket_units(b);
+
+            if (end > i) {
+                SetBit(starts_, i, true);
+            }
+
+            for (i += graph1.bucket_units(b); i < end; ++i) {
+                SetBit(from_, i, true);
+            }
+        }
+    }
+
+    int64_t size() const {
+        return size_;
+    }
+
+    // the SdBG of the unit at position i
+    int from(int64_t i) const {
+        return GetBit(from_, i);
+    }
+
+    const std::vector<uint64_t> &starts() const {
+        return starts_;
+    }
+
+    // splits every block by char j of the labels, stably
+    void Refine(int j, SdbgUnits *units[2]) {
+        SdbgUnits::Cursor cur[2];
+
+        for (int64_t s = 0; s < size_; ) {
+            int64_t e = NextBit(starts_, s + 1, size_, true);
+
+            if (e == s + 1) {
+                // single units stay where they are; skip up to the next larger block
+                int64_t run_end = NextBit(starts_, s, size_, false);
+                run_end = run_end == size_ ? size_ : run_end - 1;
+                int64_t num_from2 = CountOnes(from_, s, run_end);
+                units[0]->Skip(run_end - s - num_from2, cur[0]);
+                units[1]->Skip(num_from2, cur[1]);
+                s = run_end;
+                continue;
+            }
+
+            if (e == s + 2) {
+                // most blocks left are a node shared by both graphs
+                int g1 = from(s), g2 = from(s + 1);
+                int c1 = units[g1]->NextChar(j, cur[g1]), c2 = units[g2]->NextChar(j, cur[g2]);
+
+                if (c1 != c2) {
+                    SetBit(starts_, s + 1, true);
+                }
+
+                if (c1 > c2) {
+                    SetBit(from_, s, g2);
+                    SetBit(from_, s + 1, g1);
+                }
+
+                s = e;
+                continue;
+            }
+
+            // the units of graph1 come first in a block and keep their order, which is the order of their labels;
+            // so do the units of graph2, and the sub-blocks of each char only need the counts
+            int64_t num_from2 = CountOnes(from_, s, e);
+            int64_t counts[2][5] = {{0}};
+            units[0]->CountChars(j, e - s - num_from2, cur[0], counts[0]);
+            units[1]->CountChars(j, num_from2, cur[1], counts[1]);
+
+            bool mixed = num_from2 > 0 && num_from2 < e - s;
+
+            if (mixed) {
+                FillBits(from_, s, e, false);
+            }
+
+            for (int c = 0; c < 5; ++c) {
+                if (counts[0][c] + counts[1][c] > 0) {
+                    SetBit(starts_, s, true);
+
+                    if (mixed) {
+                        FillBits(from_, s + counts[0][c], s + counts[0][c] + counts[1][c], true);
+                    }
+
+                    s += counts[0][c] + counts[1][c];
+                }
+            }
+        }
+    }
+
+  private:
+    int64_t size_;
+    std::vector<uint64_t> from_; // a bit per position
+    std::vector<uint64_t> starts_;
+};
+
+/**
+ * @brief writes the merged edges group by group of equal (k-1)-mer S, the same way as output_() of stage 2:
+ *        edges are counted, a $ node edge is dropped if S has a solid in-edge of the same b and an edge to $
+ *        if its node has a solid out-edge; last and minus flags are recomputed over the merged group
+ */
+class GroupWriter {
+  public:
+    GroupWriter(SdbgWriter &writer, int kmer_k, int words_per_substring, int words_per_tip_label):
+        writer_(writer), words_per_substring_(words_per_substring), words_per_tip_label_(words_per_tip_label), mask_(kmer_k) { }
+
+    // an edge of the group, in the sorted order; a is the node of the edge in the group, or kSentinelValue for a $ node
+    void Add(int a, const UnitEdge &edge) {
+        a_.push_back(a);
+        edges_.push_back(edge);
+    }
+
+    void Flush() {
+        int n = edges_.size();
+        int has_solid_a = 0, has_solid_b = 0;
+        int last_a[4], outputed_b = 0;
+
+        for (int i = 0; i < n; ++i) {
+            int a = a_[i], b = edges_[i].b;
+
+            if (a != kSentinelValue && b != kSentinelValue) {
+                has_solid_a |= 1 << a;
+                has_solid_b |= 1 << b;
+            }
+
+            if (a != kSentinelValue &&
+                    (b != kSentinelValue || !(has_solid_a & (1 << a)))) {
+                last_a[a] = i;
+            }
+        }
+
+        for (int i = 0; i < n; ++i) {
+            int a = a_[i], b = edges_[i].b;
+            int is_dollar = 0;
+
+            if (a == kSentinelValue) {
+                assert(b != kSentinelValue);
+
+                if (has_solid_b & (1 << b)) {
+                    continue;
+                }
+
+                is_dollar = 1;
+            }
+
+            if (b == kSentinelValue) {
+                assert(a != kSentinelValue);
+
+                if (has_solid_a & (1 << a)) {
+                    continue;
+                }
+            }
+
+            int w = (b == kSentinelValue) ? 0 : ((outputed_b & (1 << b)) ? b + 5 : b + 1);
+            int last = (a == kSentinelValue) ? 0 : ((last_a[a] == i) ? 1 : 0);
+            outputed_b |= 1 << b;
+
+            // the tip label is the leading words of the stage 2 item: the (k-1)-mer, then b if it shares the last word
+            uint32_t tip_label[kMaxWordsPerSubstring];
+
+            if (is_dollar) {
+                for (int j = 0; j < words_per_tip_label_; ++j) {
+                    tip_label[j] = edges_[i].tip_label[j] & mask_.mask[j];
+                }
+
+                if (words_per_tip_label_ == words_per_substring_) {
+                    tip_label[words_per_substring_ - 1] |= b;
+                }
+            }
+
+            writer_.write(0, edges_[i].bucket, w, last, is_dollar, std::min(edges_[i].count, kMaxMulti_t), tip_label);
+        }
+
+        a_.clear();
+        edges_.clear();
+    }
+
+  private:
+    SdbgWriter &writer_;
+    int words_per_substring_;
+    int words_per_tip_label_;
+    KMinusOneMerMask<kMaxWordsPerSubstring> mask_;
+    std::vector<int> a_;
+    std::vector<UnitEdge> edges_;
+};
+
+} // namespace
+
+static void DisplayMergeGraphHelp(const char *program) {
+    fprintf(stderr, "Usage %s <sdbg_prefix1> <sdbg_prefix2> <out_prefix> [compress_level=0]\n"
+            "    merge two SdBGs of the same k into one, summing the multiplicities of shared edges;\n"
+            "    compress_level 1 to 9 writes the merged SdBG as zlib blocks\n", program);
+}
+
+int merge_graph(int argc, char **argv) {
+    if (argc < 4) {
+        DisplayMergeGraphHelp(argv[0]);
+        exit(1);
+    }
+
+    xtimer_t timer;
+    timer.reset();
+    timer.start();
+
+    SdbgUnits graph1(argv[1]), graph2(argv[2]);
+    xlog("Loaded %lld and %lld edges\n", (long long)graph1.size(), (long long)graph2.size());
+
+    if (graph1.kmer_k() != graph2.kmer_k()) {
+        xerr_and_exit("Cannot merge SdBGs of different k: %d and %d\n", graph1.kmer_k(), graph2.kmer_k());
+    }
+
+    int kmer_k = graph1.kmer_k();
+    int words_per_substring = DivCeiling(kmer_k * kBitsPerEdgeChar + kBWTCharNumBits + 1, kBitsPerEdgeWord);
+
+    // sort the units of both graphs by their k-char labels: after char k-2 the blocks are the groups of
+    // equal (k-1)-mers, after char k-1 the nodes, of either graph or both, and the $ edges of each (k-1)-mer.
+    // The buckets give the first chars
+    SdbgUnits *units[2] = {&graph1, &graph2};
+    bool by_bucket = kmer_k - 2 >= kBucketPrefixLength && graph1.num_buckets() == kNumBuckets && graph2.num_buckets() == kNumBuckets;
+    MergedOrder order(graph1, graph2, by_bucket);
+    std::vector<uint64_t> group_starts;
+
+    for (int j = 0; j < kmer_k; ++j) {
+        graph1.ComputeChars(j);
+        graph2.ComputeChars(j);
+
+        if (!by_bucket || j >= kBucketPrefixLength) {
+            order.Refine(j, units);
+        }
+
+        if (j == kmer_k - 2) {
+            group_starts = order.starts();
+        }
+    }
+
+    xlog("Sorted %lld units by their labels\n", (long long)order.size());
+
+    SdbgWriter writer;
+    writer.set_num_threads(1);
+    writer.set_kmer_size(kmer_k);
+    writer.set_num_buckets(kNumBuckets);
+    writer.set_file_prefix(argv[3]);
+    writer.set_compress_level(argc > 4 ? atoi(argv[4]) : 0);
+    writer.init_files();
+
+    // the edges of a node block are merged by b; an edge in both graphs is output once with the sum of multiplicities
+    GroupWriter group_writer(writer, kmer_k, words_per_substring, graph1.words_per_tip_label());
+    std::vector<UnitEdge> edges[2];
+    int64_t num_shared = 0;
+    int node_in_group = 0;
+    graph1.Rewind();
+    graph2.Rewind();
+
+    for (int64_t i = 0; i <= order.size(); ++i) {
+        if ((i == order.size() || GetBit(order.starts(), i)) && (!edges[0].empty() || !edges[1].empty())) {
+            int a = (edges[0].empty() ? edges[1][0] : edges[0][0]).tip_label ? kSentinelValue : node_in_group++;
+            size_t i1 = 0, i2 = 0;
+
+            while (i1 < edges[0].size() || i2 < edges[1].size()) {
+                int cmp = i1 == edges[0].size() ? 1 : (i2 == edges[1].size() ? -1 : edges[0][i1].b - edges[1][i2].b);
+
+                if (cmp < 0) {
+                    group_writer.Add(a, edges[0][i1++]);
+                }
+                else if (cmp > 0) {
+                    group_writer.Add(a, edges[1][i2++]);
+                }
+                else {
+                    UnitEdge edge = edges[0][i1++];
+                    edge.count += edges[1][i2++].count;
+                    group_writer.Add(a, edge);
+                    ++num_shared;
+                }
+            }
+
+            edges[0].clear();
+            edges[1].clear();
+        }
+
+        if (i == order.size()) {
+            break;
+        }
+
+        if (GetBit(group_starts, i)) {
+            group_writer.Flush();
+            node_in_group = 0;
+        }
+
+        units[order.from(i)]->NextEdges(edges[order.from(i)]);
+    }
+
+    group_writer.Flush();
+
+    xlog("Number of shared edges: %lld\n", (long long)num_shared);
+    xlog("Total number of edges: %lld\n", (long long)writer.num_edges());
+    xlog("Total number of ONEs: %lld\n", (long long)writer.num_last1());
+    xlog("Total number of $v edges: %lld\n", (long long)writer.num_tips());
+    writer.destroy();
+
+    timer.stop();
+    xlog("Merging done. Time elapsed: %.4lf\n", timer.elapsed());
+    return 0;
+}
@@ -33,13 +33,26 @@ class NodeEnumerator {
     MostProbablePath *hcost;
     AStarNode next;
     double low_cov_penalty;
+    // penalty of a codon indexed by (min multiplicity tier of its 3 edges) << 1 | (all 3 edges are multi 1)
+    double cov_penalty[(SuccinctDBG::kMultiOverflowTier + 1) * 2];
 
   public:
-    NodeEnumerator(ProfileHMM &_hmm, MostProbablePath &_hcost, double low_cov_pen) {
+    /**
+     * @param low_cov_pen the score of a codon whose 3 edges are all multiplicity 1 is scaled by low_cov_pen
+     * @param cov_weight if > 0, each codon also gets cov_weight * log(c / 2), where c is the min multiplicity
+     * (capped at 4) of its 3 edges, i.e. a graded bonus for well covered paths and penalty for 1x ones
+     */
+    NodeEnumerator(ProfileHMM &_hmm, MostProbablePath &_hcost, double low_cov_pen, double cov_weight = 0) {
         hmm = &_hmm;
         prot_search = _hmm.getAlphabet() == ProfileHMM::protein;
         hcost = &_hcost;
         this->low_cov_penalty = -log(low_cov_pen);
+
+        for (int tier = 0; tier <= SuccinctDBG::kMultiOverflowTier; ++tier) {
+            double graded = cov_weight > 0 ? -cov_weight * log((tier + 1) / 2.0) : 0;
+            cov_penalty[tier << 1] = graded;
+            cov_penalty[tier << 1 | 1] = graded + low_cov_penalty;
+        }
     };
     ~NodeEnumerator() {};
     void enumerateNodes(vector<AStarNode> &ret, AStarNode &curr, bool forward, SuccinctDBG &dbg) {
@@ -116,6 +129,9 @@ class NodeEnumerator {
                         packed |= (dbg.IsMulti1(next_node[i]) &&
                                    dbg.IsMulti1(next_node_2[j]) &&
                                    dbg.IsMulti1(next_node_3[k])) << 9;
+                        packed |= (int64_t)MIN3(dbg.EdgeMultiplicityTier(next_node[i]),
+                                                dbg.EdgeMultiplicityTier(next_node_2[j]),
+                                                dbg.EdgeMultiplicityTier(next_node_3[k])) << 11;
                         packed_codon.push_back(packed);
 
                         if ((lowCovSibling & (1 << i)) ||
@@ -147,7 +163,7 @@ class NodeEnumerator {
                     continue;
                 }
 
-                double lowCovPenalty = (packed & (1 << 9)) ? low_cov_penalty : 0;
+                double lowCovPenalty = cov_penalty[(packed >> 10 & 6) | (packed >> 9 & 1)];
 
                 if (packed & (1 << 10)) lowCovPenalty += kLowCovSibling;
 
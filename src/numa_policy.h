@@ -0,0 +1,102 @@
+/*
+ *  MEGAHIT
+ *  Copyright (C) 2014 - 2015 The University of Hong Kong
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* contact: Dinghua Li <dhli@cs.hku.hk> */
+
+#ifndef NUMA_POLICY_H__
+#define NUMA_POLICY_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef __linux__
+    #include <sys/syscall.h>
+    #include <linux/mempolicy.h>
+#endif
+
+/**
+ * @brief memory policy of the calling thread, set with the raw syscall so that libnuma is not needed
+ * a structure built by one thread under InterleaveMemPolicy() has its pages spread over all the NUMA nodes
+ * with memory, instead of all being first-touched on the node of that thread
+ */
+struct NumaMemPolicy {
+    static const int kMaxNumaNodes = 1024;
+
+    // the number of nodes the following allocations are interleaved over; 0 if not supported
+    static int InterleaveMemPolicy() {
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+        unsigned long mask[kMaxNumaNodes / (8 * sizeof(unsigned long))] = {0};
+        int num_nodes = ReadNodeList_("/sys/devices/system/node/has_memory", mask);
+
+        if (num_nodes <= 1) {
+            return 0;
+        }
+
+        if (syscall(SYS_set_mempolicy, MPOL_INTERLEAVE, mask, (unsigned long)kMaxNumaNodes) != 0) {
+            return 0;
+        }
+
+        return num_nodes;
+#else
+        return 0;
+#endif
+    }
+
+    // back to allocating on the node of the touching thread
+    static void DefaultMemPolicy() {
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+        syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0UL);
+#endif
+    }
+
+  private:
+    // parses a node list like "0-1,3" into mask; returns the number of nodes
+    static int ReadNodeList_(const char *file_name, unsigned long *mask) {
+        FILE *fp = fopen(file_name, "r");
+
+        if (fp == NULL) {
+            return 0;
+        }
+
+        int num_nodes = 0, from, to;
+        const int kBitsPerLong = 8 * sizeof(unsigned long);
+
+        while (fscanf(fp, "%d", &from) == 1) {
+            to = from;
+
+            if (fscanf(fp, "-%d", &to) != 1) {
+                to = from;
+            }
+
+            for (int i = from; i <= to && i < kMaxNumaNodes; ++i) {
+                mask[i / kBitsPerLong] |= 1UL << (i % kBitsPerLong);
+                ++num_nodes;
+            }
+
+            if (fgetc(fp) != ',') {
+                break;
+            }
+        }
+
+        fclose(fp);
+        return num_nodes;
+    }
+};
+
+#endif // NUMA_POLICY_H__
@@ -35,8 +35,159 @@
 #include "lib_info.h"
 #include "sequence_manager.h"
 #include "sequence_package.h"
+#include "count_min_sketch.h"
 #include "mem_file_checker-inl.h"
 
+/**
+ * @brief write batches of sequences to a versioned .bin image which can be mmapped by SequencePackage::MapImage
+ * sequences are stored as they are in the batches, i.e. reversed if is_reverse
+ */
+class SequenceImageWriter {
+  public:
+    SequenceImageWriter(const std::string &file_name, bool is_reverse):
+        file_name_(file_name), num_seq_(0), num_bases_(0), num_words_(0), max_read_len_(0), carry_(0), carry_chars_(0) {
+        memset(&header_, 0, sizeof(header_));
+        memcpy(header_.magic, SequencePackage::ImageMagic(), sizeof(header_.magic));
+        header_.version = SequencePackage::kImageVersion;
+        header_.is_reverse = is_reverse;
+        header_.seq_offset = SequencePackage::kImageAlign;
+
+        file_ = OpenFileAndCheck(file_name_.c_str(), "wb");
+        idx_file_ = OpenFileAndCheck((file_name_ + ".idx.tmp").c_str(), "wb+");
+        Pad_(header_.seq_offset);
+    }
+
+    ~SequenceImageWriter() {
+        if (file_ != NULL) {
+            Close();
+        }
+    }
+
+    void Append(SequencePackage &package) {
+        std::vector<uint32_t> buf;
+        uint64_t batch_bases = package.base_size();
+        uint64_t batch_words = DivCeiling(batch_bases, SequencePackage::kCharsPerWord);
+        buf.reserve(batch_words + 1);
+
+        // shift the batch behind the bases already written
+        for (uint64_t i = 0; i < batch_words; ++i) {
+            uint32_t w = package.get_word(i);
+            int chars = (i + 1 < batch_words || batch_bases % SequencePackage::kCharsPerWord == 0) ?
+                        SequencePackage::kCharsPerWord : batch_bases % SequencePackage::kCharsPerWord;
+            carry_ |= w >> (carry_chars_ * 2);
+
+            if (carry_chars_ + chars >= (int)SequencePackage::kCharsPerWord) {
+                int remain = carry_chars_ + chars - SequencePackage::kCharsPerWord;
+                buf.push_back(carry_);
+                carry_ = remain > 0 ? w << (chars - remain) * 2 : 0;
+                carry_chars_ = remain;
+            }
+            else {
+                carry_chars_ += chars;
+            }
+        }
+
+        fwrite(&buf[0], sizeof(uint32_t), buf.size(), file_);
+        num_words_ += buf.size();
+
+        for (size_t i = 0; i < package.size(); ++i) {
+            uint64_t start = num_bases_ + package.get_start_index(i);
+            fwrite(&start, sizeof(uint64_t), 1, idx_file_);
+        }
+
+        num_seq_ += package.size();
+        num_bases_ += batch_bases;
+        max_read_len_ = std::max(max_read_len_, (uint64_t)package.max_read_len());
+    }
+
+    void Close() {
+        if (carry_chars_ > 0) {
+            fwrite(&carry_, sizeof(uint32_t), 1, file_);
+            ++num_words_;
+        }
+
+        // pad one more word so that reading the word after a sequence stays inside the section
+        uint32_t zero = 0;
+        fwrite(&zero, sizeof(uint32_t), 1, file_);
+        ++num_words_;
+
+        fwrite(&num_bases_, sizeof(uint64_t), 1, idx_file_);
+        header_.start_idx_offset = AlignUp_(header_.seq_offset + num_words_ * sizeof(uint32_t));
+        Pad_(header_.start_idx_offset);
+
+        // encode start indices and build the position lookup on the fly, same as SequencePackage::BuildLookup
+        EliasFano start_idx;
+        start_idx.set_low_bits(EliasFano::OptimalLowBits(num_bases_, num_seq_ + 1));
+        start_idx.reserve(num_seq_ + 1);
+        std::vector<uint64_t> pos_to_id;
+        uint64_t next_pos = 0;
+        uint64_t buf[4096];
+        int64_t id = -1;
+        size_t num_read;
+        rewind(idx_file_);
+
+        while ((num_read = fread(buf, sizeof(uint64_t), 4096, idx_file_)) > 0) {
+            for (size_t i = 0; i < num_read; ++i, ++id) {
+                start_idx.push_back(buf[i]);
+
+                // buf[i] is the end of sequence id
+                while (id >= 0 && next_pos < buf[i]) {
+                    pos_to_id.push_back(id);
+                    next_pos += SequencePackage::kLookupStep;
+                }
+            }
+        }
+
+        while (next_pos <= num_bases_) {
+            pos_to_id.push_back(num_seq_);
+            next_pos += SequencePackage::kLookupStep;
+        }
+
+        pos_to_id.push_back(num_seq_);
+        pos_to_id.push_back(num_seq_);
+
+        start_idx.Serialize(file_);
+        header_.lookup_offset = AlignUp_(header_.start_idx_offset + start_idx.serialized_words() * sizeof(uint64_t));
+        Pad_(header_.lookup_offset);
+        fwrite(&pos_to_id[0], sizeof(uint64_t), pos_to_id.size(), file_);
+
+        header_.num_seq = num_seq_;
+        header_.num_bases = num_bases_;
+        header_.num_words = num_words_;
+        header_.num_lookup = pos_to_id.size();
+        header_.max_read_len = max_read_len_;
+        fseek(file_, 0, SEEK_SET);
+        fwrite(&header_, sizeof(header_), 1, file_);
+
+        fclose(file_);
+        fclose(idx_file_);
+        remove((file_name_ + ".idx.tmp").c_str());
+        file_ = NULL;
+    }
+
+  private:
+    static uint64_t AlignUp_(uint64_t offset) {
+        return DivCeiling(offset, SequencePackage::kImageAlign) * SequencePackage::kImageAlign;
+    }
+
+    void Pad_(uint64_t offset) {
+        for (uint64_t cur = ftell(file_); cur < offset; ++cur) {
+            fputc(0, file_);
+        }
+    }
+
+    std::string file_name_;
+    FILE *file_;
+    FILE *idx_file_;
+    SequenceImageHeader header_;
+    uint64_t num_seq_;
+    uint64_t num_bases_;
+    uint64_t num_words_;
+    uint64_t max_read_len_;
+    uint32_t carry_;
+    int carry_chars_;
+};
+
 inline void ReadMultipleLibs(const std::string &lib_file, SequencePackage &package,
                              std::vector<lib_info_t> &lib_info, bool is_reverse) {
     std::ifstream lib_config(lib_file);
@@ -116,17 +267,136 @@ inline void ReadMultipleLibs(const std::string &lib_file, SequencePackage &packa
     }
 }
 
+/**
+ * @brief streaming digital normalization of the reads written by buildlib
+ * a read is dropped if the median count of its canonical k-mers, among the reads kept so far, has reached max_coverage;
+ * a pair is kept if either mate passes. Low coverage regions are never touched, deep ones are capped at about max_coverage
+ */
+class DigitalNormalizer {
+  public:
+    DigitalNormalizer(int max_coverage, size_t sketch_mem, int k = 20):
+        sketch_(sketch_mem), max_coverage_(max_coverage), k_(k), num_kept_(0), num_dropped_(0) {
+        assert(k > 0 && k <= 32);
+    }
+
+    size_t size_in_byte() const {
+        return sketch_.size_in_byte();
+    }
+
+    int64_t num_kept() const {
+        return num_kept_;
+    }
+
+    int64_t num_dropped() const {
+        return num_dropped_;
+    }
+
+    /**
+     * @brief append the reads of package that pass to kept, in the same orientation; mates are adjacent if is_pe
+     */
+    void Filter(SequencePackage &package, bool is_pe, SequencePackage &kept) {
+        int step = is_pe ? 2 : 1;
+        std::vector<uint32_t> s;
+
+        for (size_t i = 0; i + step <= package.size(); i += step) {
+            bool keep = false;
+
+            for (int j = 0; j < step && !keep; ++j) {
+                keep = MedianCount_(package, i + j) < max_coverage_;
+            }
+
+            if (!keep) {
+                num_dropped_ += step;
+                continue;
+            }
+
+            for (int j = 0; j < step; ++j) {
+                Count_(package, i + j);
+                package.get_seq(s, i + j);
+                kept.AppendSeq(s.data(), package.length(i + j));
+            }
+
+            num_kept_ += step;
+        }
+    }
+
+  private:
+    template <typename KmerProc>
+    void ForEachKmer_(SequencePackage &package, size_t seq_id, KmerProc &proc) {
+        int len = package.length(seq_id);
+        uint64_t mask = k_ == 32 ? ~0ULL : (1ULL << (2 * k_)) - 1;
+        uint64_t kmer = 0, rev_kmer = 0;
+
+        for (int j = 0; j < len; ++j) {
+            uint64_t c = package.get_base(seq_id, j);
+            kmer = ((kmer << 2) | c) & mask;
+            rev_kmer = (rev_kmer >> 2) | ((3 - c) << (2 * k_ - 2));
+
+            if (j >= k_ - 1) {
+                proc(std::min(kmer, rev_kmer));
+            }
+        }
+    }
+
+    struct Collector {
+        std::vector<uint16_t> *counts;
+        const CountMinSketch *sketch;
+        void operator()(uint64_t kmer) {
+            counts->push_back(sketch->Estimate(kmer));
+        }
+    };
+
+    struct Adder {
+        CountMinSketch *sketch;
+        void operator()(uint64_t kmer) {
+            sketch->Add(kmer);
+        }
+    };
+
+    // reads shorter than k have no k-mers and always pass
+    int MedianCount_(SequencePackage &package, size_t seq_id) {
+        counts_.clear();
+        Collector collector = {&counts_, &sketch_};
+        ForEachKmer_(package, seq_id, collector);
+
+        if (counts_.empty()) {
+            return 0;
+        }
+
+        std::nth_element(counts_.begin(), counts_.begin() + counts_.size() / 2, counts_.end());
+        return counts_[counts_.size() / 2];
+    }
+
+    void Count_(SequencePackage &package, size_t seq_id) {
+        Adder adder = {&sketch_};
+        ForEachKmer_(package, seq_id, adder);
+    }
+
+    CountMinSketch sketch_;
+    int max_coverage_;
+    int k_;
+    int64_t num_kept_;
+    int64_t num_dropped_;
+    std::vector<uint16_t> counts_;
+};
+
+/**
+ * @brief read the libraries listed in lib_file and write them to out_prefix.bin/.lib_info;
+ * reads are normalized on the fly if normalizer is not NULL
+ */
 inline void ReadAndWriteMultipleLibs(const std::string &lib_file, bool is_reverse,
-                                     const std::string &out_prefix, bool verbose) {
+                                     const std::string &out_prefix, bool verbose,
+                                     DigitalNormalizer *normalizer = NULL) {
     std::ifstream lib_config(lib_file);
 
     if (!lib_config.is_open()) {
         xerr_and_exit("File to open read_lib file: %s\n", lib_file.c_str());
     }
 
-    FILE *bin_file = OpenFileAndCheck(FormatString("%s.bin", out_prefix.c_str()), "wb");
+    SequenceImageWriter image_writer(FormatString("%s.bin", out_prefix.c_str()), is_reverse);
 
     SequencePackage package;
+    SequencePackage kept; // reads passing the normalization
     std::vector<lib_info_t> lib_info;
 
     std::string metadata;
@@ -174,6 +444,7 @@ inline void ReadAndWriteMultipleLibs(const std::string &lib_file, bool is_revers
         }
 
         int64_t start = total_reads;
+        int64_t num_input = 0;
         int64_t reads_this_batch = 0;
         int reads_per_bach = 1 << 22;
         int bases_per_bach = 1 << 28;
@@ -186,27 +457,40 @@ inline void ReadAndWriteMultipleLibs(const std::string &lib_file, bool is_revers
                 break;
             }
 
-            total_reads += reads_this_batch;
-            total_bases += package.base_size();
-            seq_manager.WriteBinarySequences(bin_file, is_reverse);
-            max_read_len = std::max(max_read_len, (int)package.max_read_len());
+            num_input += reads_this_batch;
+            SequencePackage *batch = &package;
+
+            if (normalizer != NULL) {
+                kept.clear();
+                normalizer->Filter(package, type != "se", kept);
+                batch = &kept;
+            }
+
+            total_reads += batch->size();
+            total_bases += batch->base_size();
+            image_writer.Append(*batch);
+            max_read_len = std::max(max_read_len, (int)batch->max_read_len());
         }
 
         seq_manager.clear();
 
-        if (type == "pe" && (total_reads - start) % 2 != 0) {
-            xerr("PE library number of reads is odd: %lld!\n", total_reads - start);
+        if (type == "pe" && num_input % 2 != 0) {
+            xerr("PE library number of reads is odd: %lld!\n", num_input);
             xerr_and_exit("File(s): %s\n", metadata.c_str())
         }
 
-        if (type == "interleaved" && (total_reads - start) % 2 != 0) {
-            xerr("PE library number of reads is odd: %lld!\n", total_reads - start);
+        if (type == "interleaved" && num_input % 2 != 0) {
+            xerr("PE library number of reads is odd: %lld!\n", num_input);
             xerr_and_exit("File(s): %s\n", metadata.c_str())
         }
 
         if (verbose) {
             xlog("Lib %d (%s): %s, %lld reads, %d max length\n",
                  lib_info.size(), metadata.c_str(), type.c_str(), total_reads - start, max_read_len);
+
+            if (normalizer != NULL) {
+                xlog("Normalization kept %lld of %lld reads\n", total_reads - start, num_input);
+            }
         }
 
         lib_info.push_back(lib_info_t(&package, start, total_reads - 1, max_read_len, type != "se", metadata));
@@ -223,6 +507,7 @@ inline void ReadAndWriteMultipleLibs(const std::string &lib_file, bool is_revers
     }
 
     fclose(lib_info_file);
+    image_writer.Close();
 }
 
 inline void GetBinaryLibSize(const std::string &file_prefix, int64_t &total_bases, int64_t &num_reads) {
@@ -230,8 +515,14 @@ inline void GetBinaryLibSize(const std::string &file_prefix, int64_t &total_base
     assert(lib_info_file >> total_bases >> num_reads);
 }
 
+/**
+ * @brief load the .bin library written by buildlib
+ * a versioned image in the requested orientation is mmapped as a read-only view, others are copied into the package;
+ * extra_seq and extra_bases are reserved for sequences appended afterwards
+ */
 inline void ReadBinaryLibs(const std::string &file_prefix, SequencePackage &package, std::vector<lib_info_t> &lib_info,
-                           bool is_reverse = false, bool append_to_package = false) {
+                           bool is_reverse = false, bool append_to_package = false,
+                           int64_t extra_seq = 0, int64_t extra_bases = 0) {
     std::ifstream lib_info_file(file_prefix + ".lib_info");
     int64_t start, end;
     int max_read_len;
@@ -247,15 +538,63 @@ inline void ReadBinaryLibs(const std::string &file_prefix, SequencePackage &pack
         std::getline(lib_info_file, metadata); // eliminate the "\n"
     }
 
-    package.reserve_num_seq(num_reads);
-    package.reserve_bases(total_bases);
-    SequenceManager seq_manager(&package);
-    seq_manager.set_file_type(SequenceManager::kBinaryReads);
-    seq_manager.set_file(FormatString("%s.bin", file_prefix.c_str()));
+    std::string bin_file = FormatString("%s.bin", file_prefix.c_str());
+    SequenceImageHeader header;
+    int version = SequencePackage::ReadImageHeader(bin_file.c_str(), header);
+
+    if (version < 0) {
+        xerr_and_exit("Cannot open read library %s\n", bin_file.c_str());
+    }
+    else if (version > 0 && version != SequencePackage::kImageVersion) {
+        xerr_and_exit("Read library %s has version %d, expected %d. Please rerun buildlib.\n",
+                      bin_file.c_str(), version, SequencePackage::kImageVersion);
+    }
 
     xlog("Before reading, sizeof seq_package: %lld\n", package.size_in_byte());
 
-    seq_manager.ReadShortReads(1LL << 60, 1LL << 60, append_to_package, is_reverse);
+    if (version > 0 && !append_to_package && (bool)header.is_reverse == is_reverse) {
+        if (!package.MapImage(bin_file.c_str())) {
+            xerr_and_exit("Failed to map read library %s\n", bin_file.c_str());
+        }
+
+        package.reserve_num_seq(extra_seq);
+        package.reserve_bases(extra_bases);
+    }
+    else if (version > 0) {
+        // orientation differs or appending: fall back to a private copy
+        SequencePackage image;
+
+        if (!image.MapImage(bin_file.c_str())) {
+            xerr_and_exit("Failed to map read library %s\n", bin_file.c_str());
+        }
+
+        if (!append_to_package) {
+            package.clear();
+        }
+
+        package.reserve_num_seq(package.size() + num_reads + extra_seq);
+        package.reserve_bases(package.base_size() + total_bases + extra_bases);
+        std::vector<uint32_t> s;
+
+        for (size_t i = 0; i < image.size(); ++i) {
+            image.get_seq(s, i);
+
+            if (image.view_is_reverse() == is_reverse) {
+                package.AppendSeq(s.data(), image.length(i));
+            }
+            else {
+                package.AppendRevSeq(s.data(), image.length(i));
+            }
+        }
+    }
+    else {
+        package.reserve_num_seq(num_reads + extra_seq);
+        package.reserve_bases(total_bases + extra_bases);
+        SequenceManager seq_manager(&package);
+        seq_manager.set_file_type(SequenceManager::kBinaryReads);
+        seq_manager.set_file(bin_file);
+        seq_manager.ReadShortReads(1LL << 60, 1LL << 60, append_to_package, is_reverse);
+    }
 
     xlog("After reading, sizeof seq_package: %lld\n", package.size_in_byte());
 }
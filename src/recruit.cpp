@@ -0,0 +1,366 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <zlib.h>
+#include <omp.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "kseq.h"
+#include "prot_kmer_generator.h"
+#include "nucl_kmer.h"
+#include "hash_set_st.h"
+#include "sequence/NTSequence.h"
+#include "sequence/AASequence.h"
+#include "read_lib_functions-inl.h"
+#include "options_description.h"
+#include "utils.h"
+
+#ifndef KSEQ_INITED
+    #define KSEQ_INITED
+    KSEQ_INIT(gzFile, gzread)
+#endif
+
+/**
+ * recruit: keep only the reads that are likely to come from the genes of interest
+ * a read is recruited if one of its 6-frame translations shares a protein k-mer with any ref_aligned.faa,
+ * then each round of expansion recruits the reads sharing a nucleotide k-mer with the reads recruited
+ * in the previous round. Mates of recruited reads are always kept.
+ */
+
+struct recruit_opt_t {
+    std::string gene_list;
+    std::string read_lib;
+    std::string output_prefix;
+    int prot_k;
+    int nucl_k;
+    int rounds;
+    int num_cpu_threads;
+
+    recruit_opt_t() {
+        output_prefix = "recruited";
+        prot_k = 30;
+        nucl_k = 31;
+        rounds = 2;
+        num_cpu_threads = 0;
+    }
+};
+
+static recruit_opt_t opt;
+
+static void ParseRecruitOption(int argc, char *argv[]) {
+    OptionsDescription desc;
+
+    desc.AddOption("gene_list", "g", opt.gene_list, "gene list, the 4-th column of which is the ref_aligned.faa of a gene");
+    desc.AddOption("read_lib", "r", opt.read_lib, "read library prefix written by buildlib");
+    desc.AddOption("output_prefix", "o", opt.output_prefix, "output prefix of the reduced read library");
+    desc.AddOption("prot_k", "", opt.prot_k, "protein k-mer size in nucleotides, a multiple of 3");
+    desc.AddOption("nucl_k", "", opt.nucl_k, "nucleotide k-mer size used by the expansion, <= 32");
+    desc.AddOption("rounds", "", opt.rounds, "rounds of nucleotide k-mer expansion");
+    desc.AddOption("num_cpu_threads", "t", opt.num_cpu_threads, "number of cpu threads");
+
+    try {
+        desc.Parse(argc, argv);
+
+        if (opt.gene_list == "") {
+            throw std::logic_error("no gene list!");
+        }
+
+        if (opt.read_lib == "") {
+            throw std::logic_error("no read library!");
+        }
+
+        if (opt.prot_k % 3 != 0 || opt.prot_k / 3 > Kmer::MAX_PROT_KMER_SIZE || opt.prot_k <= 0) {
+            throw std::logic_error("invalid protein k-mer size!");
+        }
+
+        if (opt.nucl_k <= 0 || opt.nucl_k > 32) {
+            throw std::logic_error("nucleotide k-mer size must be in [1, 32]!");
+        }
+
+        if (opt.num_cpu_threads == 0) {
+            opt.num_cpu_threads = omp_get_max_threads();
+        }
+    }
+    catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << "Usage: " << argv[0] << " -g gene_list -r read_lib -o output_prefix" << std::endl;
+        std::cerr << "options:" << std::endl;
+        std::cerr << desc << std::endl;
+        exit(1);
+    }
+}
+
+static void LoadRefKmers(const std::string &gene_list, int prot_k, HashSetST<ProtKmer> &kmer_set) {
+    std::ifstream gene_list_file(gene_list);
+
+    if (!gene_list_file.is_open()) {
+        xerr_and_exit("Failed to open gene list %s\n", gene_list.c_str());
+    }
+
+    std::string line;
+
+    while (std::getline(gene_list_file, line)) {
+        std::istringstream words(line);
+        std::string name, for_hmm, rev_hmm, ref_aligned;
+
+        if (!(words >> name >> for_hmm >> rev_hmm >> ref_aligned)) {
+            continue;
+        }
+
+        gzFile fp = gzopen(ref_aligned.c_str(), "r");
+
+        if (fp == NULL) {
+            xerr_and_exit("Failed to open %s\n", ref_aligned.c_str());
+        }
+
+        kseq_t *seq = kseq_init(fp);
+
+        while (kseq_read(seq) >= 0) {
+            ProtKmerGenerator kmers(seq->seq.s, prot_k / 3, true);
+
+            while (kmers.hasNext()) {
+                kmer_set.insert(kmers.next());
+            }
+        }
+
+        kseq_destroy(seq);
+        gzclose(fp);
+    }
+}
+
+// both strands are scanned as in findstart; reads stored reversed (is_reverse) are read backwards
+static bool HasProtKmerHit(SequencePackage &package, int64_t read_id, bool is_reverse,
+                           HashSetST<ProtKmer> &kmer_set, int prot_k) {
+    int len = package.length(read_id);
+    std::string s(len, 'A');
+
+    for (int strand = 0; strand < 2; ++strand) {
+        for (int j = 0; j < len; ++j) {
+            if (strand == 0) {
+                s[j] = "ACGT"[package.get_base(read_id, is_reverse ? len - 1 - j : j)];
+            }
+            else {
+                s[j] = "ACGT"[3 - package.get_base(read_id, is_reverse ? j : len - 1 - j)];
+            }
+        }
+
+        seq::NTSequence nts("", "", s);
+
+        for (int frame = 0; frame < 3 && (int)nts.size() - frame >= prot_k; ++frame) {
+            ProtKmerGenerator kmers(seq::AASequence::translate(nts.begin() + frame,
+                                    nts.begin() + frame + ((nts.size() - frame) / 3) * 3).asString(), prot_k / 3);
+
+            while (kmers.hasNext()) {
+                if (kmer_set.find(kmers.next()) != NULL) {
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+// call proc(canonical k-mer) for each k-mer of the read, stopping as soon as proc returns true
+template <typename KmerProc>
+static bool ForEachCanonicalKmer(SequencePackage &package, int64_t read_id, int k, KmerProc proc) {
+    int len = package.length(read_id);
+    uint64_t mask = k == 32 ? ~0ULL : (1ULL << (2 * k)) - 1;
+    uint64_t kmer = 0, rev_kmer = 0;
+
+    // the strand does not matter for canonical k-mers, so the stored orientation is used as is
+    for (int j = 0; j < len; ++j) {
+        uint64_t c = package.get_base(read_id, j);
+        kmer = ((kmer << 2) | c) & mask;
+        rev_kmer = (rev_kmer >> 2) | ((3 - c) << (2 * k - 2));
+
+        if (j >= k - 1 && proc(std::min(kmer, rev_kmer))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+struct KmerCollector {
+    std::vector<uint64_t> *kmers;
+    bool operator()(uint64_t kmer) {
+        kmers->push_back(kmer);
+        return false;
+    }
+};
+
+struct KmerFinder {
+    HashSetST<uint64_t> *kmer_set;
+    bool operator()(uint64_t kmer) {
+        return kmer_set->find(kmer) != NULL;
+    }
+};
+
+// keep the mate of each recruited read in PE libraries; returns the number of mates newly recruited
+static int64_t RecruitMates(std::vector<lib_info_t> &lib_info, std::vector<uint8_t> &recruited, uint8_t tag) {
+    int64_t num_mates = 0;
+
+    for (size_t l = 0; l < lib_info.size(); ++l) {
+        if (!lib_info[l].is_pe) {
+            continue;
+        }
+
+        for (int64_t i = lib_info[l].from; i + 1 <= lib_info[l].to; i += 2) {
+            if (recruited[i] && !recruited[i + 1]) {
+                recruited[i + 1] = tag;
+                ++num_mates;
+            }
+            else if (!recruited[i] && recruited[i + 1]) {
+                recruited[i] = tag;
+                ++num_mates;
+            }
+        }
+    }
+
+    return num_mates;
+}
+
+static void WriteRecruitedLibs(SequencePackage &package, std::vector<lib_info_t> &lib_info,
+                               std::vector<uint8_t> &recruited, const std::string &out_prefix) {
+    SequenceImageWriter image_writer(FormatString("%s.bin", out_prefix.c_str()), true);
+    FILE *lib_info_file = OpenFileAndCheck(FormatString("%s.lib_info", out_prefix.c_str()), "w");
+    SequencePackage batch;
+    std::vector<uint32_t> s;
+    std::vector<lib_info_t> out_info;
+    int64_t total_reads = 0;
+    int64_t total_bases = 0;
+
+    for (size_t l = 0; l < lib_info.size(); ++l) {
+        int64_t start = total_reads;
+        int max_read_len = 0;
+
+        for (int64_t i = lib_info[l].from; i <= lib_info[l].to; ++i) {
+            if (!recruited[i]) {
+                continue;
+            }
+
+            int len = package.length(i);
+            package.get_seq(s, i);
+            batch.AppendSeq(s.data(), len);
+            max_read_len = std::max(max_read_len, len);
+            total_bases += len;
+            ++total_reads;
+
+            if (batch.base_size() >= (1 << 28)) {
+                image_writer.Append(batch);
+                batch.clear();
+            }
+        }
+
+        out_info.push_back(lib_info_t(NULL, start, total_reads - 1, max_read_len, lib_info[l].is_pe, lib_info[l].metadata));
+    }
+
+    if (batch.size() > 0) {
+        image_writer.Append(batch);
+    }
+
+    image_writer.Close();
+    fprintf(lib_info_file, "%" PRId64 " %" PRId64 "\n", total_bases, total_reads);
+
+    for (size_t l = 0; l < out_info.size(); ++l) {
+        fprintf(lib_info_file, "%s\n", out_info[l].metadata.c_str());
+        fprintf(lib_info_file, "%" PRId64 " %" PRId64 " %d %s\n", out_info[l].from, out_info[l].to,
+                out_info[l].max_read_len, out_info[l].is_pe ? "pe" : "se");
+    }
+
+    fclose(lib_info_file);
+    xlog("Written %lld reads, %lld bases to %s.bin\n", (long long)total_reads, (long long)total_bases, out_prefix.c_str());
+}
+
+int recruit(int argc, char **argv) {
+    ParseRecruitOption(argc, argv);
+    ProtKmer::setUp();
+    NuclKmer::setUp();
+    omp_set_num_threads(opt.num_cpu_threads);
+
+    HashSetST<ProtKmer> prot_kmer_set;
+    LoadRefKmers(opt.gene_list, opt.prot_k, prot_kmer_set);
+    xlog("Reference protein k-mer set size: %lld\n", (long long)prot_kmer_set.size());
+
+    SequencePackage package;
+    std::vector<lib_info_t> lib_info;
+    bool is_reverse = true; // orientation of buildlib, so that the library is mapped directly
+    ReadBinaryLibs(opt.read_lib, package, lib_info, is_reverse);
+
+    int64_t num_reads = package.size();
+    // 0: not recruited; 1: protein k-mer hit; r + 1: recruited in the r-th round of expansion
+    std::vector<uint8_t> recruited(num_reads, 0);
+    int64_t num_recruited = 0;
+
+    #pragma omp parallel for schedule(dynamic, 1024) reduction(+:num_recruited)
+    for (int64_t i = 0; i < num_reads; ++i) {
+        if ((int)package.length(i) >= opt.prot_k) {
+            if (HasProtKmerHit(package, i, is_reverse, prot_kmer_set, opt.prot_k)) {
+                recruited[i] = 1;
+                ++num_recruited;
+            }
+        }
+    }
+
+    num_recruited += RecruitMates(lib_info, recruited, 1);
+    xlog("Protein k-mer hits: %lld reads (with mates) out of %lld\n", (long long)num_recruited, (long long)num_reads);
+
+    int max_rounds = std::min(opt.rounds, 254);
+
+    for (int round = 1; round <= max_rounds; ++round) {
+        // only the reads recruited in the last round can bring new k-mers: earlier reads' k-mers were already tried
+        std::vector<std::vector<uint64_t> > thread_kmers(opt.num_cpu_threads);
+
+        #pragma omp parallel for schedule(dynamic, 1024)
+        for (int64_t i = 0; i < num_reads; ++i) {
+            if (recruited[i] == round) {
+                KmerCollector collector = {&thread_kmers[omp_get_thread_num()]};
+                ForEachCanonicalKmer(package, i, opt.nucl_k, collector);
+            }
+        }
+
+        HashSetST<uint64_t> nucl_kmer_set;
+
+        for (int t = 0; t < opt.num_cpu_threads; ++t) {
+            for (size_t j = 0; j < thread_kmers[t].size(); ++j) {
+                nucl_kmer_set.insert(thread_kmers[t][j]);
+            }
+
+            std::vector<uint64_t>().swap(thread_kmers[t]);
+        }
+
+        int64_t num_new = 0;
+
+        #pragma omp parallel for schedule(dynamic, 1024) reduction(+:num_new)
+        for (int64_t i = 0; i < num_reads; ++i) {
+            if (!recruited[i]) {
+                KmerFinder finder = {&nucl_kmer_set};
+
+                if (ForEachCanonicalKmer(package, i, opt.nucl_k, finder)) {
+                    recruited[i] = round + 1;
+                    ++num_new;
+                }
+            }
+        }
+
+        num_new += RecruitMates(lib_info, recruited, round + 1);
+        num_recruited += num_new;
+        xlog("Round %d: %lld k-mers, %lld new reads, %lld recruited\n", round, (long long)nucl_kmer_set.size(),
+             (long long)num_new, (long long)num_recruited);
+
+        if (num_new == 0) {
+            break;
+        }
+    }
+
+    WriteRecruitedLibs(package, lib_info, recruited, opt.output_prefix);
+    return 0;
+}
@@ -5,8 +5,11 @@
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #include <string>
 #include <vector>
@@ -24,31 +27,110 @@ struct SdbgPartitionRecord {
     long long num_large_mul;
     long long num_last1;
     long long num_w[9];
+    long long compressed_size; // of the zlib block of the bucket, if compressed
 
     SdbgPartitionRecord(): thread_id(-1), starting_offset(0), num_items(0),
-        num_tips(0), num_large_mul(0), num_last1(0) {
+        num_tips(0), num_large_mul(0), num_last1(0), compressed_size(0) {
         memset(num_w, 0, sizeof(num_w));
     }
 };
 
 class SdbgWriter {
   private:
+    // each thread's output is gathered in an aligned buffer and written with pwrite at the thread's file offset;
+    // the size is a multiple of any direct I/O alignment, so every full-buffer write qualifies
+    static const int64_t kBufferSize = 1 << 22;
+    static const int64_t kBufferAlignment = 4096;
+
     std::string file_prefix_;
     int num_threads_;
     int num_buckets_;
 
-    std::vector<FILE *> files_;
+    std::vector<int> fds_;
+    std::vector<bool> fd_direct_; // opened with O_DIRECT; a file that does not support it falls back alone
+    std::vector<char *> buffers_;
+    std::vector<int64_t> buffer_used_;
     std::vector<int> cur_bucket_;
-    std::vector<int64_t> cur_thread_offset_;	// offset in BYTE
+    std::vector<int64_t> cur_thread_offset_;	// offset in BYTE, including the buffered bytes
     std::vector<SdbgPartitionRecord> p_rec_;
+    std::vector<std::vector<char> > bucket_data_; // the current bucket of each thread, if compressing
+    std::vector<std::vector<Bytef> > compressed_;
 
     bool is_opened_;
+    bool direct_io_;
+    int compress_level_;
     int kmer_size_;
     int words_per_tip_label_;
 
+    void flush_(int tid) {
+        char *data = buffers_[tid];
+        int64_t size = buffer_used_[tid];
+        int64_t offset = cur_thread_offset_[tid] - size;
+
+        while (size > 0) {
+            ssize_t num_written = pwrite(fds_[tid], data, size, offset);
+
+            if (num_written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                xerr_and_exit("Failed to write %s.sdbg.%d: %s\n", file_prefix_.c_str(), tid, strerror(errno));
+            }
+
+            data += num_written;
+            size -= num_written;
+            offset += num_written;
+        }
+
+        buffer_used_[tid] = 0;
+    }
+
+    void append_(int tid, const void *data, int64_t size) {
+        const char *src = (const char *)data;
+
+        while (size > 0) {
+            int64_t num_copy = std::min(size, kBufferSize - buffer_used_[tid]);
+            memcpy(buffers_[tid] + buffer_used_[tid], src, num_copy);
+            buffer_used_[tid] += num_copy;
+            cur_thread_offset_[tid] += num_copy;
+            src += num_copy;
+            size -= num_copy;
+
+            if (buffer_used_[tid] == kBufferSize) {
+                flush_(tid);
+            }
+        }
+    }
+
+    void put_(int tid, const void *data, int64_t size) {
+        if (compress_level_ > 0) {
+            bucket_data_[tid].insert(bucket_data_[tid].end(), (const char *)data, (const char *)data + size);
+        }
+        else {
+            append_(tid, data, size);
+        }
+    }
+
+    // writes the bucket gathered by thread tid as one zlib block
+    void compress_bucket_(int tid) {
+        std::vector<char> &data = bucket_data_[tid];
+        uLongf size = compressBound(data.size());
+        compressed_[tid].resize(size);
+
+        if (compress2(&compressed_[tid][0], &size, (const Bytef *)&data[0], data.size(), compress_level_) != Z_OK) {
+            xerr_and_exit("Failed to compress bucket %d of %s.sdbg.%d\n", cur_bucket_[tid], file_prefix_.c_str(), tid);
+        }
+
+        p_rec_[cur_bucket_[tid]].starting_offset = cur_thread_offset_[tid];
+        p_rec_[cur_bucket_[tid]].compressed_size = size;
+        append_(tid, &compressed_[tid][0], size);
+        data.clear();
+    }
+
   public:
 
-    SdbgWriter() {}
+    SdbgWriter(): is_opened_(false), direct_io_(false), compress_level_(0) {}
     ~SdbgWriter() {
         destroy();
     }
@@ -66,15 +148,54 @@ class SdbgWriter {
     void set_num_buckets(int num_buckets) {
         num_buckets_ = num_buckets;
     }
+    // bypass the page cache (O_DIRECT) where the file system supports it
+    void set_direct_io(bool direct_io) {
+        direct_io_ = direct_io;
+    }
+    // write each bucket as a zlib block of this level (1 to 9); 0 writes the raw items
+    void set_compress_level(int compress_level) {
+        compress_level_ = compress_level;
+    }
 
     void init_files() {
-        files_.resize(num_threads_);
+        fds_.resize(num_threads_);
+        fd_direct_.resize(num_threads_, false);
+        buffers_.resize(num_threads_);
+        buffer_used_.resize(num_threads_, 0);
         cur_bucket_.resize(num_threads_, -1);
         cur_thread_offset_.resize(num_threads_, 0);
         p_rec_.resize(num_buckets_);
+        bucket_data_.resize(num_threads_);
+        compressed_.resize(num_threads_);
 
         for (int i = 0; i < num_threads_; ++i) {
-            files_[i] = OpenFileAndCheck(FormatString("%s.sdbg.%d", file_prefix_.c_str(), i), "wb");
+            std::string file_name = FormatString("%s.sdbg.%d", file_prefix_.c_str(), i);
+            fds_[i] = -1;
+
+#ifdef O_DIRECT
+            if (direct_io_) {
+                fds_[i] = open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+
+                if (fds_[i] != -1) {
+                    fd_direct_[i] = true;
+                }
+                else {
+                    xwarning("Direct I/O not supported for %s, fall back to buffered I/O\n", file_name.c_str());
+                }
+            }
+#endif
+
+            if (fds_[i] == -1) {
+                fds_[i] = open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            }
+
+            if (fds_[i] == -1) {
+                xerr_and_exit("Cannot open %s: %s\n", file_name.c_str(), strerror(errno));
+            }
+
+            if (posix_memalign((void **)&buffers_[i], kBufferAlignment, kBufferSize) != 0) {
+                xerr_and_exit("Cannot allocate output buffer for %s\n", file_name.c_str());
+            }
         }
 
         is_opened_ = true;
@@ -84,6 +205,10 @@ class SdbgWriter {
         assert(tid < num_threads_);
 
         if (bucket != cur_bucket_[tid]) {
+            if (compress_level_ > 0 && cur_bucket_[tid] != -1) {
+                compress_bucket_(tid);
+            }
+
             cur_bucket_[tid] = bucket;
             assert(p_rec_[bucket].thread_id == -1);
             p_rec_[bucket].thread_id = tid;
@@ -91,23 +216,19 @@ class SdbgWriter {
         }
 
         uint16_t packed_sdbg_item = w | (last << 4) | (tip << 5) | (std::min(multiplicity, (multi_t)kMulti2Sp) << 8);
-        fwrite(&packed_sdbg_item, sizeof(uint16_t), 1, files_[tid]);
+        put_(tid, &packed_sdbg_item, sizeof(uint16_t));
         ++p_rec_[bucket].num_items;
         ++p_rec_[bucket].num_w[w];
         p_rec_[bucket].num_last1 += last;
-        cur_thread_offset_[tid] += sizeof(uint16_t);
 
         if (multiplicity > kMaxMulti2_t) {
-            fwrite(&multiplicity, sizeof(multi_t), 1, files_[tid]);
-            multiplicity = kMulti2Sp;
+            put_(tid, &multiplicity, sizeof(multi_t));
             ++p_rec_[bucket].num_large_mul;
-            cur_thread_offset_[tid] += sizeof(multi_t);
         }
 
         if (tip) {
-            fwrite(packed_tip_label, sizeof(uint32_t), words_per_tip_label_, files_[tid]);
+            put_(tid, packed_tip_label, sizeof(uint32_t) * words_per_tip_label_);
             ++p_rec_[bucket].num_tips;
-            cur_thread_offset_[tid] += sizeof(uint32_t) * words_per_tip_label_;
         }
     }
 
@@ -154,7 +275,19 @@ class SdbgWriter {
     void destroy() {
         if (is_opened_) {
             for (int i = 0; i < num_threads_; ++i) {
-                fclose(files_[i]);
+                if (compress_level_ > 0 && cur_bucket_[i] != -1) {
+                    compress_bucket_(i);
+                }
+
+#ifdef O_DIRECT
+                if (fd_direct_[i]) {
+                    // the tail is not a multiple of the alignment
+                    fcntl(fds_[i], F_SETFL, fcntl(fds_[i], F_GETFL) & ~O_DIRECT);
+                }
+#endif
+                flush_(i);
+                close(fds_[i]);
+                free(buffers_[i]);
             }
 
             FILE *sdbg_info = OpenFileAndCheck((file_prefix_ + ".sdbg_info").c_str(), "w");
@@ -177,21 +310,37 @@ class SdbgWriter {
             fprintf(sdbg_info, "num_tips %lld\n", (long long)total_tips);
             fprintf(sdbg_info, "large_multi %lld\n", (long long)total_large_mul);
 
+            if (compress_level_ > 0) {
+                fprintf(sdbg_info, "compression zlib\n");
+            }
+
             for (int i = 0; i < num_buckets_; ++i) {
-                fprintf(sdbg_info, "%d %d %lld %lld %lld %lld\n", i,
+                fprintf(sdbg_info, "%d %d %lld %lld %lld %lld", i,
                         p_rec_[i].thread_id,
                         (long long)p_rec_[i].starting_offset,
                         (long long)p_rec_[i].num_items,
                         (long long)p_rec_[i].num_tips,
                         (long long)p_rec_[i].num_large_mul);
+
+                // the size of the block, so that a reader can decode the buckets independently
+                if (compress_level_ > 0) {
+                    fprintf(sdbg_info, " %lld", (long long)p_rec_[i].compressed_size);
+                }
+
+                fprintf(sdbg_info, "\n");
             }
 
             fclose(sdbg_info);
 
-            files_.clear();
+            fds_.clear();
+            fd_direct_.clear();
+            buffers_.clear();
+            buffer_used_.clear();
             cur_bucket_.clear();
             cur_thread_offset_.clear();	// offset in BYTE
             p_rec_.clear();
+            bucket_data_.clear();
+            compressed_.clear();
 
             is_opened_ = false;
         }
@@ -200,6 +349,8 @@ class SdbgWriter {
 
 class SdbgReader {
   private:
+    static const int64_t kDecodeBatchSize = 1 << 24; // bytes of buckets decoded in parallel at a time
+
     std::string file_prefix_;
     int kmer_size_;
     int words_per_tip_label_;
@@ -226,10 +377,67 @@ class SdbgReader {
     long page_size_;
     int64_t mmap_size_;
 
+    bool is_compressed_;
+    int batch_start_bucket_;
+    int batch_end_bucket_;
+    std::vector<std::vector<char> > decoded_; // the buckets of the current batch, if compressed
+
     bool is_opened_;
 
+    int64_t bucket_bytes_(int bucket) const {
+        return p_rec_[bucket].num_items * sizeof(uint16_t) +
+               p_rec_[bucket].num_tips * sizeof(uint32_t) * words_per_tip_label_ +
+               p_rec_[bucket].num_large_mul * sizeof(multi_t);
+    }
+
+    void decode_bucket_(int bucket, std::vector<char> &decoded) {
+        const SdbgPartitionRecord &rec = p_rec_[bucket];
+        std::vector<Bytef> block(rec.compressed_size);
+        int64_t num_read = 0;
+
+        while (num_read < rec.compressed_size) {
+            ssize_t ret = pread(fds_[rec.thread_id], &block[num_read], rec.compressed_size - num_read, rec.starting_offset + num_read);
+
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (ret <= 0) {
+                xerr_and_exit("Failed to read bucket %d of %s.sdbg.%d\n", bucket, file_prefix_.c_str(), rec.thread_id);
+            }
+
+            num_read += ret;
+        }
+
+        decoded.resize(bucket_bytes_(bucket));
+        uLongf size = decoded.size();
+
+        if (uncompress((Bytef *)&decoded[0], &size, &block[0], block.size()) != Z_OK || size != decoded.size()) {
+            xerr_and_exit("Bucket %d of %s.sdbg.%d is corrupted\n", bucket, file_prefix_.c_str(), rec.thread_id);
+        }
+    }
+
+    // decodes the non-empty buckets from start_bucket on, about kDecodeBatchSize bytes, across threads
+    void decode_batch_(int start_bucket) {
+        int64_t batch_size = 0;
+        batch_start_bucket_ = batch_end_bucket_ = start_bucket;
+
+        while (batch_end_bucket_ < num_buckets_ && (batch_size < kDecodeBatchSize || batch_end_bucket_ == start_bucket)) {
+            batch_size += bucket_bytes_(batch_end_bucket_++);
+        }
+
+        decoded_.resize(batch_end_bucket_ - batch_start_bucket_);
+
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (int b = batch_start_bucket_; b < batch_end_bucket_; ++b) {
+            if (p_rec_[b].thread_id != -1) {
+                decode_bucket_(b, decoded_[b - batch_start_bucket_]);
+            }
+        }
+    }
+
   public:
-    SdbgReader(): is_opened_(false) {}
+    SdbgReader(): is_compressed_(false), is_opened_(false) {}
     ~SdbgReader() {
         destroy();
     }
@@ -248,6 +456,13 @@ class SdbgReader {
         assert(fscanf(sdbg_info, "num_tips %lld\n", &num_tips_) == 1);
         assert(fscanf(sdbg_info, "large_multi %lld\n", &num_large_mul_) == 1);
 
+        char compression[16];
+        is_compressed_ = fscanf(sdbg_info, "compression %15s\n", compression) == 1;
+
+        if (is_compressed_ && strcmp(compression, "zlib") != 0) {
+            xerr_and_exit("Unknown compression of %s.sdbg: %s\n", file_prefix_.c_str(), compression);
+        }
+
         p_rec_.resize(num_buckets_);
         file_sizes_.resize(num_files_, 0);
         long long acc = 0;
@@ -262,7 +477,14 @@ class SdbgReader {
                           &p_rec_[i].num_items,
                           &p_rec_[i].num_tips,
                           &p_rec_[i].num_large_mul) == 6);
-            file_sizes_[p_rec_[i].thread_id] += p_rec_[i].num_items * sizeof(uint16_t) + p_rec_[i].num_tips * sizeof(uint32_t) * words_per_tip_label_ + p_rec_[i].num_large_mul * sizeof(multi_t);
+
+            if (is_compressed_) {
+                assert(fscanf(sdbg_info, "%lld\n", &p_rec_[i].compressed_size) == 1);
+            }
+
+            if (p_rec_[i].thread_id != -1) {
+                file_sizes_[p_rec_[i].thread_id] += is_compressed_ ? p_rec_[i].compressed_size : bucket_bytes_(i);
+            }
             acc += p_rec_[i].num_items;
             f_[i / (num_buckets_ / 4) + 2] = acc;
         }
@@ -301,6 +523,9 @@ class SdbgReader {
     int words_per_tip_label() const {
         return words_per_tip_label_;
     }
+    int num_buckets() const {
+        return num_buckets_;
+    }
     int prefix_lkt_len() const {
         return pre_lkt_len_;
     }
@@ -337,6 +562,7 @@ class SdbgReader {
         }
 
         cur_bucket_ = -1;
+        batch_start_bucket_ = batch_end_bucket_ = 0;
         cur_bucket_cnt_ = 0;
         cur_vol_ = 0;
         mmap_ = NULL;
@@ -361,23 +587,30 @@ class SdbgReader {
                 return false;
             }
 
+            cur_vol_ = p_rec_[cur_bucket_].num_items;
+
+            if (is_compressed_) {
+                if (cur_bucket_ >= batch_end_bucket_) {
+                    decode_batch_(cur_bucket_);
+                }
+
+                cur_bucket_ptr_ = &decoded_[cur_bucket_ - batch_start_bucket_][0];
+                continue;
+            }
+
             if (mmap_) {
                 munmap(mmap_, mmap_size_);
                 mmap_ = NULL;
             }
 
             int64_t offset = p_rec_[cur_bucket_].starting_offset / page_size_ * page_size_;
-            mmap_size_ = p_rec_[cur_bucket_].num_items * sizeof(uint16_t) +
-                         p_rec_[cur_bucket_].num_tips * sizeof(uint32_t) * words_per_tip_label_ +
-                         p_rec_[cur_bucket_].num_large_mul * sizeof(multi_t);
-            mmap_size_ += p_rec_[cur_bucket_].starting_offset - offset;
+            mmap_size_ = bucket_bytes_(cur_bucket_) + p_rec_[cur_bucket_].starting_offset - offset;
 
             mmap_ = mmap(NULL, mmap_size_, PROT_READ, MAP_PRIVATE, fds_[p_rec_[cur_bucket_].thread_id], offset);
             assert(mmap_ != NULL);
             madvise(mmap_, mmap_size_, MADV_SEQUENTIAL);
 
             cur_bucket_ptr_ = (char *)mmap_ + p_rec_[cur_bucket_].starting_offset - offset;
-            cur_vol_ = p_rec_[cur_bucket_].num_items;
         }
 
         ++cur_bucket_cnt_;
@@ -410,6 +643,7 @@ class SdbgReader {
 
             file_sizes_.clear();
             fds_.clear();
+            decoded_.clear();
 
             is_opened_ = false;
         }
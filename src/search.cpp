@@ -4,6 +4,7 @@
 #include "most_probable_path.h"
 #include "hmmer3b_parser.h"
 #include "succinct_dbg.h"
+#include "numa_policy.h"
 #include "utils.h"
 
 #include <fstream>
@@ -70,7 +71,8 @@ void pruneLowDepthPath(SuccinctDBG &dbg) {
 
 int search(int argc, char **argv) {
     if (argc < 7) {
-        fprintf(stderr, "Usage: %s <succinct_dbg> <gene_list> <starting_kmers_prefix> <output_prefix> <prune_len> <low_cov_penalty> [num_threads=0]\n", argv[0]);
+        fprintf(stderr, "Usage: %s <succinct_dbg> <gene_list> <starting_kmers_prefix> <output_prefix> <prune_len> <low_cov_penalty> [num_threads=0] [cov_weight=0] [invalid_mask] [numa=0]\n"
+                "    numa=1 interleaves the SdBG over the NUMA nodes, so that no socket serves all the lookups\n", argv[0]);
         exit(1);
     }
 
@@ -80,6 +82,20 @@ int search(int argc, char **argv) {
         num_threads = atoi(argv[7]);
     }
 
+    double cov_weight = 0; // weight of the graded log-coverage score of codons, 0 to disable
+
+    if (argc > 8) {
+        cov_weight = atof(argv[8]);
+    }
+
+    const char *invalid_mask = NULL; // edges removed by denovo --mask_only, not to be explored
+
+    if (argc > 9 && argv[9][0] != '\0') { // "" for none, to give the numa flag alone
+        invalid_mask = argv[9];
+    }
+
+    bool numa_interleave = argc > 10 && atoi(argv[10]) != 0;
+
     if (num_threads == 0) {
         num_threads = omp_get_max_threads();
     }
@@ -95,7 +111,30 @@ int search(int argc, char **argv) {
     timer.start();
     SuccinctDBG dbg;
     xlog("Loading SdBG...\n");
-    dbg.LoadFromMultiFile(argv[1], false);
+
+    // the loading thread touches the SdBG first; without interleaving all its pages would sit on one node
+    if (numa_interleave) {
+        int num_nodes = NumaMemPolicy::InterleaveMemPolicy();
+
+        if (num_nodes > 0) {
+            xlog("Interleaving the SdBG over %d NUMA nodes\n", num_nodes);
+        }
+        else {
+            xwarning("NUMA interleaving not available, the SdBG is loaded with the default policy\n");
+        }
+    }
+
+    dbg.LoadFromMultiFile(argv[1], false, invalid_mask);
+
+    if (numa_interleave) {
+        // the policy is per thread, and the OpenMP workers that decode a compressed SdBG are created under it;
+        // reset the whole team so that the search pools stay local to their threads
+        #pragma omp parallel
+        {
+            NumaMemPolicy::DefaultMemPolicy();
+        }
+    }
+
     timer.stop();
     xlog("Done! Time elapsed: %.4lf\n", timer.elapsed());
 
@@ -171,8 +210,8 @@ int search(int argc, char **argv) {
 
         for (int i = 0; i < num_threads; ++i) {
             search.push_back(HMMGraphSearch(heuristic_pruning));
-            for_node_enumerator.push_back(NodeEnumerator(forward_hmm, for_hcost, low_cov_penalty));
-            rev_node_enumerator.push_back(NodeEnumerator(reverse_hmm, rev_hcost, low_cov_penalty));
+            for_node_enumerator.push_back(NodeEnumerator(forward_hmm, for_hcost, low_cov_penalty, cov_weight));
+            rev_node_enumerator.push_back(NodeEnumerator(reverse_hmm, rev_hcost, low_cov_penalty, cov_weight));
         }
 
         for (int i = 0; i < num_threads; ++i) {
@@ -191,7 +230,14 @@ int search(int argc, char **argv) {
         fclose(out_file);
 
         timer.stop();
-        xlog("Done %s: time %.4lf\n", gene[0].c_str(), timer.elapsed());
+        int64_t num_expanded = 0;
+
+        for (int i = 0; i < num_threads; ++i) {
+            num_expanded += search[i].num_expanded();
+        }
+
+        xlog("Done %s: time %.4lf, %lld A* nodes expanded, %.0f per second\n", gene[0].c_str(), timer.elapsed(),
+             (long long)num_expanded, num_expanded / std::max(timer.elapsed(), 1e-6));
     }
 
     return 0;
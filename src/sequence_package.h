@@ -22,13 +22,42 @@
 #define SEQUENCE_PACKAGE_H__
 
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <vector>
 
 #include "bit_operation.h"
+#include "elias_fano.h"
+#include "utils.h"
+
+/**
+ * @brief on-disk header of a versioned .bin read library
+ * the header is followed by the packed words, the serialized start_idx_ (EliasFano) and pos_to_id_ of the sequences,
+ * each section starting at a multiple of kImageAlign so that it can be mmapped in place
+ */
+struct SequenceImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t is_reverse;
+    uint64_t num_seq;
+    uint64_t num_bases;
+    uint64_t num_words;
+    uint64_t num_lookup;
+    uint64_t max_read_len;
+    uint64_t seq_offset;
+    uint64_t start_idx_offset;
+    uint64_t lookup_offset;
+};
 
 /**
  * @brief hold a set of sequences
+ * the first view_num_seq_ sequences may be a read-only view of a mmapped image (see MapImage),
+ * sequences appended afterwards are kept in packed_seq/start_idx_ and start from a fresh word
  */
 
 struct SequencePackage {
@@ -39,7 +68,13 @@ struct SequencePackage {
     char dna_map_[256];
 
     std::vector<word_t> packed_seq; // packed all
-    std::vector<uint64_t> start_idx_; // the index of the starting position of a sequence
+    // the starting positions of the variable-length sequences followed by the end of the last one,
+    // empty until the first of them is appended; relative to var_begin_, where they start, so that
+    // a few sequences appended to a large view do not pay for the high bits of the view's offsets
+    EliasFano start_idx_;
+    uint64_t var_begin_;
+    size_t reserved_seq_;
+    size_t reserved_bases_;
 
     uint8_t unused_bits_; // the number of unused bits in the last word
     int max_read_len_;
@@ -54,8 +89,30 @@ struct SequencePackage {
     std::vector<uint64_t> pos_to_id_;
     const static int kLookupStep = 1024;
 
+    // read-only view of a mmapped image
+    const static int kImageVersion = 2;
+    const static uint64_t kImageAlign = 4096;
+    void *image_map_;
+    size_t image_map_size_;
+    const word_t *view_seq_;
+    EliasFano view_start_idx_;
+    const uint64_t *view_pos_to_id_;
+    size_t view_num_seq_;
+    size_t view_num_words_;
+    bool view_is_reverse_;
+
     SequencePackage() {
-        start_idx_.push_back(0);
+        image_map_ = NULL;
+        image_map_size_ = 0;
+        view_seq_ = NULL;
+        view_pos_to_id_ = NULL;
+        view_num_seq_ = 0;
+        view_num_words_ = 0;
+        view_is_reverse_ = false;
+
+        var_begin_ = 0;
+        reserved_seq_ = 0;
+        reserved_bases_ = 0;
         packed_seq.push_back(word_t(0));
         unused_bits_ = kBitsPerWord;
         max_read_len_ = 0;
@@ -69,13 +126,118 @@ struct SequencePackage {
         }
     }
 
-    ~SequencePackage() {}
+    ~SequencePackage() {
+        UnmapImage_();
+    }
+
+    static const char *ImageMagic() {
+        return "MGTABIN";
+    }
+
+    /**
+     * @brief read the header of a .bin file
+     * @return the version of the image, 0 for the legacy (length, words) stream, -1 if the file cannot be opened
+     */
+    static int ReadImageHeader(const char *file_name, SequenceImageHeader &header) {
+        FILE *fp = fopen(file_name, "rb");
+
+        if (fp == NULL) {
+            return -1;
+        }
+
+        int version = 0;
+
+        if (fread(&header, sizeof(header), 1, fp) == 1 && memcmp(header.magic, ImageMagic(), sizeof(header.magic)) == 0) {
+            version = header.version;
+        }
+
+        fclose(fp);
+        return version;
+    }
+
+    /**
+     * @brief replace the content by a read-only view of the image file_name
+     * @return false if the file is not a valid image of kImageVersion
+     */
+    bool MapImage(const char *file_name) {
+        clear();
+        int fd = open(file_name, O_RDONLY);
+
+        if (fd == -1) {
+            return false;
+        }
+
+        struct stat file_stat;
+
+        if (fstat(fd, &file_stat) != 0 || file_stat.st_size < (off_t)sizeof(SequenceImageHeader)) {
+            close(fd);
+            return false;
+        }
+
+        void *map = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (map == MAP_FAILED) {
+            return false;
+        }
+
+        const SequenceImageHeader *header = (const SequenceImageHeader *)map;
+
+        if (memcmp(header->magic, ImageMagic(), sizeof(header->magic)) != 0 || header->version != (uint32_t)kImageVersion ||
+                header->lookup_offset + header->num_lookup * sizeof(uint64_t) > (uint64_t)file_stat.st_size ||
+                view_start_idx_.Attach((const uint64_t *)((const char *)map + header->start_idx_offset),
+                                       (header->lookup_offset - header->start_idx_offset) / sizeof(uint64_t)) == 0 ||
+                view_start_idx_.size() != header->num_seq + 1) {
+            view_start_idx_.clear();
+            munmap(map, file_stat.st_size);
+            return false;
+        }
+
+        image_map_ = map;
+        image_map_size_ = file_stat.st_size;
+        view_seq_ = (const word_t *)((const char *)map + header->seq_offset);
+        view_pos_to_id_ = (const uint64_t *)((const char *)map + header->lookup_offset);
+        view_num_seq_ = header->num_seq;
+        view_num_words_ = header->num_words;
+        view_is_reverse_ = header->is_reverse;
+        max_read_len_ = header->max_read_len;
+
+        // appended sequences never share a word with the view
+        var_begin_ = view_num_words_ * kCharsPerWord;
+        fixed_len_sealed_ = true;
+        return true;
+    }
+
+    bool is_view() {
+        return image_map_ != NULL;
+    }
+
+    bool view_is_reverse() {
+        return view_is_reverse_;
+    }
+
+    void UnmapImage_() {
+        if (image_map_ != NULL) {
+            munmap(image_map_, image_map_size_);
+        }
+
+        image_map_ = NULL;
+        image_map_size_ = 0;
+        view_seq_ = NULL;
+        view_start_idx_.clear();
+        view_pos_to_id_ = NULL;
+        view_num_seq_ = 0;
+        view_num_words_ = 0;
+        view_is_reverse_ = false;
+    }
 
     void clear() {
+        UnmapImage_();
         packed_seq.clear();
         packed_seq.push_back(word_t(0));
         start_idx_.clear();
-        start_idx_.push_back(0);
+        var_begin_ = 0;
+        SetOffsetLowBits_();
         pos_to_id_.clear();
         unused_bits_ = kBitsPerWord;
         max_read_len_ = 0;
@@ -85,16 +247,31 @@ struct SequencePackage {
         fixed_len_sealed_ = false;
     }
 
-    size_t size() {
-        return num_fixed_len_items_ + start_idx_.size() - 1;
+    size_t size() const {
+        return view_num_seq_ + num_fixed_len_items_ + num_var_items_();
+    }
+
+    size_t num_var_items_() const {
+        return start_idx_.size() == 0 ? 0 : start_idx_.size() - 1;
+    }
+
+    // end of the appended sequences
+    uint64_t end_() {
+        return start_idx_.size() == 0 ? var_begin_ : var_begin_ + start_idx_.back();
     }
 
     size_t base_size() {
-        return start_idx_.back();
+        if (view_num_seq_ > 0 && size() == view_num_seq_) {
+            return view_start_idx_.back();
+        }
+
+        return end_();
     }
 
+    // mapped pages are counted as well since they are resident once touched
     size_t size_in_byte() {
-        return sizeof(word_t) * packed_seq.capacity() + sizeof(uint64_t) * start_idx_.capacity() + sizeof(uint64_t) * pos_to_id_.capacity();
+        return sizeof(word_t) * packed_seq.capacity() + start_idx_.size_in_byte() + sizeof(uint64_t) * pos_to_id_.capacity()
+               + image_map_size_;
     }
 
     size_t max_read_len() {
@@ -108,32 +285,95 @@ struct SequencePackage {
 
     void reserve_bases(size_t num_bases) {
         packed_seq.reserve((num_bases + kCharsPerWord) / kCharsPerWord);
+        reserved_bases_ = num_bases;
+        SetOffsetLowBits_();
     }
 
     void reserve_num_seq(size_t num_seq) {
+        reserved_seq_ = num_seq;
+        SetOffsetLowBits_();
         start_idx_.reserve(num_seq + 1);
     }
 
-    size_t length(size_t seq_id) {
+    // the reserved sizes tell the average length, which decides the low bits of start_idx_
+    void SetOffsetLowBits_() {
+        if (start_idx_.size() == 0 && reserved_seq_ > 0 && reserved_bases_ > 0) {
+            start_idx_.set_low_bits(EliasFano::OptimalLowBits(reserved_bases_, reserved_seq_ + 1));
+        }
+    }
+
+    size_t length(size_t seq_id) const {
+        uint64_t begin, end;
+
+        if (seq_id < view_num_seq_) {
+            view_start_idx_.get_pair(seq_id, begin, end);
+            return end - begin;
+        }
+
+        seq_id -= view_num_seq_;
+
         if (seq_id < num_fixed_len_items_) {
             return fixed_len_;
         }
         else {
-            return start_idx_[seq_id - num_fixed_len_items_ + 1] - start_idx_[seq_id - num_fixed_len_items_];
+            start_idx_.get_pair(seq_id - num_fixed_len_items_, begin, end);
+            return end - begin;
+        }
+    }
+
+    // [start_index, end_index) of a sequence with a single select, for the loops over consecutive sequences
+    void get_range(size_t seq_id, uint64_t &start_index, uint64_t &end_index) const {
+        if (seq_id < view_num_seq_) {
+            view_start_idx_.get_pair(seq_id, start_index, end_index);
+            return;
+        }
+
+        seq_id -= view_num_seq_;
+
+        if (seq_id < num_fixed_len_items_) {
+            start_index = seq_id * fixed_len_;
+            end_index = start_index + fixed_len_;
+        }
+        else {
+            start_idx_.get_pair(seq_id - num_fixed_len_items_, start_index, end_index);
+            start_index += var_begin_;
+            end_index += var_begin_;
         }
     }
 
-    uint8_t get_base(size_t seq_id, size_t offset) {
-        uint64_t where = get_start_index(seq_id) + offset;
-        return packed_seq[where / kCharsPerWord] >> (kCharsPerWord - 1 - where % kCharsPerWord) * 2 & 3;
+    uint8_t get_base(size_t seq_id, size_t offset) const {
+        return get_base_at(get_start_index(seq_id) + offset);
+    }
+
+    // base at an absolute position, cheaper than get_base if the start index of the sequence is known
+    uint8_t get_base_at(uint64_t where) const {
+        return get_word(where / kCharsPerWord) >> (kCharsPerWord - 1 - where % kCharsPerWord) * 2 & 3;
+    }
+
+    word_t get_word(size_t word_idx) const {
+        return word_idx < view_num_words_ ? view_seq_[word_idx] : packed_seq[word_idx - view_num_words_];
     }
 
-    uint64_t get_start_index(size_t seq_id) {
+    /**
+     * @brief pointer to the word_idx-th packed word, valid for all words of the sequence containing it
+     * read-only, as the words of the view are a PROT_READ mapping
+     */
+    const word_t *get_word_ptr(size_t word_idx) const {
+        return word_idx < view_num_words_ ? view_seq_ + word_idx : &packed_seq[word_idx - view_num_words_];
+    }
+
+    uint64_t get_start_index(size_t seq_id) const {
+        if (seq_id < view_num_seq_) {
+            return view_start_idx_[seq_id];
+        }
+
+        seq_id -= view_num_seq_;
+
         if (seq_id < num_fixed_len_items_) {
             return seq_id * fixed_len_;
         }
         else {
-            return start_idx_[seq_id - num_fixed_len_items_];
+            return var_begin_ + start_idx_[seq_id - num_fixed_len_items_];
         }
     }
 
@@ -142,14 +382,16 @@ struct SequencePackage {
         fixed_len_ = len;
     }
 
+    // only the appended part needs a lookup, the view carries its own
     void BuildLookup() {
+        size_t first_id = view_num_seq_ + num_fixed_len_items_;
         pos_to_id_.clear();
-        pos_to_id_.reserve(start_idx_.back() / kLookupStep + 4);
-        size_t abs_offset = num_fixed_len_items_ * fixed_len_;
-        size_t cur_id = num_fixed_len_items_;
+        pos_to_id_.reserve((end_() - var_begin_) / kLookupStep + 4);
+        size_t abs_offset = var_begin_;
+        size_t cur_id = first_id;
 
-        while (abs_offset <= start_idx_.back()) {
-            while (cur_id < size() && start_idx_[cur_id - num_fixed_len_items_ + 1] <= abs_offset) {
+        while (abs_offset <= end_()) {
+            while (cur_id < size() && var_begin_ + start_idx_[cur_id - first_id + 1] <= abs_offset) {
                 ++cur_id;
             }
 
@@ -162,38 +404,58 @@ struct SequencePackage {
     }
 
     uint64_t get_id(size_t abs_offset) {
-        if (abs_offset < num_fixed_len_items_ * fixed_len_) {
-            return abs_offset / fixed_len_;
-        }
-        else {
-            size_t look_up_entry = (abs_offset - num_fixed_len_items_ * fixed_len_) / kLookupStep;
-            size_t l = pos_to_id_[look_up_entry], r = pos_to_id_[look_up_entry + 1];
+        uint64_t start_index, end_index;
+        return get_id(abs_offset, start_index, end_index);
+    }
 
-            while (l < r) {
-                size_t mid = (l + r) / 2;
+    /**
+     * @brief also returns the [start_index, end_index) range of the read, which comes for free with the lookup
+     */
+    uint64_t get_id(size_t abs_offset, uint64_t &start_index, uint64_t &end_index) {
+        if (abs_offset < view_num_words_ * kCharsPerWord) {
+            if (UNLIKELY(abs_offset >= view_start_idx_.back())) {
+                xerr_and_exit("Offset %llu is beyond the %llu bases of the mapped sequences\n", (unsigned long long)abs_offset,
+                              (unsigned long long)view_start_idx_.back());
+            }
 
-                if (start_idx_[mid - num_fixed_len_items_] > abs_offset) {
-                    r = mid - 1;
-                }
-                else if (start_idx_[mid - num_fixed_len_items_ + 1] <= abs_offset) {
-                    l = mid + 1;
-                }
-                else {
-                    return mid;
-                }
+            return LookupId_(abs_offset, view_pos_to_id_, view_start_idx_, 0, 0, start_index, end_index);
+        }
+        else if (abs_offset < view_num_words_ * kCharsPerWord + num_fixed_len_items_ * fixed_len_) {
+            uint64_t fixed_begin = view_num_words_ * kCharsPerWord;
+            uint64_t id = (abs_offset - fixed_begin) / fixed_len_;
+            start_index = fixed_begin + id * fixed_len_;
+            end_index = start_index + fixed_len_;
+            return view_num_seq_ + id;
+        }
+        else {
+            if (UNLIKELY(abs_offset >= end_() || pos_to_id_.empty())) {
+                xerr_and_exit("Offset %llu is beyond the %llu bases of the sequences, or BuildLookup() was not called\n",
+                              (unsigned long long)abs_offset, (unsigned long long)end_());
             }
 
-            return l;
+            return LookupId_(abs_offset, &pos_to_id_[0], start_idx_, var_begin_, view_num_seq_ + num_fixed_len_items_,
+                             start_index, end_index);
         }
     }
 
+    uint64_t LookupId_(size_t abs_offset, const uint64_t *pos_to_id, const EliasFano &start_idx, size_t first_offset,
+                       size_t first_id, uint64_t &start_index, uint64_t &end_index) {
+        size_t look_up_entry = (abs_offset - first_offset) / kLookupStep;
+        // the read covering the entry starts no later than abs_offset, and few reads follow it within a step;
+        // start_idx holds the offsets relative to first_offset
+        size_t id = first_id + start_idx.Locate(pos_to_id[look_up_entry] - first_id, abs_offset - first_offset, start_index, end_index);
+        start_index += first_offset;
+        end_index += first_offset;
+        return id;
+    }
+
     void AppendFixedLenSeq(const char *s, int len) {
         assert(len == fixed_len_);
         assert(!fixed_len_sealed_);
 
         AddSeqToPackedSeq_(s, len);
         ++num_fixed_len_items_;
-        start_idx_.back() += len;
+        var_begin_ += len;
     }
 
     void AppendFixedLenRevSeq(const char *s, int len) {
@@ -202,7 +464,7 @@ struct SequencePackage {
 
         AddRevSeqToPackedSeq_(s, len);
         ++num_fixed_len_items_;
-        start_idx_.back() += len;
+        var_begin_ += len;
     }
 
     void AppendFixedLenSeq(const word_t *s, int len) {
@@ -211,7 +473,7 @@ struct SequencePackage {
 
         AddSeqToPackedSeq_(s, len);
         ++num_fixed_len_items_;
-        start_idx_.back() += len;
+        var_begin_ += len;
     }
 
     void AppendFixedLenRevSeq(const word_t *s, int len) {
@@ -220,35 +482,41 @@ struct SequencePackage {
 
         AddRevSeqToPackedSeq_(s, len);
         ++num_fixed_len_items_;
-        start_idx_.back() += len;
+        var_begin_ += len;
     }
 
     void AppendSeq(const char *s, int len) {
         fixed_len_sealed_ = true;
         AddSeqToPackedSeq_(s, len);
-        uint64_t end = start_idx_.back() + len;
-        start_idx_.push_back(end);
+        PushEnd_(len);
     }
 
     void AppendReverseSeq(const char *s, int len) {
         fixed_len_sealed_ = true;
         AddRevSeqToPackedSeq_(s, len);
-        uint64_t end = start_idx_.back() + len;
-        start_idx_.push_back(end);
+        PushEnd_(len);
     }
 
     void AppendSeq(const word_t *s, int len) {
         fixed_len_sealed_ = true;
         AddSeqToPackedSeq_(s, len);
-        uint64_t end = start_idx_.back() + len;
-        start_idx_.push_back(end);
+        PushEnd_(len);
     }
 
     void AppendRevSeq(const word_t *s, int len) {
         fixed_len_sealed_ = true;
         AddRevSeqToPackedSeq_(s, len);
-        uint64_t end = start_idx_.back() + len;
-        start_idx_.push_back(end);
+        PushEnd_(len);
+    }
+
+    void PushEnd_(int len) {
+        uint64_t end = end_() + len;
+
+        if (start_idx_.size() == 0) {
+            start_idx_.push_back(0);
+        }
+
+        start_idx_.push_back(end - var_begin_);
     }
 
     void AddSeqToPackedSeq_(const char *s, int len) {
@@ -325,7 +593,7 @@ struct SequencePackage {
                 }
             }
 
-            int bits_in_last_word = (start_idx_.back() + len) % kCharsPerWord * 2;
+            int bits_in_last_word = (end_() + len) % kCharsPerWord * 2;
             unused_bits_ = kBitsPerWord - bits_in_last_word;
 
             if (unused_bits_ == kBitsPerWord) {
@@ -383,16 +651,16 @@ struct SequencePackage {
 
         if (first_shift == 0) {
             for (size_t i = first_word; i <= last_word; ++i) {
-                s.push_back(packed_seq[i]);
+                s.push_back(get_word(i));
             }
         }
         else {
             for (size_t i = first_word; i < last_word; ++i) {
-                s.push_back((packed_seq[i] << first_shift) | (packed_seq[i + 1] >> (kBitsPerWord - first_shift)));
+                s.push_back((get_word(i) << first_shift) | (get_word(i + 1) >> (kBitsPerWord - first_shift)));
             }
 
             if (kCharsPerWord * s.size() < (unsigned)end - begin + 1) {
-                s.push_back(packed_seq[last_word] << first_shift);
+                s.push_back(get_word(last_word) << first_shift);
             }
         }
 
@@ -527,6 +527,55 @@ int SuccinctDBG::Label(int64_t edge_or_node_id, uint8_t *seq) {
     return kmer_k;
 }
 
+static inline void PutBase(int64_t i, uint8_t c, uint64_t *packed, char *ascii) {
+    if (packed != NULL) {
+        packed[i >> 5] |= (uint64_t)c << ((i & 31) << 1);
+    }
+
+    if (ascii != NULL) {
+        ascii[i] = "ACGT"[c];
+    }
+}
+
+int64_t SuccinctDBG::SimplePathLabel(int64_t end_edge, int64_t path_len, uint64_t *packed, char *ascii) {
+    int64_t x = end_edge;
+
+    for (int64_t i = path_len + kmer_k - 1; ; --i) {
+        uint8_t c = GetW(x);
+        assert(c >= 1 && c <= 8);
+        PutBase(i, c > 4 ? c - 5 : c - 1, packed, ascii);
+
+        if (i == kmer_k) {
+            break;
+        }
+
+        x = PrevEdgeInSimplePath(x);
+    }
+
+    int64_t first_edge = x;
+
+    // the same as Label(first_edge)
+    for (int i = kmer_k - 1; i >= 0; --i) {
+        if (IsTip(x)) {
+            uint32_t *tip_node_seq = tip_node_seq_ + (size_t)uint32_per_tip_nodes_ * (rs_is_tip_.Rank(x) - 1);
+
+            for (int j = 0; j <= i; ++j) {
+                PutBase(i - j, (tip_node_seq[j / kCharsPerUint32] >> (kCharsPerUint32 - 1 - j % kCharsPerUint32) * kBitsPerChar) & 3,
+                        packed, ascii);
+            }
+
+            break;
+        }
+
+        x = Backward(x);
+        uint8_t c = GetW(x);
+        assert(c > 0);
+        PutBase(i, c > 4 ? c - 5 : c - 1, packed, ascii);
+    }
+
+    return first_edge;
+}
+
 int64_t SuccinctDBG::IndexBinarySearchEdge(uint8_t *seq) {
     int64_t node = IndexBinarySearch(seq);
 
@@ -592,7 +641,7 @@ int64_t SuccinctDBG::EdgeReverseComplement(int64_t edge_id) {
     return -1;
 }
 
-void SuccinctDBG::LoadFromMultiFile(const char *dbg_name, bool need_multiplicity) {
+void SuccinctDBG::LoadFromMultiFile(const char *dbg_name, bool need_multiplicity, const char *invalid_mask_name) {
     SdbgReader sdbg_reader;
     sdbg_reader.set_file_prefix(std::string(dbg_name));
     sdbg_reader.read_info();
@@ -615,22 +664,15 @@ void SuccinctDBG::LoadFromMultiFile(const char *dbg_name, bool need_multiplicity
     is_tip_ = (unsigned long long *) MallocAndCheck(sizeof(unsigned long long) * word_needed_last, __FILE__, __LINE__);
     tip_node_seq_ = (uint32_t *) MallocAndCheck(sizeof(uint32_t) * num_tip_nodes_ * sdbg_reader.words_per_tip_label(), __FILE__, __LINE__);
 
-    if (need_multiplicity) {
-        if (sdbg_reader.num_large_mul() > (1 << 30) ||
-                sdbg_reader.num_large_mul() > size * 0.08) {
-            edge_large_multi_ = (multi_t *) MallocAndCheck(sizeof(multi_t) * size, __FILE__, __LINE__);
-        }
-        else {
-            edge_multi_ = (multi2_t *) MallocAndCheck(sizeof(multi2_t) * size, __FILE__, __LINE__);
-            large_multi_h_ = kh_init(k64v16);
-        }
+    size_t word_needed_tier = (size + kMultiTiersPerWord - 1) / kMultiTiersPerWord;
+    multi_tier_ = (unsigned long long *) MallocAndCheck(sizeof(unsigned long long) * word_needed_tier, __FILE__, __LINE__);
+    memset(multi_tier_, 0, sizeof(unsigned long long) * word_needed_tier);
+    need_to_free_mul_ = true;
 
-        need_to_free_mul_ = true;
-    }
-    else {
-        is_multi_1_ = (unsigned long long *) MallocAndCheck(sizeof(unsigned long long) * word_needed_last, __FILE__, __LINE__);
-        memset(is_multi_1_, 0, sizeof(unsigned long long) * word_needed_last);
-        need_to_free_mul_ = true;
+    vector<multi2_t> overflow;
+
+    if (need_multiplicity) {
+        large_multi_h_ = kh_init(k64v16);
     }
 
     unsigned long long packed_w = 0;
@@ -670,29 +712,25 @@ void SuccinctDBG::LoadFromMultiFile(const char *dbg_name, bool need_multiplicity
             packed_tip = packed_last = 0;
         }
 
-        if (need_multiplicity) {
-            if (edge_multi_)
-                edge_multi_[i] = item >> 8;
-            else
-                edge_large_multi_[i] = item >> 8;
-        }
-        else {
-            is_multi_1_[i / 64] |= (unsigned long long)((item >> 8) <= 1) << (i % 64);
-        }
+        multi_t mul = item >> 8;
 
-        if (UNLIKELY((item >> 8) == kMulti2Sp)) {
-            multi_t mul = sdbg_reader.NextLargeMul();
+        if (UNLIKELY(mul == kMulti2Sp)) {
+            mul = sdbg_reader.NextLargeMul();
             assert(mul >= kMulti2Sp);
+        }
 
-            if (need_multiplicity) {
-                if (edge_multi_) {
-                    int ret;
-                    khint_t k = kh_put(k64v16, large_multi_h_, i, &ret);
-                    kh_value(large_multi_h_, k) = mul;
-                }
-                else {
-                    edge_large_multi_[i] = mul;
-                }
+        int tier = std::min(std::max((int)mul, 1), kMultiOverflowTier + 1) - 1;
+        multi_tier_[i / kMultiTiersPerWord] |= (unsigned long long)tier << (i % kMultiTiersPerWord * kMultiTierBits);
+
+        if (need_multiplicity && tier == kMultiOverflowTier) {
+            if (mul >= kMulti2Sp) {
+                int ret;
+                khint_t k = kh_put(k64v16, large_multi_h_, i, &ret);
+                kh_value(large_multi_h_, k) = mul;
+                overflow.push_back(kMulti2Sp);
+            }
+            else {
+                overflow.push_back(mul);
             }
         }
 
@@ -714,12 +752,63 @@ void SuccinctDBG::LoadFromMultiFile(const char *dbg_name, bool need_multiplicity
     assert(!sdbg_reader.NextItem(item));
     assert(tip_label_offset == num_tip_nodes_ * sdbg_reader.words_per_tip_label());
 
+    if (need_multiplicity) {
+        multi_overflow_ = (multi2_t *) MallocAndCheck(sizeof(multi2_t) * (overflow.size() + 1), __FILE__, __LINE__);
+        std::copy(overflow.begin(), overflow.end(), multi_overflow_);
+        vector<multi2_t>().swap(overflow);
+
+        int64_t num_samples = size / kMultiRankInterval + 1;
+        multi_overflow_rank_ = (int64_t *) MallocAndCheck(sizeof(int64_t) * num_samples, __FILE__, __LINE__);
+        int64_t rank = 0;
+
+        for (int64_t s = 0; s < num_samples; ++s) {
+            multi_overflow_rank_[s] = rank;
+
+            for (int64_t w = s * (kMultiRankInterval / kMultiTiersPerWord); w < (s + 1) * (kMultiRankInterval / kMultiTiersPerWord) && w < (int64_t)word_needed_tier; ++w) {
+                rank += __builtin_popcountll(OverflowTierMask_(multi_tier_[w]));
+            }
+        }
+    }
+
     invalid_ = (unsigned long long *) MallocAndCheck(sizeof(unsigned long long) * word_needed_last, __FILE__, __LINE__);
     memcpy(invalid_, is_tip_, sizeof(unsigned long long) * word_needed_last);
     rs_is_tip_.Build(is_tip_, size);
 
     init(w_, last_, f_, size, kmer_k);
     need_to_free_ = true;
+
+    if (invalid_mask_name != NULL) {
+        FILE *fp = OpenFileAndCheck(invalid_mask_name, "rb");
+        int64_t header[2];
+
+        if (fread(header, sizeof(int64_t), 2, fp) != 2 || header[0] != size || header[1] != kmer_k) {
+            xerr_and_exit("%s is not an invalid edge mask of %s\n", invalid_mask_name, dbg_name);
+        }
+
+        unsigned long long buf[4096];
+
+        for (size_t i = 0; i < word_needed_last; i += 4096) {
+            size_t num_words = std::min(word_needed_last - i, (size_t)4096);
+
+            if (fread(buf, sizeof(unsigned long long), num_words, fp) != num_words) {
+                xerr_and_exit("%s is truncated\n", invalid_mask_name);
+            }
+
+            for (size_t j = 0; j < num_words; ++j) {
+                invalid_[i + j] |= buf[j];
+            }
+        }
+
+        fclose(fp);
+    }
+}
+
+void SuccinctDBG::SaveInvalidMask(const char *file_name) {
+    FILE *fp = OpenFileAndCheck(file_name, "wb");
+    int64_t header[2] = {size, kmer_k};
+    fwrite(header, sizeof(int64_t), 2, fp);
+    fwrite(invalid_, sizeof(unsigned long long), (size + kBitsPerULL - 1) / kBitsPerULL, fp);
+    fclose(fp);
 }
 
 void SuccinctDBG::PrefixRangeSearch_(uint8_t c, int64_t &l, int64_t &r) {
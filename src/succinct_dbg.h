@@ -40,12 +40,17 @@ class SuccinctDBG {
     static const int kMaxKmerK = kMaxK + 1;
     static const int kCharsPerUint32 = 16;
     static const int kBitsPerChar = 2;
+    static const int kMultiTierBits = 2;
+    static const int kMultiTierMask = 3;
+    static const int kMultiTiersPerWord = sizeof(unsigned long long) * kBitsPerByte / kMultiTierBits;
+    static const int kMultiOverflowTier = 3;
+    static const int kMultiRankInterval = 256;
 
     int64_t size;
     int kmer_k;
 
   public:
-    SuccinctDBG(): need_to_free_(false), need_to_free_mul_(false), edge_multi_(NULL), edge_large_multi_(NULL), is_multi_1_(NULL) { }
+    SuccinctDBG(): need_to_free_(false), need_to_free_mul_(false), multi_tier_(NULL), multi_overflow_(NULL), multi_overflow_rank_(NULL) { }
     ~SuccinctDBG() {
         if (need_to_free_) {
             free(last_);
@@ -58,7 +63,12 @@ class SuccinctDBG {
         FreeMul();
     }
 
-    void LoadFromMultiFile(const char *dbg_name, bool need_multiplicity = true);
+    /**
+     * @param invalid_mask_name if not NULL, edges invalid in the mask written by SaveInvalidMask() are invalidated,
+     * so that the graph is seen as cleaned without cleaning it again
+     */
+    void LoadFromMultiFile(const char *dbg_name, bool need_multiplicity = true, const char *invalid_mask_name = NULL);
+    void SaveInvalidMask(const char *file_name);
     void init(unsigned long long *w, unsigned long long *last, long long *f, int64_t size, int kmer_k) {
         w_ = w;
         last_ = last;
@@ -130,16 +140,27 @@ class SuccinctDBG {
         __sync_fetch_and_or(invalid_ + edge_id / 64, 1ULL << (edge_id % 64));
     }
 
+    // 0, 1, 2 for multiplicity 1, 2, 3 and kMultiOverflowTier for >= 4; 2 bits per edge
+    int EdgeMultiplicityTier(int64_t edge_id) {
+        return (multi_tier_[edge_id / kMultiTiersPerWord] >> (edge_id % kMultiTiersPerWord * kMultiTierBits)) & kMultiTierMask;
+    }
+
+    // exact if loaded with need_multiplicity, otherwise only tells 1 from larger ones
     int EdgeMultiplicity(int64_t edge_id) {
-        if (is_multi_1_)
-            return 2 - ((is_multi_1_[edge_id / 64] >> (edge_id % 64)) & 1);
+        int tier = EdgeMultiplicityTier(edge_id);
+
+        if (multi_overflow_ == NULL) {
+            return tier == 0 ? 1 : 2;
+        }
 
-        if (edge_large_multi_) {
-            return edge_large_multi_[edge_id];
+        if (__builtin_expect(tier != kMultiOverflowTier, 1)) {
+            return tier + 1;
         }
 
-        if (__builtin_expect(edge_multi_[edge_id] != kMulti2Sp, 1)) {
-            return edge_multi_[edge_id];
+        multi2_t mul = multi_overflow_[OverflowRank_(edge_id)];
+
+        if (__builtin_expect(mul != kMulti2Sp, 1)) {
+            return mul;
         }
         else {
             return kh_value(large_multi_h_, kh_get(k64v16, large_multi_h_, edge_id));
@@ -147,9 +168,7 @@ class SuccinctDBG {
     }
 
     bool IsMulti1(int64_t edge_id) {
-        if (is_multi_1_)
-            return (is_multi_1_[edge_id / 64] >> (edge_id % 64)) & 1;
-        else return EdgeMultiplicity(edge_id) <= 1;
+        return EdgeMultiplicityTier(edge_id) == 0;
     }
 
     int64_t Forward(int64_t edge_id) { // the last edge edge_id points to
@@ -169,10 +188,37 @@ class SuccinctDBG {
         return rs_w_.Select(a, count_a);
     }
 
+    // the valid incoming edge of an edge inside a simple path; unlike PrevSimplePathEdge, no degree is checked
+    int64_t PrevEdgeInSimplePath(int64_t edge_id) {
+        int64_t prev_edge = Backward(edge_id);
+        // the next Backward() starts with a rank around prev_edge
+        __builtin_prefetch(last_ + prev_edge / 64);
+
+        if (IsValidEdge(prev_edge)) {
+            return prev_edge;
+        }
+
+        uint8_t c = GetW(prev_edge) + 4;
+
+        do {
+            ++prev_edge;
+        }
+        while (GetW(prev_edge) != c || !IsValidEdge(prev_edge));
+
+        return prev_edge;
+    }
+
     int64_t Index(uint8_t *seq);
     int64_t IndexBinarySearch(uint8_t *seq);
     int64_t IndexBinarySearchEdge(uint8_t *seq);
     int Label(int64_t edge_or_node_id, uint8_t *seq);
+    /**
+     * @brief label of the simple path of path_len edges ending at end_edge, by a single backward walk through the path
+     * and then the k-mer of its first node. the i-th base is written as a 2-bit code to packed (32 per word, zeroed by
+     * the caller) and as ACGT to ascii; either can be NULL
+     * @return the first edge of the path
+     */
+    int64_t SimplePathLabel(int64_t end_edge, int64_t path_len, uint64_t *packed, char *ascii);
 
     int EdgeIndegree(int64_t edge_id);
     int EdgeOutdegree(int64_t edge_id);
@@ -199,19 +245,16 @@ class SuccinctDBG {
     // After that EdgeMultiplicty() are invalid
     void FreeMul() {
         if (need_to_free_mul_) {
-            if (edge_multi_ != NULL) {
-                free(edge_multi_);
-                edge_multi_ = NULL;
+            free(multi_tier_);
+            multi_tier_ = NULL;
+
+            if (multi_overflow_ != NULL) {
+                free(multi_overflow_);
+                free(multi_overflow_rank_);
+                multi_overflow_ = NULL;
+                multi_overflow_rank_ = NULL;
                 kh_destroy(k64v16, large_multi_h_);
             }
-            else if (edge_large_multi_ != NULL) {
-                free(edge_large_multi_);
-                edge_large_multi_ = NULL;
-            }
-
-            if (is_multi_1_ != NULL) {
-                free(is_multi_1_);
-            }
         }
 
         need_to_free_mul_ = false;
@@ -227,10 +270,10 @@ class SuccinctDBG {
     unsigned long long *is_tip_;
     unsigned long long *invalid_;
     uint32_t *tip_node_seq_;
-    multi2_t *edge_multi_;
-    multi_t *edge_large_multi_;
-    khash_t(k64v16) *large_multi_h_;
-    unsigned long long *is_multi_1_;
+    unsigned long long *multi_tier_;  // 2-bit multiplicity tiers
+    multi2_t *multi_overflow_;        // multiplicities of the overflow tier, indexed by its rank
+    int64_t *multi_overflow_rank_;    // # of overflow tiers before every kMultiRankInterval edges
+    khash_t(k64v16) *large_multi_h_;  // multiplicities >= kMulti2Sp
 
     long long f_[kAlphabetSize + 2];
     long long rank_f_[kAlphabetSize + 2]; // = rs_last_.Rank(f_[i] - 1)
@@ -244,6 +287,25 @@ class SuccinctDBG {
     RankAndSelect1Bit<true> rs_is_tip_;
 
     void PrefixRangeSearch_(uint8_t c, int64_t &l, int64_t &r);
+
+    // the low bit of each tier that equals kMultiOverflowTier
+    static unsigned long long OverflowTierMask_(unsigned long long tiers) {
+        return tiers & (tiers >> 1) & 0x5555555555555555ULL;
+    }
+
+    // # of edges before edge_id in the overflow tier, one popcount per word of 32 tiers
+    int64_t OverflowRank_(int64_t edge_id) {
+        int64_t rank = multi_overflow_rank_[edge_id / kMultiRankInterval];
+        int64_t word_idx = edge_id / kMultiRankInterval * (kMultiRankInterval / kMultiTiersPerWord);
+        int64_t end_word_idx = edge_id / kMultiTiersPerWord;
+
+        for (; word_idx < end_word_idx; ++word_idx) {
+            rank += __builtin_popcountll(OverflowTierMask_(multi_tier_[word_idx]));
+        }
+
+        unsigned long long partial = multi_tier_[end_word_idx] & ((1ULL << (edge_id % kMultiTiersPerWord * kMultiTierBits)) - 1);
+        return rank + __builtin_popcountll(OverflowTierMask_(partial));
+    }
 };
 
 #endif // SUCCINCT_DBG_H_
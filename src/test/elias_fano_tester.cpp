@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <vector>
+#include <algorithm>
+
+#include "elias_fano.h"
+
+// g++ -O2 -I.. -mpopcnt elias_fano_tester.cpp -o elias_fano_tester
+int main(int argc, char **argv) {
+    int max_gap[] = {1, 150, 300, 20000};
+
+    for (int t = 0; t < 4; ++t) {
+        std::vector<uint64_t> values;
+        uint64_t cur = rand() % 100;
+
+        for (int i = 0; i < 100000; ++i) {
+            // mix short reads with a few long sequences and empty ones
+            cur += (i % 1000 == 0) ? rand() % 100000 : rand() % max_gap[t];
+            values.push_back(cur);
+        }
+
+        EliasFano ef;
+        ef.set_low_bits(EliasFano::OptimalLowBits(values.back(), values.size()));
+        ef.reserve(values.size());
+
+        for (size_t i = 0; i < values.size(); ++i) {
+            ef.push_back(values[i]);
+        }
+
+        for (size_t i = 0; i < values.size(); ++i) {
+            assert(ef[i] == values[i]);
+        }
+
+        for (size_t i = 0; i + 1 < values.size(); ++i) {
+            uint64_t a, b;
+            ef.get_pair(i, a, b);
+            assert(a == values[i] && b == values[i + 1]);
+        }
+
+        for (int i = 0; i < 100000; ++i) {
+            uint64_t pos = values[0] + rand() % (values.back() - values[0]);
+            size_t from = std::upper_bound(values.begin(), values.end(), pos) - values.begin() - 1;
+            size_t expected = from;
+            from -= std::min(from, (size_t)rand() % 8);
+
+            uint64_t a, b;
+            assert(ef.Locate(from, pos, a, b) == expected);
+            assert(a <= pos && pos < b && a == values[expected] && b == values[expected + 1]);
+        }
+
+        // round trip through the serialized form
+        FILE *fp = tmpfile();
+        ef.Serialize(fp);
+        std::vector<uint64_t> words(ef.serialized_words());
+        rewind(fp);
+        assert(fread(&words[0], sizeof(uint64_t), words.size(), fp) == words.size());
+        fclose(fp);
+
+        EliasFano view;
+        assert(view.Attach(&words[0], words.size()) == words.size());
+        assert(view.size() == values.size() && view.back() == values.back());
+
+        for (size_t i = 0; i < values.size(); ++i) {
+            assert(view[i] == values[i]);
+        }
+
+        printf("max gap %d: %d low bits, %.3lf bytes per value\n", max_gap[t], ef.low_bits(),
+               (double)ef.serialized_words() * sizeof(uint64_t) / values.size());
+    }
+
+    puts("All tests passed");
+    return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ *  MEGAHIT
+ *  Copyright (C) 2014 - 2015 The University of Hong Kong
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* contact: Dinghua Li <dhli@cs.hku.hk> */
+
+#ifndef THREAD_POOL_H__
+#define THREAD_POOL_H__
+
+#include <assert.h>
+#include <pthread.h>
+#include <vector>
+
+/**
+ * @brief a pool of persistent pthreads running parallel loops
+ * @details ForEach() schedules like kt_dfor(): worker w runs task w first, then takes
+ *          the remaining tasks one at a time from a shared counter, so a slow task only
+ *          holds up its own worker. The calling thread waits until all tasks are done.
+ */
+class ThreadPool {
+  public:
+    typedef void (*task_func_t)(void *data, long i, int worker_id);
+
+    ThreadPool(): generation_(0), stop_(false) {
+        pthread_mutex_init(&lock_, NULL);
+        pthread_cond_init(&job_cond_, NULL);
+        pthread_cond_init(&done_cond_, NULL);
+    }
+
+    ~ThreadPool() {
+        Resize(0);
+        pthread_mutex_destroy(&lock_);
+        pthread_cond_destroy(&job_cond_);
+        pthread_cond_destroy(&done_cond_);
+    }
+
+    int num_threads() const {
+        return workers_.size();
+    }
+
+    // must not be called while ForEach() is running
+    void Resize(int num_threads) {
+        if (num_threads == (int)workers_.size()) {
+            return;
+        }
+
+        if (!workers_.empty()) {
+            pthread_mutex_lock(&lock_);
+            stop_ = true;
+            pthread_cond_broadcast(&job_cond_);
+            pthread_mutex_unlock(&lock_);
+
+            for (size_t i = 0; i < workers_.size(); ++i) {
+                pthread_join(workers_[i].thread, NULL);
+            }
+
+            stop_ = false;
+        }
+
+        workers_.resize(num_threads);
+
+        for (int i = 0; i < num_threads; ++i) {
+            workers_[i].pool = this;
+            workers_[i].id = i;
+            workers_[i].generation = generation_;
+            pthread_create(&workers_[i].thread, NULL, Work_, &workers_[i]);
+        }
+    }
+
+    void ForEach(long n, task_func_t func, void *data) {
+        assert(!workers_.empty());
+        pthread_mutex_lock(&lock_);
+        func_ = func;
+        data_ = data;
+        n_ = n;
+        next_ = workers_.size();
+        num_running_ = workers_.size();
+        ++generation_;
+        pthread_cond_broadcast(&job_cond_);
+
+        while (num_running_ > 0) {
+            pthread_cond_wait(&done_cond_, &lock_);
+        }
+
+        pthread_mutex_unlock(&lock_);
+    }
+
+  private:
+    struct worker_t {
+        ThreadPool *pool;
+        int id;
+        long generation; // of the last job taken
+        pthread_t thread;
+    };
+
+    static void *Work_(void *_w) {
+        worker_t &w = *((worker_t *) _w);
+        ThreadPool &pool = *w.pool;
+
+        for (;;) {
+            pthread_mutex_lock(&pool.lock_);
+
+            while (!pool.stop_ && pool.generation_ == w.generation) {
+                pthread_cond_wait(&pool.job_cond_, &pool.lock_);
+            }
+
+            if (pool.stop_) {
+                pthread_mutex_unlock(&pool.lock_);
+                break;
+            }
+
+            w.generation = pool.generation_;
+            pthread_mutex_unlock(&pool.lock_);
+
+            if (w.id < pool.n_) {
+                pool.func_(pool.data_, w.id, w.id);
+            }
+
+            for (;;) {
+                long i = __sync_fetch_and_add(&pool.next_, 1);
+
+                if (i >= pool.n_) {
+                    break;
+                }
+
+                pool.func_(pool.data_, i, w.id);
+            }
+
+            pthread_mutex_lock(&pool.lock_);
+
+            if (--pool.num_running_ == 0) {
+                pthread_cond_signal(&pool.done_cond_);
+            }
+
+            pthread_mutex_unlock(&pool.lock_);
+        }
+
+        return NULL;
+    }
+
+    std::vector<worker_t> workers_;
+    pthread_mutex_t lock_;
+    pthread_cond_t job_cond_;
+    pthread_cond_t done_cond_;
+    long generation_;
+    bool stop_;
+
+    // the current job
+    task_func_t func_;
+    void *data_;
+    long n_;
+    volatile long next_;
+    int num_running_;
+};
+
+#endif // THREAD_POOL_H__
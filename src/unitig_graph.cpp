@@ -78,36 +78,14 @@ static inline void ReverseComplement(std::string &s) {
 }
 
 std::string VertexToDNAString(SuccinctDBG *sdbg_, const UnitigGraphVertex &v) {
-    std::string label;
-    int64_t cur_edge = v.end_node;
+    std::string label(v.length + sdbg_->kmer_k, 'A');
+    int64_t first_edge = sdbg_->SimplePathLabel(v.end_node, v.length, NULL, &label[0]);
 
-    for (int i = 1; i < v.length; ++i) {
-        int8_t cur_char = sdbg_->GetW(cur_edge);
-        assert(1 <= cur_char && cur_char <= 8);
-        label.append(1, "ACGT"[cur_char > 4 ? (cur_char - 5) : (cur_char - 1)]);
-
-        cur_edge = sdbg_->PrevSimplePathEdge(cur_edge);
-        assert(cur_edge != -1);
-    }
-
-    int8_t cur_char = sdbg_->GetW(cur_edge);
-    label.append(1, "ACGT"[cur_char > 4 ? (cur_char - 5) : (cur_char - 1)]);
-
-    if (cur_edge != v.start_node) {
+    if (first_edge != v.start_node) {
         xerr("fwd: %lld, %lld, rev: %lld, %lld, (%lld, %lld) length: %d\n", v.start_node, v.end_node, v.rev_start_node, v.rev_end_node, sdbg_->EdgeReverseComplement(v.end_node), sdbg_->EdgeReverseComplement(v.start_node), v.length);
     }
 
-    assert(cur_edge == v.start_node);
-
-    uint8_t seq[sdbg_->kMaxKmerK];
-    sdbg_->Label(v.start_node, seq);
-
-    for (int i = sdbg_->kmer_k - 1; i >= 0; --i) {
-        assert(seq[i] >= 1 && seq[i] <= 4);
-        label.append(1, "ACGT"[seq[i] - 1]);
-    }
-
-    std::reverse(label.begin(), label.end());
+    assert(first_edge == v.start_node);
     return label;
 }
 
@@ -132,8 +110,19 @@ void FoldPalindrome(std::string &s, int kmer_k, bool is_loop) {
 }
 
 void WriteContig(const std::string &label, int k_size, long long &id, int flag, double multiplicity, omp_lock_t *lock, FILE *file) {
-    std::string rev_label(label);
-    ReverseComplement(rev_label);
+    // output the smaller one of the label and its reverse complement; the latter is only built if needed
+    int cmp = 0;
+
+    for (int i = 0, j = label.length() - 1; i < (int)label.length() && cmp == 0; ++i, --j) {
+        cmp = (int)label[i] - Complement(label[j]);
+    }
+
+    std::string rev_label;
+
+    if (cmp > 0) {
+        rev_label = label;
+        ReverseComplement(rev_label);
+    }
 
     omp_set_lock(lock);
 
@@ -144,61 +133,177 @@ void WriteContig(const std::string &label, int k_size, long long &id, int flag,
             flag,
             multiplicity,
             (int)label.length(),
-            label < rev_label ? label.c_str() : rev_label.c_str());
+            cmp > 0 ? rev_label.c_str() : label.c_str());
 
     omp_unset_lock(lock);
 }
 
-double GetSimilarity(std::string &a, std::string &b, double min_similar) {
-    int n = a.length();
-    int m = b.length();
-    int max_indel = std::max(n, m) * (1 - min_similar);
+// 2-bit packed label, 32 bases per word
+struct PackedLabel {
+    std::vector<uint64_t> words;
+    int length;
 
-    if (abs(n - m) > max_indel) {
-        return 0;
+    PackedLabel(): length(0) {}
+
+    void resize(int len) {
+        length = len;
+        words.assign((len + 31) / 32, 0);
     }
 
-    if (max_indel < 1) {
-        return 0;
+    void set(int i, uint8_t c) {
+        words[i >> 5] |= (uint64_t)c << ((i & 31) << 1);
     }
 
-    std::vector<int> dp[2];
+    uint8_t at(int i) const {
+        return (words[i >> 5] >> ((i & 31) << 1)) & 3;
+    }
+
+    std::string ToDNAString() const {
+        std::string label(length, 'A');
+
+        for (int i = 0; i < length; ++i) {
+            label[i] = "ACGT"[at(i)];
+        }
 
-    for (int i = 0; i < 2; ++i) {
-        dp[i].resize(max_indel * 2 + 1, 0);
+        return label;
     }
+};
 
-#define IDX(j, i) ((j) - (i) + max_indel)
+// same label as VertexToDNAString, without going through ASCII
+void VertexToPackedLabel(SuccinctDBG *sdbg_, const UnitigGraphVertex &v, PackedLabel &label) {
+    label.resize(v.length + sdbg_->kmer_k);
+    int64_t first_edge = sdbg_->SimplePathLabel(v.end_node, v.length, &label.words[0], NULL);
+    assert(first_edge == v.start_node);
+}
+
+// a 64-row block of a DP column, as vertical +1/-1 bit vectors and the score of its last row
+struct MyersBlock {
+    uint64_t pv, mv;
+    int score;
+};
+
+struct EditDistanceBuffer {
+    std::vector<uint64_t> peq;
+    std::vector<MyersBlock> blocks;
+};
+
+static inline int AdvanceBlock(MyersBlock &block, uint64_t eq, int hin, uint64_t high_bit) {
+    uint64_t pv = block.pv;
+    uint64_t mv = block.mv;
+    uint64_t xv = eq | mv;
 
-    for (int j = 0; j <= max_indel; ++j) {
-        dp[0][IDX(j, 0)] = j;
+    if (hin < 0) {
+        eq |= 1;
     }
 
-    for (int i = 1; i <= n; ++i) {
-        std::fill(dp[i & 1].begin(), dp[i & 1].end(), 99999999);
+    uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+    uint64_t ph = mv | ~(xh | pv);
+    uint64_t mh = pv & xh;
+    int hout = (ph & high_bit) ? 1 : ((mh & high_bit) ? -1 : 0);
 
-        if (i - max_indel <= 0) {
-            dp[i & 1][IDX(0, i)] = i;
+    ph <<= 1;
+    mh <<= 1;
+
+    if (hin < 0) {
+        mh |= 1;
+    }
+    else if (hin > 0) {
+        ph |= 1;
+    }
+
+    block.pv = mh | ~(xv | ph);
+    block.mv = ph & xv;
+    block.score += hout;
+    return hout;
+}
+
+/**
+ * @brief global edit distance by Myers/Hyyro bit-parallel blocks, a column of b at a time;
+ * only the blocks crossing the diagonal band that can still end within max_dist are computed,
+ * and blocks whose cells all exceed max_dist are dropped
+ * @return the edit distance, or max_dist + 1 if it is larger than max_dist
+ */
+static int BandedEditDistance(const PackedLabel &a, const PackedLabel &b, int max_dist, EditDistanceBuffer &buf) {
+    int n = a.length;
+    int m = b.length;
+
+    if (abs(n - m) > max_dist) {
+        return max_dist + 1;
+    }
+
+    if (n == 0 || m == 0) {
+        return std::max(n, m);
+    }
+
+    int num_blocks = (n + 63) / 64;
+    int last_height = n - (num_blocks - 1) * 64;
+    buf.peq.assign(4 * num_blocks, 0);
+    buf.blocks.resize(num_blocks);
+
+    for (int i = 0; i < n; ++i) {
+        buf.peq[a.at(i) * num_blocks + i / 64] |= 1ULL << (i % 64);
+    }
+
+    int first = 0, last = -1;
+
+    for (int j = 1; j <= m; ++j) {
+        // rows (1-based) of column j that can be on a path within max_dist
+        int lo = std::max(1, std::max(j - max_dist, j + n - m - max_dist));
+        int hi = std::min(n, std::min(j + max_dist, j + n - m + max_dist));
+        int band_last = (hi - 1) / 64;
+        first = std::max(first, (lo - 1) / 64);
+
+        // a new block starts from an upper bound of column j - 1: +1 for every row below the block above it
+        while (last < band_last) {
+            ++last;
+            MyersBlock &block = buf.blocks[last];
+            block.pv = ~0ULL;
+            block.mv = 0;
+            block.score = (last == 0 ? 0 : buf.blocks[last - 1].score) + (last == num_blocks - 1 ? last_height : 64);
         }
 
-        for (int j = std::max(i - max_indel, 1); j <= m && j <= i + max_indel; ++j) {
-            // assert(IDX(j,i) >= 0 && IDX(j,i) < max_indel * 2 + 1);
-            dp[i & 1][IDX(j, i)] = std::min(dp[i & 1][IDX(j, i)], dp[(i ^ 1) & 1][IDX(j - 1, i - 1)] + (a[i - 1] != b[j - 1]));
+        const uint64_t *eq = &buf.peq[b.at(j - 1) * num_blocks];
+        int hout = 1; // the row above the first block grows by 1 per column, exact for row 0
 
-            if (j > i - max_indel) {
-                // assert(IDX(j-1,i) >= 0 && IDX(j-1,i) < max_indel * 2 + 1);
-                dp[i & 1][IDX(j, i)] = std::min(dp[i & 1][IDX(j, i)], dp[i & 1][IDX(j - 1, i)] + 1);
-            }
+        for (int blk = first; blk <= last; ++blk) {
+            hout = AdvanceBlock(buf.blocks[blk], eq[blk], hout, 1ULL << ((blk == num_blocks - 1 ? last_height : 64) - 1));
+        }
 
-            if (j < i + max_indel) {
-                // assert(IDX(j,i-1) >= 0 && IDX(j,i-1) < max_indel * 2 + 1);
-                dp[i & 1][IDX(j, i)] = std::min(dp[i & 1][IDX(j, i)], dp[(i ^ 1) & 1][IDX(j, i - 1)] + 1);
-            }
+        while (first <= last && buf.blocks[first].score >= max_dist + (first == num_blocks - 1 ? last_height : 64)) {
+            ++first;
+        }
+
+        while (last >= first && buf.blocks[last].score >= max_dist + (last == num_blocks - 1 ? last_height : 64)) {
+            --last;
+        }
+
+        if (first > last) {
+            return max_dist + 1;
         }
     }
 
-    return 1 - dp[n & 1][IDX(m, n)] * 1.0 / std::max(n, m);
-#undef IDX
+    if (last != num_blocks - 1) {
+        return max_dist + 1;
+    }
+
+    return std::min(buf.blocks[last].score, max_dist + 1);
+}
+
+double GetSimilarity(const PackedLabel &a, const PackedLabel &b, double min_similar, EditDistanceBuffer &buf) {
+    int n = a.length;
+    int m = b.length;
+    int max_indel = std::max(n, m) * (1 - min_similar);
+
+    if (abs(n - m) > max_indel) {
+        return 0;
+    }
+
+    if (max_indel < 1) {
+        return 0;
+    }
+
+    // max_indel is rounded down, so one more edit may still be just similar enough
+    return 1 - BandedEditDistance(a, b, max_indel + 1, buf) * 1.0 / std::max(n, m);
 }
 
 // -- end of helper functions --
@@ -206,9 +311,12 @@ double GetSimilarity(std::string &a, std::string &b, double min_similar) {
 const size_t UnitigGraph::kMaxNumVertices = std::numeric_limits<UnitigGraph::vertexID_t>::max();
 
 void UnitigGraph::InitFromSdBG(Histgram<int64_t> *hist, FILE *out, int min_contig) {
-    start_node_map_.clear();
     vertices_.clear();
 
+    if (sdbg_->size >= (1LL << (UnitigGraphVertex::kEdgeIdBits - 1))) {
+        xerr_and_exit("[ERROR] Too many edges for the unitig graph (%lld)\n", (long long)sdbg_->size);
+    }
+
     omp_lock_t path_lock;
     omp_init_lock(&path_lock);
     AtomicBitVector marked(sdbg_->size);
@@ -306,39 +414,133 @@ void UnitigGraph::InitFromSdBG(Histgram<int64_t> *hist, FILE *out, int min_conti
         }
     }
 
-    if (out == NULL) return;
+    if (out != NULL) {
+        omp_destroy_lock(&path_lock);
+        return;
+    }
+
+    // assemble looped paths, which have no end to start from
+    #pragma omp parallel for
+
+    for (int64_t edge_idx = 0; edge_idx < sdbg_->size; ++edge_idx) {
+        if (!marked.get(edge_idx) && sdbg_->IsValidEdge(edge_idx)) {
+            omp_set_lock(&path_lock);
+
+            if (!marked.get(edge_idx)) {
+                int64_t rc_edge = sdbg_->EdgeReverseComplement(edge_idx);
+                int64_t cur_edge = edge_idx;
+                int64_t depth = 0;
+                uint32_t length = 0;
+                bool is_palindrome = false;
+
+                while (!marked.get(cur_edge)) {
+                    marked.set(cur_edge);
+                    depth += sdbg_->EdgeMultiplicity(cur_edge);
+                    ++length;
+                    is_palindrome |= cur_edge == rc_edge;
+                    cur_edge = sdbg_->NextSimplePathEdge(cur_edge);
+                    assert(cur_edge != -1);
+                }
+
+                assert(cur_edge == edge_idx);
+
+                if (!is_palindrome) {
+                    for (cur_edge = rc_edge; !marked.get(cur_edge); cur_edge = sdbg_->NextSimplePathEdge(cur_edge)) {
+                        marked.set(cur_edge);
+                    }
+                }
+
+                int64_t end_edge = sdbg_->PrevSimplePathEdge(edge_idx);
+                vertices_.push_back(UnitigGraphVertex(edge_idx, end_edge, sdbg_->EdgeReverseComplement(end_edge), rc_edge, depth, length));
+                vertices_.back().is_loop = true;
+                vertices_.back().is_deleted = true;
+                vertices_.back().is_palindrome = is_palindrome;
+            }
+
+            omp_unset_lock(&path_lock);
+        }
+    }
+
+    omp_destroy_lock(&path_lock);
 
     if (vertices_.size() >= kMaxNumVertices) {
         xerr_and_exit("[ERROR] Too many vertices in the unitig graph (%llu >= %llu)\n",
                       (unsigned long long)vertices_.size(), (unsigned long long)kMaxNumVertices);
     }
 
-    // free memory for hash table construction
+    // free memory for building the start node index
     sdbg_->FreeMul();
     {
         AtomicBitVector empty_abv;
         marked.swap(empty_abv);
     }
 
-    start_node_map_.reserve(vertices_.size() * 2);
+    BuildStartNodeIndex_();
+    locks_.reset(vertices_.size());
+}
+
+void UnitigGraph::BuildStartNodeIndex_() {
+    start_node_bits_.assign((sdbg_->size + 63) / 64, 0);
 
     #pragma omp parallel for
 
     for (vertexID_t i = 0; i < vertices_.size(); ++i) {
         if (!vertices_[i].is_deleted) {
-            start_node_map_[vertices_[i].start_node] = i;
-            start_node_map_[vertices_[i].rev_start_node] = i;
+            __sync_fetch_and_or(&start_node_bits_[vertices_[i].start_node / 64], 1ULL << (vertices_[i].start_node % 64));
+            __sync_fetch_and_or(&start_node_bits_[vertices_[i].rev_start_node / 64], 1ULL << (vertices_[i].rev_start_node % 64));
         }
     }
 
-    locks_.resize(vertices_.size());
+    start_node_rank_.Build(&start_node_bits_[0], sdbg_->size);
+    start_node_vertex_.resize(start_node_rank_.total_num_ones);
+
     #pragma omp parallel for
 
     for (vertexID_t i = 0; i < vertices_.size(); ++i) {
-        omp_init_lock(&locks_[i]);
+        if (!vertices_[i].is_deleted) {
+            StartNodeVertex_(vertices_[i].start_node) = i;
+            StartNodeVertex_(vertices_[i].rev_start_node) = i;
+        }
     }
 }
 
+uint32_t UnitigGraph::RemoveTips(int max_tip_len) {
+    uint32_t num_removed = 0;
+
+    // same schedule as assembly_algorithms::RemoveTips, but a whole unitig is checked at once
+    for (int len = 2; ; len *= 2) {
+        len = std::min(len, max_tip_len);
+        uint32_t num_removed_this_len = 0;
+
+        #pragma omp parallel for reduction(+: num_removed_this_len)
+
+        for (vertexID_t i = 0; i < vertices_.size(); ++i) {
+            if (vertices_[i].is_deleted || vertices_[i].length >= (uint32_t)len) {
+                continue;
+            }
+
+            bool no_in = sdbg_->EdgeIndegreeZero(vertices_[i].start_node);
+            bool no_out = sdbg_->EdgeOutdegreeZero(vertices_[i].end_node);
+
+            if (no_in != no_out) {
+                vertices_[i].is_dead = true;
+                ++num_removed_this_len;
+            }
+        }
+
+        if (num_removed_this_len > 0) {
+            Refresh_(false);
+            num_removed += num_removed_this_len;
+        }
+
+        if (len == max_tip_len) {
+            break;
+        }
+    }
+
+    return num_removed;
+}
+
 uint32_t UnitigGraph::MergeBubbles(bool permanent_rm, bool careful, FILE *bubble_file, Histgram<int64_t> &hist) {
     int max_bubble_len = sdbg_->kmer_k * 2 + 2; // allow 1 indel
     uint32_t num_removed = 0;
@@ -366,9 +568,8 @@ uint32_t UnitigGraph::MergeBubbles(bool permanent_rm, bool careful, FILE *bubble
             int64_t next_outgoings[4];
 
             for (int j = 0; j < outdegree; ++j) {
-                auto next_vertex_iter = start_node_map_.find(outgoings[j]);
-                assert(next_vertex_iter != start_node_map_.end());
-                UnitigGraphVertex &next_vertex = vertices_[next_vertex_iter->second];
+                vertexID_t next_vertex_id = StartNodeVertex_(outgoings[j]);
+                UnitigGraphVertex &next_vertex = vertices_[next_vertex_id];
                 assert(!next_vertex.is_deleted);
 
                 if (next_vertex.length > max_bubble_len) {
@@ -400,7 +601,7 @@ uint32_t UnitigGraph::MergeBubbles(bool permanent_rm, bool careful, FILE *bubble
                 }
 
                 branches.push_back(std::make_tuple(-next_vertex.depth * 1.0 / next_vertex.length, next_vertex.Representation(),
-                                                   next_vertex_iter->second, next_outgoings[0]));
+                                                   next_vertex_id, next_outgoings[0]));
             }
 
             for (int j = 1; converged && j < outdegree; ++j) {
@@ -437,13 +638,14 @@ uint32_t UnitigGraph::MergeComplexBubbles(double similarity, int merge_level, bo
     uint32_t num_removed = 0;
 
     std::vector<std::tuple<double, int64_t, vertexID_t, std::vector<int64_t>, bool> > branches; // depth, representative id, id, in_out_ids, strand
-    std::vector<std::string> vertex_labels;
+    std::vector<PackedLabel> vertex_labels;
+    EditDistanceBuffer edit_buf;
 
     long long output_id = 0;
     omp_lock_t output_lock;
     omp_init_lock(&output_lock);
 
-    #pragma omp parallel for private(branches, vertex_labels) reduction(+: num_removed)
+    #pragma omp parallel for private(branches, vertex_labels, edit_buf) reduction(+: num_removed)
 
     for (vertexID_t i = 0; i < vertices_.size(); ++i) {
         if (vertices_[i].is_deleted || vertices_[i].is_dead) {
@@ -460,12 +662,14 @@ uint32_t UnitigGraph::MergeComplexBubbles(double similarity, int merge_level, bo
 
             branches.clear();
             vertex_labels.resize(outdegree);
-            std::fill(vertex_labels.begin(), vertex_labels.end(), "");
 
             for (int j = 0; j < outdegree; ++j) {
-                auto next_vertex_iter = start_node_map_.find(outgoings[j]);
-                assert(next_vertex_iter != start_node_map_.end());
-                UnitigGraphVertex &next_vertex = vertices_[next_vertex_iter->second];
+                vertex_labels[j].length = 0;
+            }
+
+            for (int j = 0; j < outdegree; ++j) {
+                vertexID_t next_vertex_id = StartNodeVertex_(outgoings[j]);
+                UnitigGraphVertex &next_vertex = vertices_[next_vertex_id];
                 assert(!next_vertex.is_deleted);
 
                 vector<int64_t> next_outgoings(8, -1);
@@ -473,7 +677,7 @@ uint32_t UnitigGraph::MergeComplexBubbles(double similarity, int merge_level, bo
                 sdbg_->OutgoingEdges(outgoings[j] == next_vertex.start_node ? next_vertex.rev_end_node : next_vertex.end_node, &next_outgoings[4]);
 
                 branches.push_back(std::make_tuple(-next_vertex.depth * 1.0 / next_vertex.length, next_vertex.Representation(),
-                                                   next_vertex_iter->second, next_outgoings, outgoings[j] == next_vertex.start_node));
+                                                   next_vertex_id, next_outgoings, outgoings[j] == next_vertex.start_node));
             }
 
             std::sort(branches.begin(), branches.end());
@@ -509,27 +713,26 @@ uint32_t UnitigGraph::MergeComplexBubbles(double similarity, int merge_level, bo
 
                     if ((vk.length + sdbg_->kmer_k - 1) * similarity <= (vj.length + sdbg_->kmer_k - 1) &&
                             (vj.length + sdbg_->kmer_k - 1) * similarity <= (vk.length + sdbg_->kmer_k - 1)) {
-                        if (vertex_labels[j] == "") {
-                            vertex_labels[j] = VertexToDNAString(sdbg_, std::get<4>(branches[j]) ? vj.ReverseComplement() : vj);
+                        if (vertex_labels[j].length == 0) {
+                            VertexToPackedLabel(sdbg_, std::get<4>(branches[j]) ? vj.ReverseComplement() : vj, vertex_labels[j]);
                         }
 
-                        if (vertex_labels[k] == "") {
-                            vertex_labels[k] = VertexToDNAString(sdbg_, std::get<4>(branches[k]) ? vk.ReverseComplement() : vk);
+                        if (vertex_labels[k].length == 0) {
+                            VertexToPackedLabel(sdbg_, std::get<4>(branches[k]) ? vk.ReverseComplement() : vk, vertex_labels[k]);
                         }
 
-                        // fprintf(stderr, "%s\n%s\n%lf\n", a.c_str(), b.c_str(), GetSimilarity(a, b, max_indel_allowed, similarity));
-                        if (GetSimilarity(vertex_labels[j], vertex_labels[k], similarity) >= similarity) {
+                        if (GetSimilarity(vertex_labels[j], vertex_labels[k], similarity, edit_buf) >= similarity) {
                             num_removed++;
                             vk.is_dead = true;
 
                             if (careful && -std::get<0>(branches[k]) >= -std::get<0>(branches[j]) * 0.2) {
                                 careful_merged = true;
-                                WriteContig(vertex_labels[k], sdbg_->kmer_k, output_id, 0, -std::get<0>(branches[j]), &output_lock, bubble_file);
-                                hist.insert(vertex_labels[k].length());
+                                WriteContig(vertex_labels[k].ToDNAString(), sdbg_->kmer_k, output_id, 0, -std::get<0>(branches[j]), &output_lock, bubble_file);
+                                hist.insert(vertex_labels[k].length);
 
                                 for (int ni = 0; ni < 8; ++ni) {
                                     if (std::get<3>(branches[k])[ni] != -1) {
-                                        left_or_right.push_back(start_node_map_[std::get<3>(branches[k])[ni]]);
+                                        left_or_right.push_back(StartNodeVertex_(std::get<3>(branches[k])[ni]));
                                     }
                                 }
                             }
@@ -636,9 +839,8 @@ double UnitigGraph::LocalDepth_(vertexID_t id, int local_width) {
         int outdegree = sdbg_->OutgoingEdges(dir == 1 ? vertices_[id].rev_end_node : vertices_[id].end_node, outgoings);
 
         for (int i = 0; i < outdegree; ++i) {
-            auto next_vertex_iter = start_node_map_.find(outgoings[i]);
-            assert(next_vertex_iter != start_node_map_.end());
-            UnitigGraphVertex &next_vertex = vertices_[next_vertex_iter->second];
+            vertexID_t next_vertex_id = StartNodeVertex_(outgoings[i]);
+            UnitigGraphVertex &next_vertex = vertices_[next_vertex_id];
             assert(!next_vertex.is_deleted);
 
             if (next_vertex.length <= local_width) {
@@ -716,7 +918,7 @@ void UnitigGraph::Refresh_(bool set_changed) {
             continue;
         }
 
-        if (!omp_test_lock(&locks_[i])) {
+        if (!locks_.try_lock(i)) {
             continue;
         }
 
@@ -732,13 +934,12 @@ void UnitigGraph::Refresh_(bool set_changed) {
                 break;
             }
 
-            auto next_vertex_iter = start_node_map_.find(next_start);
-            assert(next_vertex_iter != start_node_map_.end());
-            UnitigGraphVertex &next_vertex = vertices_[next_vertex_iter->second];
+            vertexID_t next_vertex_id = StartNodeVertex_(next_start);
+            UnitigGraphVertex &next_vertex = vertices_[next_vertex_id];
             assert(!next_vertex.is_deleted);
 
             bool is_rc = next_vertex.start_node != next_start;
-            linear_path.push_back(std::make_pair(next_vertex_iter->second, is_rc));
+            linear_path.push_back(std::make_pair(next_vertex_id, is_rc));
 
             cur_end = is_rc ? next_vertex.rev_end_node : next_vertex.end_node;
         }
@@ -748,13 +949,15 @@ void UnitigGraph::Refresh_(bool set_changed) {
             continue;
         }
 
-        if (i != linear_path.back().first && !omp_test_lock(&locks_[linear_path.back().first])) { // if i == linear_path.back().first, it is a palindrome self loop
+        if (i != linear_path.back().first && !locks_.try_lock(linear_path.back().first)) { // if i == linear_path.back().first, it is a palindrome self loop
             if (linear_path.back().first > i) {
-                omp_unset_lock(&locks_[i]);
+                locks_.unset(i);
                 continue;
             }
             else {
-                omp_set_lock(&locks_[linear_path.back().first]);
+                // the owner has a larger id, so it is about to give up
+                while (!locks_.try_lock(linear_path.back().first)) {
+                }
             }
         }
 
@@ -824,9 +1027,8 @@ void UnitigGraph::Refresh_(bool set_changed) {
                         break;
                     }
 
-                    auto next_vertex_iter = start_node_map_.find(next_start);
-                    assert(next_vertex_iter != start_node_map_.end());
-                    UnitigGraphVertex &next_vertex = vertices_[next_vertex_iter->second];
+                    vertexID_t next_vertex_id = StartNodeVertex_(next_start);
+                    UnitigGraphVertex &next_vertex = vertices_[next_vertex_id];
 
                     if (next_vertex.is_deleted) {
                         // that means the loop has alrealy gone through its rc
@@ -857,18 +1059,14 @@ void UnitigGraph::Refresh_(bool set_changed) {
     for (vertexID_t i = 0; i < vertices_.size(); ++i) {
         if (!vertices_[i].is_deleted) {
             vertices_[i].is_marked = false;
-            start_node_map_[vertices_[i].rev_start_node] = i;
+            StartNodeVertex_(vertices_[i].rev_start_node) = i;
         }
         else {
             assert(!vertices_[i].is_marked);
         }
     }
 
-    #pragma omp parallel for
-
-    for (vertexID_t i = 0; i < vertices_.size(); ++i) {
-        omp_unset_lock(&locks_[i]);
-    }
+    locks_.reset(vertices_.size());
 
     omp_destroy_lock(&reassemble_lock);
 }
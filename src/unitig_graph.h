@@ -26,11 +26,16 @@
 #include <assert.h>
 #include <omp.h>
 
-#include "hash_map.h"
+#include "atomic_bit_vector.h"
+#include "rank_and_select.h"
 #include "histgram.h"
 
 class SuccinctDBG;
-struct UnitigGraphVertex {
+
+// 40-bit edge ids hold SdBGs of up to 5.5e11 edges, so that a vertex packs into 32 bytes
+struct __attribute__((packed)) UnitigGraphVertex {
+    static const int kEdgeIdBits = 40;
+
     UnitigGraphVertex(int64_t start_node, int64_t end_node,
                       int64_t rev_start_node, int64_t rev_end_node, int64_t depth, uint32_t length):
         start_node(start_node), end_node(end_node), rev_start_node(rev_start_node),
@@ -43,28 +48,30 @@ struct UnitigGraphVertex {
         is_palindrome = false;
     }
 
-    int64_t start_node, end_node;
-    int64_t rev_start_node, rev_end_node;
+    int64_t start_node: kEdgeIdBits, end_node: kEdgeIdBits;
+    int64_t rev_start_node: kEdgeIdBits, rev_end_node: kEdgeIdBits;
     int64_t depth: 60; // if is_loop, depth is equal to average depth
+    uint32_t length: 30;
     bool is_deleted: 1;
     bool is_changed: 1;
     bool is_marked: 1;
     bool is_dead: 1;
     bool is_loop: 1;
-    uint32_t length: 30;
     bool is_palindrome: 1;
 
-    UnitigGraphVertex ReverseComplement() {
+    UnitigGraphVertex ReverseComplement() const {
         UnitigGraphVertex ret = *this;
-        std::swap(ret.start_node, ret.rev_start_node);
-        std::swap(ret.end_node, ret.rev_end_node);
+        ret.start_node = rev_start_node;
+        ret.rev_start_node = start_node;
+        ret.end_node = rev_end_node;
+        ret.rev_end_node = end_node;
         return ret;
     }
 
-    int64_t Representation() {
-        int64_t ret = std::max(start_node, end_node);
-        ret = std::max(rev_start_node, ret);
-        ret = std::max(rev_end_node, ret);
+    int64_t Representation() const {
+        int64_t ret = std::max<int64_t>(start_node, end_node);
+        ret = std::max<int64_t>(rev_start_node, ret);
+        ret = std::max<int64_t>(rev_end_node, ret);
         return ret;
     }
 };
@@ -74,16 +81,12 @@ class UnitigGraph {
     typedef uint32_t vertexID_t;
 
     UnitigGraph(SuccinctDBG *sdbg): sdbg_(sdbg) {}
-    ~UnitigGraph() {
-        for (vertexID_t i = 0; i < locks_.size(); ++i) {
-            omp_destroy_lock(&locks_[i]);
-        }
-    }
 
     void InitFromSdBG(Histgram<int64_t> *hist = NULL, FILE *out = NULL, int min_contig = 0);
     uint32_t size() {
         return vertices_.size();
     }
+    uint32_t RemoveTips(int max_tip_len);
     int64_t RemoveLowDepth(double min_depth);
     bool RemoveLocalLowDepth(double min_depth, int min_len, int local_width, double local_ratio, int64_t &num_removed, bool permanent_rm = false);
     uint32_t MergeBubbles(bool permanent_rm, bool careful, FILE *bubble_file, Histgram<int64_t> &hist);
@@ -96,14 +99,23 @@ class UnitigGraph {
     // functions
     double LocalDepth_(vertexID_t id, int local_width);
     void Refresh_(bool set_changed = true);
+    void BuildStartNodeIndex_();
+
+    // the vertex starting from start_node on either strand; start nodes are indexed by their rank among all of them
+    vertexID_t &StartNodeVertex_(int64_t start_node) {
+        assert((start_node_bits_[start_node / 64] >> (start_node % 64)) & 1);
+        return start_node_vertex_[start_node_rank_.Rank(start_node) - 1];
+    }
 
   private:
     // data
     static const size_t kMaxNumVertices;// = std::numeric_limits<vertexID_t>::max();
     SuccinctDBG *sdbg_;
-    HashMap<int64_t, vertexID_t> start_node_map_;
+    std::vector<unsigned long long> start_node_bits_;
+    RankAndSelect1Bit<true> start_node_rank_;
+    std::vector<vertexID_t> start_node_vertex_;
     std::vector<UnitigGraphVertex> vertices_;
-    std::vector<omp_lock_t> locks_;
+    AtomicBitVector locks_; // bit spinlocks of the vertices, held through Refresh_()
 };
 
 #endif // UNITIG_GRAPH_H_
\ No newline at end of file